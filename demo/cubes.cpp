@@ -1,17 +1,32 @@
 #include <imgui.h>
 #include <glm/gtc/color_space.hpp>
+#include <glm/gtc/packing.hpp>
+#include <fstream>
 #include "demo.hpp"
 #include "liblava-extras/raytracing.hpp"
 
 using namespace lava;
 using namespace lava::extras::raytracing;
 
+enum accumulation_mode : uint32_t {
+    accumulation_off = 0,
+    // average all frames since the camera or an instance last moved
+    accumulation_progressive,
+    // blend with the reprojected history of the last frame
+    accumulation_temporal,
+    // jittered samples accumulated and filtered by the denoiser
+    accumulation_denoise
+};
+
 struct uniform_data {
     glm::mat4 inv_view;
     glm::mat4 inv_proj;
+    glm::mat4 prev_view_proj;
     glm::uvec4 viewport;
     glm::vec4 background_color;
-    uint32_t max_depth;
+    uint32_t frame_index;
+    uint32_t sample_count; // frames in the history, 0 discards it
+    uint32_t accumulation_mode;
 } uniforms;
 
 struct instance_data {
@@ -19,6 +34,41 @@ struct instance_data {
     uint32_t vertex_count;
     uint32_t index_base;
     uint32_t index_count;
+    glm::vec4 color;
+};
+
+enum execution_mode : int {
+    // one raygen shader traces all bounces of a pixel
+    execution_megakernel = 0,
+    // ray queues with a trace, sort and shading pass per bounce
+    execution_wavefront
+};
+
+enum scene_mode : int {
+    // the animated cubes of top_as
+    scene_cubes = 0,
+    // a static grid of cubes, the instances are generated and culled on the GPU
+    scene_gpu_grid,
+    // the same grid as a wave, the instances are written by job threads every frame
+    scene_cpu_grid,
+    // the glTF file passed with --gltf=<path>, filled in while it's loading
+    scene_gltf
+};
+
+// read by the closest-hit shader to find the geometry table and the instance transforms of the last frame
+// the wavefront passes also read the geometry table, wavefront::push_constants follow right after
+struct push_constant_data {
+    VkDeviceAddress geometry_table;
+    VkDeviceAddress previous_transforms;
+};
+
+// read by deform.comp
+struct deform_push_constants {
+    VkDeviceAddress base_vertices;
+    VkDeviceAddress positions;
+    VkDeviceAddress vertices;
+    uint32_t vertex_count;
+    float time;
 };
 
 int main(int argc, char* argv[]) {
@@ -29,6 +79,13 @@ int main(int argc, char* argv[]) {
 
     app app(env);
 
+    std::string gltf_path;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg.starts_with("--gltf="))
+            gltf_path = arg.substr(std::strlen("--gltf="));
+    }
+
     app.config.surface.formats = { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB };
 
     device::ptr device = create_raytracing_device(app.platform);
@@ -44,19 +101,24 @@ int main(int argc, char* argv[]) {
     // this combination exists as long as the device supports graphics queues
     queue::ref queue = app.device->graphics_queue();
 
-    const size_t uniform_stride = align_up(sizeof(uniform_data), app.device->get_physical_device()->get_properties().limits.minUniformBufferOffsetAlignment);
-
     mesh::ptr cube = create_mesh(app.device, mesh_type::cube);
     if (!cube)
         return error::create_failed;
     mesh_data& mesh = cube->get_data();
     mesh.scale(0.333f);
 
+    // triangles in Morton order for the attribute fetches in the hit shaders, the cube has no thin triangles to split
+    triangle_preprocessor preprocessor;
+    preprocessor.process(mesh);
+    log()->info("cube mesh preprocessed, {} triangles ({} split)", mesh.indices.size() / 3, preprocessor.get_split_count());
+
     std::vector<instance_data> instances;
     std::vector<vertex> vertices;
     std::vector<lava::index> indices;
 
-    // combined vertex and index buffers for all meshes
+    // vertex and index buffers for the cube mesh
+    // all instances use the same mesh, so it's only stored once
+    // shaders find it through the geometry table, the per-instance color is stored in the table entry
 
     constexpr size_t INSTANCE_COUNT = 2;
     const glm::vec3 instance_colors[INSTANCE_COUNT] = {
@@ -64,17 +126,20 @@ int main(int argc, char* argv[]) {
         glm::vec3(0.063f, 0.812f, 0.749f)
     };
 
+    // a third cube is deformed on the GPU and gets its own BLAS, it's the last TLAS instance
+    constexpr size_t TLAS_INSTANCE_COUNT = INSTANCE_COUNT + 1;
+    const glm::vec3 deform_color = glm::vec3(0.812f, 0.749f, 0.063f);
+
+    vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+    indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+
     for (size_t i = 0; i < INSTANCE_COUNT; i++) {
-        const instance_data instance = { .vertex_base = uint32_t(vertices.size()),
+        const instance_data instance = { .vertex_base = 0,
                                          .vertex_count = uint32_t(mesh.vertices.size()),
-                                         .index_base = uint32_t(indices.size()),
-                                         .index_count = uint32_t(mesh.indices.size()) };
+                                         .index_base = 0,
+                                         .index_count = uint32_t(mesh.indices.size()),
+                                         .color = { glm::convertSRGBToLinear(instance_colors[i]), 1.0f } };
         instances.push_back(instance);
-        vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
-        std::for_each(vertices.begin() + instance.vertex_base, vertices.end(), [&](vertex& v) {
-            v.color = { glm::convertSRGBToLinear(instance_colors[i]), 1.0f };
-        });
-        indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
     }
 
     cube->destroy();
@@ -89,28 +154,136 @@ int main(int argc, char* argv[]) {
     descriptor::ptr shared_descriptor_set_layout;
     VkDescriptorSet shared_descriptor_set;
 
-    pipeline_layout::ptr raytracing_pipeline_layout;
-    raytracing_pipeline::ptr raytracing_pipeline;
-
-    shader_binding_table::ptr shader_binding;
+    // set 0 is the shared set, set 1 is a push descriptor set
+    VkPipelineLayout raytracing_pipeline_layout = VK_NULL_HANDLE;
+    // the ray depth and flags are specialization constants, each combination gets its own pipeline and SBT
+    pipeline_variants::ptr raytracing_variants;
+    int max_depth = 5;
+
+    const auto make_constants = [](int depth) {
+        specialization constants;
+        constants.set<uint32_t>(0, depth);
+        constants.set<uint32_t>(1, 0x01 | 0x10); // gl_RayFlagsOpaqueEXT | gl_RayFlagsCullBackFacingTrianglesEXT
+        constants.set<float>(2, 5.0f); // max distance
+        return constants;
+    };
 
-    descriptor::ptr raytracing_descriptor_set_layout;
-    VkDescriptorSet raytracing_descriptor_set;
+    // wavefront execution of the same scene, one material per cube
+    // the trace pipeline shares raytracing_pipeline_layout, the compute passes use a compatible layout for set 0 and the push constants
+    wavefront::ptr wavefront_tracer;
+    wavefront::passes wavefront_passes;
+    pipeline_layout::ptr wavefront_compute_layout;
+    int execution = execution_megakernel;
+    int last_execution = execution_megakernel;
+
+    // GPU time of the trace, two timestamps per frame in flight
+    VkQueryPool timestamp_pool = VK_NULL_HANDLE;
+    std::vector<bool> timestamps_written;
+    float trace_ms = 0.0f;
+    uint32_t traced_rays = 0;
+
+    // traces a screenshot at twice the window size in tiles and writes it to cubes_screenshot.ppm
+    // tiled.rgen writes the tiles to set 1, binding 6, the other raygen shaders don't use it
+    tiled_tracer::ptr screenshot_tracer;
+    pipeline_variants::variant screenshot_pipeline;
+    bool screenshot_requested = false;
+
+    // cube map faces around a point between the cubes, traced in one launch and copied to a strip in the top left corner
+    // probe.rgen writes the faces to set 1, binding 7
+    constexpr uint32_t PROBE_SIZE = 96;
+    multi_view::ptr probe_views;
+    pipeline_variants::variant probe_pipeline;
+    bool show_probe = false;
+
+    // frees acceleration structures and the SBT once no frame in flight uses them anymore
+    deletion_queue::ptr deletion;
+
+    // TLAS and accumulation images, pushed with every dispatch instead of written to an allocated set
+    push_descriptor::ptr raytracing_bindings;
+
+    // BLAS objects and their geometry arrays, declared before the structures so it outlives them (locals are destroyed in reverse order)
+    host_pool blas_pool;
 
     top_level_acceleration_structure::ptr top_as;
     bottom_level_acceleration_structure::list bottom_as_list;
 
-    buffer::ptr scratch_buffer;
-    VkDeviceAddress scratch_buffer_address = 0;
+    // BLAS device memory, suballocated from a few blocks and defragmented a few structures per frame
+    structure_heap::ptr blas_heap;
+
+    // instances with identical geometry share a BLAS
+    blas_registry registry;
+    // index into bottom_as_list per instance, the order is kept when compacting
+    std::vector<size_t> instance_blas;
+
+    // vertex and index buffer addresses of each instance's geometry, indexed by gl_InstanceCustomIndexEXT + gl_GeometryIndexEXT
+    geometry_table::ptr geometries;
+
+    // scratch memory for the per-frame TLAS update, one region per frame in flight
+    scratch_allocator::ptr frame_scratch;
+
+    // the grid scene references the BLAS of the first cube, its TLAS is built from instances written by instance_generator.comp
+    constexpr uint32_t GRID_SIZE = 32;
+    instance_generator::ptr grid_generator;
+    // BLAS address the grid objects were written with, 0 while the cube BLAS is evicted
+    VkDeviceAddress grid_blas_address = 0;
+    float grid_cull_scale = 1.0f;
+    // the CPU grid's TLAS reads the instance buffer of the frame from grid_writer
+    // its slots are written by the threads of grid_jobs, one task per band of rows
+    instance_writer::ptr grid_writer;
+    job_pool grid_jobs;
+    constexpr uint32_t GRID_TASK_COUNT = 4;
+    std::vector<instance_writer::slot> grid_slots;
+    top_level_acceleration_structure::ptr grid_tlas;
+    int scene = scene_cubes;
+    int last_scene = scene_cubes;
+
+    // nullptr without --gltf, meshes are decoded in the background and built a few per frame
+    // their instances are activated in the glTF TLAS once the builds are recorded
+    gltf_loader::ptr gltf;
+    scratch_allocator::ptr gltf_scratch;
+    instance_writer::ptr gltf_writer;
+    std::vector<instance_writer::slot> gltf_slots;
+    top_level_acceleration_structure::ptr gltf_tlas;
+    // first geometry table entry of each glTF mesh
+    std::vector<uint32_t> gltf_table_bases;
+
+    // evicts BLAS that weren't used recently when over the memory limit, serialized to host memory and restored on use
+    residency_manager::ptr residency;
+    std::vector<residency_manager::entry> residency_entries;
+    // 0 uses the device budget, or a share of the device local heaps without VK_EXT_memory_budget
+    int residency_limit_kb = 0;
+    // stops touching the cube BLAS, as if they were out of view
+    bool release_cubes = false;
 
-    buffer::ptr instance_buffer;
     buffer::ptr vertex_buffer;
     buffer::ptr index_buffer;
 
-    buffer::ptr uniform_buffer;
+    // squashes and stretches the third cube with a compute pass, its BLAS is refit from the positions every frame
+    deformable_group::ptr deform_group;
+    deformable_mesh::ptr deform_mesh;
+    // the deformed vertices in the lava::vertex layout for the hit shaders, the BLAS only reads the positions
+    buffer::ptr deformed_vertex_buffer;
+    pipeline_layout::ptr deform_layout;
+    compute_pipeline::ptr deform_pipeline;
+    bool deform = true;
+    float deform_time = 0.0f;
+
+    // transient per-frame uploads: uniforms, last frame's instance transforms for motion vectors and TLAS instances
+    upload_ring::ptr frame_uploads;
+    // dynamic offset of this frame's uniforms, also used by the blit pass
+    uint32_t uniform_offset = 0;
 
     image::ptr output_image;
 
+    // accumulated color, the images swap between history and output every frame
+    std::array<image::ptr, 2> accumulation_images;
+
+    // filters output_image in place, the raygen shader writes its G-buffer
+    denoiser::ptr output_denoiser;
+
+    glm::mat4 last_view_proj = glm::mat4(1.0f);
+    uint32_t last_accumulation_mode = accumulation_off;
+
     // catch swapchain recreation
     // recreate raytracing image and update its descriptors
     target_callback swapchain_callback;
@@ -121,10 +294,17 @@ int main(int argc, char* argv[]) {
             uniforms.inv_proj = glm::inverse(perspective_matrix(size, 90.0f, 5.0f));
             uniforms.viewport = { area.get_origin(), size };
 
+            // the history doesn't match the new size
+            uniforms.sample_count = 0;
+
             if (!output_image->create(app.device, size))
                 return false;
+            for (image::ptr& accumulation_image : accumulation_images) {
+                if (!accumulation_image->create(app.device, size))
+                    return false;
+            }
 
-            // update image descriptor
+            // update image descriptor, the blit shader reads it from the shared set
             const VkDescriptorImageInfo image_info = { .sampler = VK_NULL_HANDLE,
                                                        .imageView = output_image->get_view(),
                                                        .imageLayout = VK_IMAGE_LAYOUT_GENERAL };
@@ -136,22 +316,46 @@ int main(int argc, char* argv[]) {
                                                       .pImageInfo = &image_info };
             app.device->vkUpdateDescriptorSets({ write_info });
 
-            // transition image to general layout
+            // only raygen reads the accumulation images, they're pushed with the next dispatch
+            raytracing_bindings->set_image(1, accumulation_images[0]->get_view());
+            raytracing_bindings->set_image(2, accumulation_images[1]->get_view());
+
+            // the pipelines are created once in on_create, only the images and queues follow the size
+            if (!output_denoiser->resize(output_image))
+                return false;
+            raytracing_bindings->set_image(3, output_denoiser->get_normal_depth()->get_view());
+            raytracing_bindings->set_image(4, output_denoiser->get_albedo()->get_view());
+            raytracing_bindings->set_image(5, output_denoiser->get_motion()->get_view());
+
+            // one ray per pixel and bounce
+            if (!wavefront_tracer->resize(size.x * size.y))
+                return false;
+            wavefront_passes.generate_groups = { (size.x + 7) / 8, (size.y + 7) / 8, 1 };
+
+            // transition images to general layout
             return one_time_submit_pool(
                 app.device, pool, queue, [&](VkCommandBuffer cmd_buf) {
-                    insert_image_memory_barrier(app.device, cmd_buf, output_image->get(), 0, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
-                                                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, output_image->get_subresource_range());
+                    for (const image::ptr& img : { output_image, accumulation_images[0], accumulation_images[1],
+                                                   output_denoiser->get_normal_depth(), output_denoiser->get_albedo(), output_denoiser->get_motion() }) {
+                        insert_image_memory_barrier(app.device, cmd_buf, img->get(), 0, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, img->get_subresource_range());
+                    }
                 });
         };
 
     swapchain_callback.on_destroyed = [&]() {
         app.device->wait_for_idle();
         output_image->destroy();
+        for (image::ptr& accumulation_image : accumulation_images)
+            accumulation_image->destroy();
     };
 
     app.target->add_callback(&swapchain_callback);
 
     app.on_create = [&]() {
+        deletion = make_deletion_queue();
+        deletion->create(app.target->get_frame_count());
+
         // command pool for one-time command buffers
         const VkCommandPoolCreateInfo create_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
                                                       .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
@@ -160,19 +364,25 @@ int main(int argc, char* argv[]) {
             return false;
 
         descriptor_pool = descriptor::pool::make();
-        constexpr uint32_t set_count = 2;
+        constexpr uint32_t set_count = 1;
         const VkDescriptorPoolSizes sizes = {
             { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
-            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 },
-            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
-            { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1 }
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 }
         };
         if (!descriptor_pool->create(app.device, sizes, set_count, 0))
             return false;
 
-        // uniform buffer for camera parameters and background color
-        uniform_buffer = buffer::make();
-        if (!uniform_buffer->create_mapped(app.device, nullptr, app.target->get_frame_count() * uniform_stride, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT))
+        const VkQueryPoolCreateInfo query_pool_info = { .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                                                        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                                                        .queryCount = 2 * app.target->get_frame_count() };
+        if (!check(app.device->call().vkCreateQueryPool(app.device->get(), &query_pool_info, memory::instance().alloc(), &timestamp_pool)))
+            return false;
+        timestamps_written.assign(app.target->get_frame_count(), false);
+
+        // one region per frame in flight, a few KB is plenty for the uniforms and TLAS_INSTANCE_COUNT instances
+        frame_uploads = make_upload_ring();
+        if (!frame_uploads->create(app.device, 4096 + TLAS_INSTANCE_COUNT * (sizeof(VkTransformMatrixKHR) + sizeof(VkAccelerationStructureInstanceKHR)),
+                                   app.target->get_frame_count()))
             return false;
 
         // output image for the raytracing shader
@@ -183,10 +393,20 @@ int main(int argc, char* argv[]) {
         output_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
         output_image->set_aspect_mask(format_aspect_mask(format));
 
+        // RGBA32F for precision when averaging many frames, also guaranteed to support storage
+        const VkFormat accumulation_format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        for (image::ptr& accumulation_image : accumulation_images) {
+            accumulation_image = image::make(accumulation_format);
+            accumulation_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT);
+            accumulation_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+            accumulation_image->set_aspect_mask(format_aspect_mask(accumulation_format));
+        }
+
         // descriptor set used by the raytracing shaders and the blit shader
         shared_descriptor_set_layout = descriptor::make();
-        shared_descriptor_set_layout->add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR);
-        shared_descriptor_set_layout->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        // the wavefront generate and shading passes write the output image in compute
+        shared_descriptor_set_layout->add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
         if (!shared_descriptor_set_layout->create(app.device))
             return false;
 
@@ -213,7 +433,6 @@ int main(int argc, char* argv[]) {
             return false;
 
         blit_pipeline->on_process = [&](VkCommandBuffer cmd_buf) {
-            const uint32_t uniform_offset = app.block.get_current_frame() * uniform_stride;
             app.device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, blit_pipeline_layout->get(), 0, 1, &shared_descriptor_set, 1, &uniform_offset);
             // fullscreen triangle
             // no vertex buffer, attributes are generated in the vertex shader
@@ -224,87 +443,199 @@ int main(int argc, char* argv[]) {
         render_pass->add_front(blit_pipeline);
 
         // descriptor used by the raytracing shader
-        raytracing_descriptor_set_layout = descriptor::make();
-        raytracing_descriptor_set_layout->add_binding(0, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
-        raytracing_descriptor_set_layout->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
-        raytracing_descriptor_set_layout->add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
-        raytracing_descriptor_set_layout->add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
-        if (!raytracing_descriptor_set_layout->create(app.device))
+        raytracing_bindings = make_push_descriptor();
+        raytracing_bindings->add_binding(0, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        raytracing_bindings->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        raytracing_bindings->add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        // denoiser G-buffer
+        raytracing_bindings->add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        raytracing_bindings->add_binding(4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        raytracing_bindings->add_binding(5, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        // screenshot tiles
+        raytracing_bindings->add_binding(6, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        // probe faces
+        raytracing_bindings->add_binding(7, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        if (!raytracing_bindings->create(app.device))
             return false;
 
-        raytracing_pipeline_layout = pipeline_layout::make();
-        raytracing_pipeline_layout->add(shared_descriptor_set_layout);
-        raytracing_pipeline_layout->add(raytracing_descriptor_set_layout);
-        if (!raytracing_pipeline_layout->create(app.device))
+        // the wavefront constants follow the demo's, both pipelines push to all stages of the range
+        const VkPushConstantRange push_constant_range = { .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT,
+                                                          .offset = 0,
+                                                          .size = sizeof(push_constant_data) + sizeof(wavefront::push_constants) };
+
+        if (!push_descriptor::create_pipeline_layout(app.device, { shared_descriptor_set_layout->get(), raytracing_bindings->get() },
+                                                     { push_constant_range }, raytracing_pipeline_layout))
             return false;
 
-        raytracing_descriptor_set = raytracing_descriptor_set_layout->allocate(descriptor_pool->get());
+        if (!raytracing_bindings->create_template(raytracing_pipeline_layout, 1))
+            return false;
 
+        raytracing_variants = make_pipeline_variants();
         // raytracing pipeline with raygen, miss and closest-hit shader
-        raytracing_pipeline = make_raytracing_pipeline(app.device);
+        // only the raygen shader uses the constants, the screenshot pipeline only swaps the raygen shader
+        const auto create_raytracing_pipeline = [&](const char* raygen_filename, const specialization& constants) {
+            raytracing_pipeline::ptr raytracing_pipeline = make_raytracing_pipeline(app.device);
+
+            if (!raytracing_pipeline->add_shader(file_data(raygen_filename), VK_SHADER_STAGE_RAYGEN_BIT_KHR, constants))
+                return pipeline_variants::variant{};
+            if (!raytracing_pipeline->add_shader(file_data("cubes/rmiss.spv"), VK_SHADER_STAGE_MISS_BIT_KHR))
+                return pipeline_variants::variant{};
+            if (!raytracing_pipeline->add_shader(file_data("cubes/rchit.spv"), VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR))
+                return pipeline_variants::variant{};
+            if (!raytracing_pipeline->add_shader(file_data("cubes/rcall.spv"), VK_SHADER_STAGE_CALLABLE_BIT_KHR))
+                return pipeline_variants::variant{};
+
+            enum rt_stage : uint32_t {
+                // this reflects the order they're added in above
+                raygen = 0,
+                miss,
+                closest_hit,
+                callable
+            };
+
+            // shader_binding_table expects the groups to be in this order
+            raytracing_pipeline->add_shader_general_group(raygen);
+            raytracing_pipeline->add_shader_general_group(miss);
+            raytracing_pipeline->add_shader_hit_group(closest_hit);
+            raytracing_pipeline->add_shader_general_group(callable);
+
+            raytracing_pipeline->set_max_recursion_depth(1);
+            raytracing_pipeline->set_layout(raytracing_pipeline_layout);
+
+            if (!raytracing_pipeline->create())
+                return pipeline_variants::variant{};
+
+            // shader binding table
+
+            // shaderRecordEXT buffer data for the callable shader
+            // directional light vector for diffuse lighting
+            struct callable_record_data {
+                glm::vec3 direction = { 0.0f, 0.0f, 1.0f };
+            } callable_record;
+
+            std::vector records(raytracing_pipeline->get_shader_groups().size(), cdata(nullptr, 0));
+            records[callable] = cdata(&callable_record, sizeof(callable_record));
+
+            shader_binding_table::ptr shader_binding = make_shader_binding_table();
+            shader_binding->set_deletion_queue(deletion);
+            if (!shader_binding->create(raytracing_pipeline, records)) {
+                raytracing_pipeline->destroy();
+                return pipeline_variants::variant{};
+            }
+
+            return pipeline_variants::variant{ .pipeline = raytracing_pipeline, .sbt = shader_binding };
+        };
+
+        raytracing_variants->set_create_func([create_raytracing_pipeline](const specialization& constants) {
+            return create_raytracing_pipeline("cubes/rgen.spv", constants);
+        });
 
-        if (!raytracing_pipeline->add_shader(file_data("cubes/rgen.spv"), VK_SHADER_STAGE_RAYGEN_BIT_KHR))
+        // create all variants the depth slider can select upfront
+        for (int depth = 1; depth <= 5; depth++) {
+            if (!raytracing_variants->get(make_constants(depth)).pipeline)
+                return false;
+        }
+
+        // screenshots always use the full depth
+        screenshot_pipeline = create_raytracing_pipeline("cubes/tiled_rgen.spv", make_constants(5));
+        if (!screenshot_pipeline.pipeline)
             return false;
-        if (!raytracing_pipeline->add_shader(file_data("cubes/rmiss.spv"), VK_SHADER_STAGE_MISS_BIT_KHR))
+
+        // RGBA8 is guaranteed to support storage, tiled.rgen encodes sRGB itself
+        screenshot_tracer = make_tiled_tracer();
+        if (!screenshot_tracer->create(app.device, queue, VK_FORMAT_R8G8B8A8_UNORM, 4, { 256, 256 }))
             return false;
-        if (!raytracing_pipeline->add_shader(file_data("cubes/rchit.spv"), VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR))
+        screenshot_tracer->set_push_constant_stages(push_constant_range.stageFlags);
+        raytracing_bindings->set_image(6, screenshot_tracer->get_image()->get_view());
+
+        probe_pipeline = create_raytracing_pipeline("cubes/probe_rgen.spv", make_constants(5));
+        if (!probe_pipeline.pipeline)
             return false;
-        if (!raytracing_pipeline->add_shader(file_data("cubes/rcall.spv"), VK_SHADER_STAGE_CALLABLE_BIT_KHR))
+
+        // same format as the output image, the faces are copied into it
+        probe_views = make_multi_view();
+        if (!probe_views->create(app.device, VK_FORMAT_R16G16B16A16_SFLOAT, { PROBE_SIZE, PROBE_SIZE }, 6, app.target->get_frame_count(),
+                                 VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
             return false;
+        raytracing_bindings->set_image(7, probe_views->get_image()->get_view());
 
-        enum rt_stage : uint32_t {
-            // this reflects the order they're added in above
-            raygen = 0,
-            miss,
-            closest_hit,
-            callable
-        };
+        // wavefront passes
+        // the raygen shader only traces and stores the hit, shading moves to compute
 
-        // shader_binding_table expects the groups to be in this order
-        raytracing_pipeline->add_shader_general_group(raygen);
-        raytracing_pipeline->add_shader_general_group(miss);
-        raytracing_pipeline->add_shader_hit_group(closest_hit);
-        raytracing_pipeline->add_shader_general_group(callable);
+        raytracing_pipeline::ptr wavefront_trace = make_raytracing_pipeline(app.device);
+        if (!wavefront_trace->add_shader(file_data("cubes/wavefront_rgen.spv"), VK_SHADER_STAGE_RAYGEN_BIT_KHR))
+            return false;
+        if (!wavefront_trace->add_shader(file_data("cubes/wavefront_rmiss.spv"), VK_SHADER_STAGE_MISS_BIT_KHR))
+            return false;
+        if (!wavefront_trace->add_shader(file_data("cubes/wavefront_rchit.spv"), VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR))
+            return false;
 
-        raytracing_pipeline->set_max_recursion_depth(1);
-        raytracing_pipeline->set_layout(raytracing_pipeline_layout);
+        wavefront_trace->add_shader_general_group(0);
+        wavefront_trace->add_shader_general_group(1);
+        wavefront_trace->add_shader_hit_group(2);
 
-        if (!raytracing_pipeline->create())
+        wavefront_trace->set_max_recursion_depth(1);
+        wavefront_trace->set_layout(raytracing_pipeline_layout);
+        if (!wavefront_trace->create())
             return false;
 
-        // shader binding table
+        shader_binding_table::ptr wavefront_sbt = make_shader_binding_table();
+        if (!wavefront_sbt->create(wavefront_trace))
+            return false;
 
-        // shaderRecordEXT buffer data for the callable shader
-        // directional light vector for diffuse lighting
-        struct callable_record_data {
-            glm::vec3 direction = { 0.0f, 0.0f, 1.0f };
-        } callable_record;
+        // same set 0 and push constant range as raytracing_pipeline_layout, so bindings and push constants stay valid between the passes
+        wavefront_compute_layout = pipeline_layout::make();
+        wavefront_compute_layout->add(shared_descriptor_set_layout);
+        wavefront_compute_layout->add(push_constant_range);
+        if (!wavefront_compute_layout->create(app.device))
+            return false;
 
-        std::vector records(raytracing_pipeline->get_shader_groups().size(), cdata(nullptr, 0));
-        records[callable] = cdata(&callable_record, sizeof(callable_record));
+        const auto make_wavefront_pass = [&](const char* filename) {
+            compute_pipeline::ptr pass = compute_pipeline::make(app.device);
+            if (!pass->set_shader_stage(file_data(filename), VK_SHADER_STAGE_COMPUTE_BIT))
+                return compute_pipeline::ptr();
+            pass->set_layout(wavefront_compute_layout);
+            if (!pass->create())
+                return compute_pipeline::ptr();
+            return pass;
+        };
 
-        shader_binding = make_shader_binding_table();
-        if (!shader_binding->create(raytracing_pipeline, records))
+        // all cubes have the same material model, the first two still get separate bins and dispatches
+        compute_pipeline::ptr wavefront_shade = make_wavefront_pass("cubes/wavefront_shade.spv");
+        compute_pipeline::ptr wavefront_miss = make_wavefront_pass("cubes/wavefront_miss.spv");
+        wavefront_passes.generate = make_wavefront_pass("cubes/wavefront_generate.spv");
+        if (!wavefront_shade || !wavefront_miss || !wavefront_passes.generate)
             return false;
 
+        wavefront_passes.trace = wavefront_trace;
+        wavefront_passes.sbt = wavefront_sbt;
+        wavefront_passes.shade.assign(INSTANCE_COUNT, wavefront_shade);
+        wavefront_passes.shade.push_back(wavefront_miss);
+        wavefront_passes.layout = raytracing_pipeline_layout;
+        wavefront_passes.push_constant_offset = sizeof(push_constant_data);
+
         // ideally, these buffers would all be device-local (VMA_MEMORY_USAGE_GPU_ONLY) but to keep the demo code short they're host-visible to skip a staging buffer copy
-        instance_buffer = buffer::make();
-        if (!instance_buffer->create(app.device, instances.data(), sizeof(instance_data) * instances.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, false, VMA_MEMORY_USAGE_CPU_TO_GPU))
-            return false;
+        // shaders read vertices and indices through buffer references, so they only need the device address usage
         vertex_buffer = buffer::make();
-        if (!vertex_buffer->create(app.device, vertices.data(), sizeof(vertex) * vertices.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, false, VMA_MEMORY_USAGE_CPU_TO_GPU))
+        if (!vertex_buffer->create(app.device, vertices.data(), sizeof(vertex) * vertices.size(), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, false, VMA_MEMORY_USAGE_CPU_TO_GPU))
             return false;
         index_buffer = buffer::make();
-        if (!index_buffer->create(app.device, indices.data(), sizeof(lava::index) * indices.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, false, VMA_MEMORY_USAGE_CPU_TO_GPU))
+        if (!index_buffer->create(app.device, indices.data(), sizeof(lava::index) * indices.size(), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, false, VMA_MEMORY_USAGE_CPU_TO_GPU))
+            return false;
+
+        // glTF scenes get plenty of entries for their primitives
+        geometries = make_geometry_table();
+        if (!geometries->create(app.device, gltf_path.empty() ? 64 : 16384))
             return false;
 
         // create acceleration structures
-        // - a BLAS (bottom level) for each mesh
+        // - a BLAS (bottom level) for each unique mesh
         // - one TLAS (top level) referencing all the BLAS
 
         constexpr bool COMPACT_BLAS = true;
 
         top_as = make_top_level_acceleration_structure();
+        top_as->set_deletion_queue(deletion);
 
         // buffer data, common to all BLAS
         const VkAccelerationStructureGeometryTrianglesDataKHR triangles = { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
@@ -315,8 +646,20 @@ int main(int argc, char* argv[]) {
                                                                             .indexType = VK_INDEX_TYPE_UINT32,
                                                                             .indexData = { index_buffer->get_address() } };
 
+        // scratch memory for the initial builds, freed once they're done
+        buffer::ptr scratch_buffer;
         VkDeviceSize scratch_buffer_size = 0;
 
+        const VkBuildAccelerationStructureFlagsKHR blas_flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | (COMPACT_BLAS ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR : 0);
+
+        // cube BLAS are tiny, small blocks keep the heap's footprint close to them
+        blas_heap = make_structure_heap();
+        if (!blas_heap->create(app.device, 64 * 1024, 16 * 1024))
+            return false;
+
+        registry.set_memory_resource(blas_pool.get_resource());
+        registry.set_structure_heap(blas_heap);
+
         for (size_t i = 0; i < instances.size(); i++) {
             const instance_data& instance = instances[i];
             // per-mesh sub-buffer region
@@ -326,25 +669,158 @@ int main(int argc, char* argv[]) {
                 .firstVertex = instance.vertex_base // but this is an index...
             };
 
-            bottom_level_acceleration_structure::ptr bottom_as = make_bottom_level_acceleration_structure();
-            bottom_as->add_geometry(triangles, range, VK_GEOMETRY_OPAQUE_BIT_KHR);
+            const blas_registry::triangles_geometry::list mesh_geometries = {
+                { .triangles = triangles,
+                  .range = range,
+                  .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+                  .vertices = cdata(&vertices[instance.vertex_base], sizeof(vertex) * instance.vertex_count),
+                  .indices = cdata(&indices[instance.index_base], sizeof(lava::index) * instance.index_count) }
+            };
+
+            bool created = false;
+            bottom_level_acceleration_structure::ptr bottom_as = registry.get_or_create(app.device, mesh_geometries, blas_flags, &created);
+            if (!bottom_as)
+                return false;
+
+            if (created) {
+                // compacted copies inherit the queue
+                bottom_as->set_deletion_queue(deletion);
+                bottom_as_list.push_back(bottom_as);
+            }
+
+            instance_blas.push_back(std::find(bottom_as_list.begin(), bottom_as_list.end(), bottom_as) - bottom_as_list.begin());
 
-            if (!bottom_as->create(app.device, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | (COMPACT_BLAS ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR : 0)))
+            // each instance gets its own table entries for its color, even if the BLAS is shared
+            const uint32_t material = glm::packUnorm4x8(instance.color);
+            uint32_t table_base = 0;
+            if (!geometries->add(*bottom_as, table_base, &material))
                 return false;
-            bottom_as_list.push_back(bottom_as);
-            scratch_buffer_size = std::max(scratch_buffer_size, bottom_as->scratch_buffer_size());
 
-            top_as->add_instance(bottom_as);
+            top_as->add_instance(bottom_as, table_base);
         }
 
+        // the deforming cube shares the index buffer, its vertices are written by deform.comp
+        deformed_vertex_buffer = buffer::make();
+        if (!deformed_vertex_buffer->create(app.device, nullptr, sizeof(vertex) * vertices.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, false, VMA_MEMORY_USAGE_GPU_ONLY))
+            return false;
+
+        deform_mesh = make_deformable_mesh();
+        if (!deform_mesh->create(app.device, uint32_t(vertices.size()), index_buffer->get_address(), uint32_t(indices.size())))
+            return false;
+
+        const geometry_table::entry deform_entry = { .vertices = deformed_vertex_buffer->get_address(),
+                                                     .indices = index_buffer->get_address(),
+                                                     .material = glm::packUnorm4x8(glm::vec4(glm::convertSRGBToLinear(deform_color), 1.0f)) };
+        uint32_t deform_table_base = 0;
+        if (!geometries->add(&deform_entry, 1, deform_table_base))
+            return false;
+        top_as->add_instance(deform_mesh->get_blas(), deform_table_base);
+        // stays in place above the others
+        top_as->set_instance_transform(INSTANCE_COUNT, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.75f, 0.25f)));
+
+        deform_layout = pipeline_layout::make();
+        deform_layout->add({ .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT, .offset = 0, .size = sizeof(deform_push_constants) });
+        if (!deform_layout->create(app.device))
+            return false;
+
+        deform_pipeline = compute_pipeline::make(app.device);
+        if (!deform_pipeline->set_shader_stage(file_data("cubes/deform.spv"), VK_SHADER_STAGE_COMPUTE_BIT))
+            return false;
+        deform_pipeline->set_layout(deform_layout);
+        if (!deform_pipeline->create())
+            return false;
+
+        deform_group = make_deformable_group();
+        deform_group->add(deform_mesh);
+        // refits loosen the BVH over time, a rebuild every few seconds keeps it tight
+        deform_group->set_rebuild_interval(300);
+        deform_group->on_skin = [&](VkCommandBuffer cmd_buf, const deformable_mesh::list& meshes) {
+            deform_pipeline->bind(cmd_buf);
+            for (const deformable_mesh::ptr& deformable : meshes) {
+                const deform_push_constants push_constants = { .base_vertices = vertex_buffer->get_address(),
+                                                               .positions = deformable->get_position_address(),
+                                                               .vertices = deformed_vertex_buffer->get_address(),
+                                                               .vertex_count = deformable->get_vertex_count(),
+                                                               .time = deform_time };
+                app.device->call().vkCmdPushConstants(cmd_buf, deform_layout->get(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+                app.device->call().vkCmdDispatch(cmd_buf, (deformable->get_vertex_count() + 63) / 64, 1, 1);
+            }
+        };
+
+        const allocation_stats blas_allocations = blas_pool.get_stats();
+        log()->info("{} BLAS created, the pool requested {} chunks ({} bytes) from the heap", bottom_as_list.size(), blas_allocations.allocations, blas_allocations.bytes);
+
         if (!top_as->create(app.device, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR))
             return false;
 
-        scratch_buffer_size = std::max(scratch_buffer_size, top_as->scratch_buffer_size());
+        // the demo device doesn't enable accelerationStructureIndirectBuild, so culled objects are masked out
+        grid_generator = make_instance_generator();
+        if (!grid_generator->create(app.device, file_data("cubes/instance_generator.spv"), GRID_SIZE * GRID_SIZE, app.target->get_frame_count(), false))
+            return false;
+        grid_generator->get_tlas()->set_deletion_queue(deletion);
+
+        // slots start out inactive, the job threads fill them in on the first frame
+        grid_writer = make_instance_writer();
+        if (!grid_writer->create(app.device, GRID_SIZE * GRID_SIZE, app.target->get_frame_count()))
+            return false;
+        for (uint32_t i = 0; i < GRID_SIZE * GRID_SIZE; i++)
+            grid_slots.push_back(grid_writer->allocate({}));
+        grid_jobs.create(GRID_TASK_COUNT);
+
+        grid_tlas = make_top_level_acceleration_structure();
+        grid_tlas->set_deletion_queue(deletion);
+        if (!grid_tlas->create(app.device, grid_writer->get_instance_data(0), grid_writer->get_capacity(),
+                               VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR))
+            return false;
+
+        if (!gltf_path.empty()) {
+            gltf = make_gltf_loader();
+            if (!gltf->load(app.device, gltf_path)) {
+                log()->error("failed to load glTF scene {}", gltf_path);
+                gltf = nullptr;
+            }
+        }
+
+        if (gltf) {
+            gltf_scratch = make_scratch_allocator();
+            if (!gltf_scratch->create(app.device, 16 * 1024 * 1024, app.target->get_frame_count()))
+                return false;
+
+            const uint32_t gltf_instance_count = std::max(uint32_t(gltf->get_instances().size()), 1u);
+            gltf_writer = make_instance_writer();
+            if (!gltf_writer->create(app.device, gltf_instance_count, app.target->get_frame_count()))
+                return false;
+            for (size_t i = 0; i < gltf->get_instances().size(); i++)
+                gltf_slots.push_back(gltf_writer->allocate({}));
+            gltf_table_bases.assign(gltf->get_mesh_count(), 0);
+
+            gltf_tlas = make_top_level_acceleration_structure();
+            gltf_tlas->set_deletion_queue(deletion);
+            if (!gltf_tlas->create(app.device, gltf_writer->get_instance_data(0), gltf_instance_count))
+                return false;
+        }
+
+        // scratch memory for the per-frame refit of the deforming cube, the TLAS update and the build of the scene's TLAS, in that order
+        // minAccelerationStructureScratchOffsetAlignment is at most 256, which leaves room to align the following ranges
+        VkDeviceSize grid_scratch_size = std::max(grid_generator->get_tlas()->scratch_buffer_size(), grid_tlas->scratch_buffer_size());
+        if (gltf_tlas)
+            grid_scratch_size = std::max(grid_scratch_size, gltf_tlas->scratch_buffer_size());
+        frame_scratch = make_scratch_allocator();
+        if (!frame_scratch->create(app.device, deform_mesh->get_blas()->scratch_buffer_size() + 256 + top_as->scratch_buffer_size() + 256 + grid_scratch_size,
+                                   app.target->get_frame_count()))
+            return false;
+
+        // BLAS builds are recorded on multiple threads, each of them needs its own scratch memory
+        // the TLAS is built after them and can reuse it
+        build_recorder::ptr recorder = make_build_recorder();
+        if (!recorder->create(app.device, queue.family))
+            return false;
+
+        scratch_buffer_size = std::max(recorder->scratch_buffer_size(bottom_as_list), top_as->scratch_buffer_size());
         scratch_buffer = buffer::make();
         if (!scratch_buffer->create(app.device, nullptr, scratch_buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR))
             return false;
-        scratch_buffer_address = scratch_buffer->get_address();
+        const VkDeviceAddress scratch_buffer_address = scratch_buffer->get_address();
 
         // build BLAS and TLAS
 
@@ -356,14 +832,18 @@ int main(int argc, char* argv[]) {
             const VkPipelineStageFlags src = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
             const VkPipelineStageFlags dst = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
 
-            for (size_t i = 0; i < bottom_as_list.size(); i++) {
-                bottom_as_list[i]->build(cmd_buf, scratch_buffer_address);
-                app.device->call().vkCmdPipelineBarrier(cmd_buf, src, dst, 0, 1, &barrier, 0, 0, 0, 0);
-            }
+            recorder->record(cmd_buf, bottom_as_list, scratch_buffer_address);
+            // the deforming cube is built from its first pose
+            frame_scratch->begin_frame(0);
+            deform_group->record(cmd_buf, *frame_scratch);
+            app.device->call().vkCmdPipelineBarrier(cmd_buf, src, dst, 0, 1, &barrier, 0, 0, 0, 0);
             top_as->build(cmd_buf, scratch_buffer_address);
             app.device->call().vkCmdPipelineBarrier(cmd_buf, src, dst | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &barrier, 0, 0, 0, 0);
         });
 
+        // one_time_submit_pool waits for the submission, so the secondary command buffers are no longer in use
+        recorder->destroy();
+
         // compact BLAS
         // building must be finished to retrieve the compacted size, or vkGetQueryPoolResults will time out
 
@@ -380,9 +860,13 @@ int main(int argc, char* argv[]) {
                 for (size_t i = 0; i < bottom_as_list.size(); i++) {
                     acceleration_structure::ptr compacted_bottom_as = bottom_as_list[i]->compact(cmd_buf);
                     compacted_bottom_as_list.push_back(std::dynamic_pointer_cast<bottom_level_acceleration_structure>(compacted_bottom_as));
-                    // update the TLAS with references to the new compacted BLAS since their handles changed
-                    top_as->update_instance(i, compacted_bottom_as_list[i]);
+                    registry.replace(bottom_as_list[i], compacted_bottom_as_list[i]);
+                    // the copy is placed in the heap, the uncompacted structure leaves a hole once it's retired
+                    blas_heap->add(compacted_bottom_as_list[i]);
                 }
+                // update the TLAS with references to the new compacted BLAS since their handles changed
+                for (size_t i = 0; i < instance_blas.size(); i++)
+                    top_as->update_instance(i, compacted_bottom_as_list[instance_blas[i]]);
                 app.device->call().vkCmdPipelineBarrier(cmd_buf, src, dst, 0, 1, &barrier, 0, 0, 0, 0);
                 top_as->update(cmd_buf, scratch_buffer_address);
                 app.device->call().vkCmdPipelineBarrier(cmd_buf, src, dst | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &barrier, 0, 0, 0, 0);
@@ -391,50 +875,49 @@ int main(int argc, char* argv[]) {
             bottom_as_list = compacted_bottom_as_list;
         }
 
+        scratch_buffer->destroy();
+
+        // the compacted BLAS are evicted as a whole, without proxy their instances turn inactive
+        residency = make_residency_manager();
+        if (!residency->create(app.device, uint32_t(bottom_as_list.size()), residency_manager::serialize, has_memory_budget(app.device)))
+            return false;
+        residency->set_deletion_queue(deletion);
+        residency->set_scratch_size(frame_scratch->get_region_size() * app.target->get_frame_count());
+        for (const bottom_level_acceleration_structure::ptr& bottom_as : bottom_as_list)
+            residency_entries.push_back(residency->add(bottom_as));
+        for (size_t i = 0; i < instance_blas.size(); i++)
+            residency->add_instance(residency_entries[instance_blas[i]], i);
+
+        // a floor of small cubes below the others, colored like the two cubes in a checkerboard pattern
+        instance_generator::object* grid_objects = grid_generator->get_objects();
+        for (uint32_t z = 0; z < GRID_SIZE; z++) {
+            for (uint32_t x = 0; x < GRID_SIZE; x++) {
+                const glm::vec3 position = { (float(x) - 0.5f * GRID_SIZE) * 0.25f, -0.75f, (float(z) - 0.5f * GRID_SIZE) * 0.25f };
+                instance_generator::object& object = grid_objects[z * GRID_SIZE + x];
+                object = { .transform = glm::translate(glm::mat4(1.0f), position) * glm::scale(glm::mat4(1.0f), glm::vec3(0.3f)),
+                           .custom_index = top_as->get_instances()[(x + z) % INSTANCE_COUNT].instanceCustomIndex,
+                           .cull_distance = 3.0f };
+            }
+        }
+        grid_generator->set_object_count(GRID_SIZE * GRID_SIZE);
+
         // write descriptors
 
-        VkDescriptorBufferInfo buffer_info = *uniform_buffer->get_descriptor_info();
         // for dynamic uniform buffers, range must be the bound size, not the total buffer size
-        buffer_info.range = uniform_stride;
-
-        const std::array<const VkWriteDescriptorSet, 5> write_sets = {
-            VkWriteDescriptorSet{ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                                  .dstSet = shared_descriptor_set,
-                                  .dstBinding = 0,
-                                  .descriptorCount = 1,
-                                  .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-                                  .pBufferInfo = &buffer_info },
-
-            VkWriteDescriptorSet{ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                                  .pNext = top_as->get_descriptor_info(),
-                                  .dstSet = raytracing_descriptor_set,
-                                  .dstBinding = 0,
-                                  .descriptorCount = 1,
-                                  .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR },
-
-            VkWriteDescriptorSet{ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                                  .dstSet = raytracing_descriptor_set,
-                                  .dstBinding = 1,
-                                  .descriptorCount = 1,
-                                  .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                                  .pBufferInfo = instance_buffer->get_descriptor_info() },
-
-            VkWriteDescriptorSet{ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                                  .dstSet = raytracing_descriptor_set,
-                                  .dstBinding = 2,
-                                  .descriptorCount = 1,
-                                  .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                                  .pBufferInfo = vertex_buffer->get_descriptor_info() },
-
-            VkWriteDescriptorSet{ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                                  .dstSet = raytracing_descriptor_set,
-                                  .dstBinding = 3,
-                                  .descriptorCount = 1,
-                                  .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                                  .pBufferInfo = index_buffer->get_descriptor_info() }
-        };
+        const VkDescriptorBufferInfo buffer_info = { .buffer = frame_uploads->get_buffer()->get(),
+                                                     .offset = 0,
+                                                     .range = sizeof(uniform_data) };
+
+        const VkWriteDescriptorSet write_set = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                 .dstSet = shared_descriptor_set,
+                                                 .dstBinding = 0,
+                                                 .descriptorCount = 1,
+                                                 .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                                                 .pBufferInfo = &buffer_info };
 
-        app.device->vkUpdateDescriptorSets(write_sets.size(), write_sets.data());
+        app.device->vkUpdateDescriptorSets({ write_set });
+
+        // the TLAS of the current scene is set before each dispatch
 
         glm::uvec2 size = app.target->get_size();
 
@@ -442,7 +925,20 @@ int main(int argc, char* argv[]) {
         uniforms.inv_proj = glm::inverse(perspective_matrix(size, 90.0f, 5.0f));
         uniforms.viewport = { 0, 0, size };
         uniforms.background_color = { glm::convertSRGBToLinear(render_pass->get_clear_color()), 1.0f };
-        uniforms.max_depth = 5;
+        uniforms.frame_index = 0;
+        uniforms.sample_count = 0;
+        uniforms.accumulation_mode = accumulation_off;
+
+        last_view_proj = glm::inverse(uniforms.inv_proj) * glm::inverse(uniforms.inv_view);
+
+        // sized by swapchain_callback
+        output_denoiser = make_denoiser();
+        if (!output_denoiser->create(app.device, file_data("cubes/denoise.spv")))
+            return false;
+
+        wavefront_tracer = make_wavefront();
+        if (!wavefront_tracer->create(app.device, file_data("cubes/wavefront_sort.spv"), INSTANCE_COUNT))
+            return false;
 
         swapchain_callback.on_created({}, { { 0, 0 }, size });
 
@@ -453,33 +949,126 @@ int main(int argc, char* argv[]) {
         swapchain_callback.on_destroyed();
         app.target->remove_callback(&swapchain_callback);
 
+        output_denoiser->destroy();
+        wavefront_tracer->destroy();
+
         blit_pipeline->destroy();
         blit_pipeline_layout->destroy();
 
-        raytracing_pipeline->destroy();
-        raytracing_pipeline_layout->destroy();
+        raytracing_variants->clear();
+
+        screenshot_tracer->destroy();
+        screenshot_pipeline.pipeline->destroy();
+        screenshot_pipeline = {};
+
+        probe_views->destroy();
+        probe_pipeline.pipeline->destroy();
+        probe_pipeline = {};
+
+        wavefront_passes.generate->destroy();
+        for (const compute_pipeline::ptr& pass : wavefront_passes.shade)
+            pass->destroy();
+        wavefront_passes.trace->destroy();
+        wavefront_passes = {};
+        wavefront_compute_layout->destroy();
+
+        app.device->call().vkDestroyQueryPool(app.device->get(), timestamp_pool, memory::instance().alloc());
+
+        app.device->call().vkDestroyPipelineLayout(app.device->get(), raytracing_pipeline_layout, memory::instance().alloc());
 
         descriptor_pool->destroy();
 
         shared_descriptor_set_layout->destroy();
-        raytracing_descriptor_set_layout->destroy();
+        raytracing_bindings->destroy();
 
-        instance_buffer->destroy();
+        geometries->destroy();
         vertex_buffer->destroy();
         index_buffer->destroy();
 
+        if (gltf) {
+            gltf->destroy();
+            gltf_scratch->destroy();
+            gltf_slots.clear();
+            gltf_writer->destroy();
+            gltf_tlas = nullptr;
+        }
+
+        grid_generator->destroy();
+        grid_jobs.destroy();
+        grid_slots.clear();
+        grid_writer->destroy();
+        grid_tlas = nullptr;
+
+        deform_group->clear();
+        deform_mesh->destroy();
+        deformed_vertex_buffer->destroy();
+        deform_pipeline->destroy();
+        deform_layout->destroy();
+
         bottom_as_list.clear();
+        instance_blas.clear();
+        registry.clear();
         top_as = nullptr;
 
-        scratch_buffer->destroy();
-        scratch_buffer_address = 0;
+        residency->destroy();
+        residency_entries.clear();
+
+        frame_scratch->destroy();
+
+        frame_uploads->destroy();
 
-        uniform_buffer->destroy();
+        // the device is idle, free everything that's left
+        deletion->flush();
+
+        blas_heap->destroy();
 
         app.device->vkDestroyCommandPool(pool);
     };
 
+    // blocks until all tiles are traced, the TLAS and uniforms of the last frame are reused
+    const auto save_screenshot = [&]() {
+        app.device->wait_for_idle();
+
+        const glm::uvec2 size = glm::uvec2(uniforms.viewport.z, uniforms.viewport.w) * 2u;
+        std::vector<uint8_t> pixels(size_t(size.x) * size.y * 4);
+
+        const push_constant_data push_constants = { .geometry_table = geometries->get_address(),
+                                                    .previous_transforms = 0 };
+        const auto bind = [&](VkCommandBuffer cmd_buf) {
+            screenshot_pipeline.pipeline->bind(cmd_buf);
+            app.device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, raytracing_pipeline_layout, 0, 1, &shared_descriptor_set, 1, &uniform_offset);
+            raytracing_bindings->push(cmd_buf);
+            app.device->call().vkCmdPushConstants(cmd_buf, raytracing_pipeline_layout, VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT,
+                                                  0, sizeof(push_constants), &push_constants);
+        };
+        if (!screenshot_tracer->render(size, *screenshot_pipeline.sbt, raytracing_pipeline_layout, sizeof(push_constant_data), bind, pixels.data(), size_t(size.x) * 4)) {
+            log()->error("failed to trace the screenshot");
+            return;
+        }
+
+        // binary PPM, RGB without alpha
+        std::ofstream file("cubes_screenshot.ppm", std::ios::binary);
+        file << "P6\n"
+             << size.x << " " << size.y << "\n255\n";
+        for (size_t i = 0; i < pixels.size(); i += 4)
+            file.write(reinterpret_cast<const char*>(&pixels[i]), 3);
+        if (!file) {
+            log()->error("failed to write cubes_screenshot.ppm");
+            return;
+        }
+
+        log()->info("screenshot saved to cubes_screenshot.ppm ({}x{})", size.x, size.y);
+    };
+
     app.on_update = [&](delta dt) {
+        // outside of on_process, tiled_tracer submits its own command buffers
+        if (screenshot_requested) {
+            save_screenshot();
+            screenshot_requested = false;
+        }
+        // last frame's transforms for motion vectors
+        top_as->save_transforms();
+
         for (size_t i = 0; i < INSTANCE_COUNT; i++) {
             glm::vec3 pos = { (2.0f * i - 1) * 0.5f, 0.0f, i * 0.5f };
             float angle = glm::radians(15.0f) * float(to_sec(now())) * i;
@@ -487,15 +1076,107 @@ int main(int argc, char* argv[]) {
             top_as->set_instance_transform(i, transform);
         }
 
+        if (deform)
+            deform_time = float(to_sec(now()));
+
         return true;
     };
 
     // this is called before app.forward_shading (blit + gui) is processed
 
     app.on_process = [&](VkCommandBuffer cmd_buf, lava::index frame) {
-        const uint32_t uniform_offset = frame * uniform_stride;
-        char* address = static_cast<char*>(uniform_buffer->get_mapped_data()) + uniform_offset;
-        *reinterpret_cast<uniform_data*>(address) = uniforms;
+        // lava waited for this frame's fence, free what older frames retired
+        deletion->next_frame();
+
+        // progressive accumulation starts over as soon as anything moves, temporal reprojection keeps its history
+        const glm::mat4 view_proj = glm::inverse(uniforms.inv_proj) * glm::inverse(uniforms.inv_view);
+        const bool moved = view_proj != last_view_proj || scene == scene_cpu_grid || (scene == scene_cubes && (top_as->transforms_changed() || deform));
+        // the wavefront passes don't accumulate, the history is stale after switching back
+        if (uniforms.accumulation_mode != last_accumulation_mode || execution != last_execution || scene != last_scene || (uniforms.accumulation_mode == accumulation_progressive && moved))
+            uniforms.sample_count = 0;
+        if (uniforms.sample_count == 0)
+            output_denoiser->reset();
+        uniforms.prev_view_proj = last_view_proj;
+        last_view_proj = view_proj;
+        last_accumulation_mode = uniforms.accumulation_mode;
+        last_execution = execution;
+        last_scene = scene;
+
+        // the timestamps of this frame's last use are done, lava waited for its fence
+        const uint32_t first_query = 2 * frame;
+        if (timestamps_written[frame]) {
+            std::array<uint64_t, 2> timestamps;
+            if (app.device->call().vkGetQueryPoolResults(app.device->get(), timestamp_pool, first_query, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+                const float period = app.device->get_physical_device()->get_properties().limits.timestampPeriod;
+                trace_ms = float(timestamps[1] - timestamps[0]) * period / 1e6f;
+                traced_rays = wavefront_tracer->get_traced_rays();
+            }
+        }
+
+        // evictions and restreams patch the instances, so this comes before they're staged
+        if (!release_cubes) {
+            for (residency_manager::entry entry : residency_entries)
+                residency->touch(entry);
+        }
+        residency->set_limit(VkDeviceSize(residency_limit_kb) * 1024);
+        residency->set_sbt_size(raytracing_variants->get(make_constants(max_depth)).sbt->get_size() + wavefront_passes.sbt->get_size());
+        // evicted instances turn inactive, which needs a full build
+        const bool residency_changed = residency->update(cmd_buf, *top_as) > 0;
+        if (residency_changed) {
+            uniforms.sample_count = 0;
+            output_denoiser->reset();
+        }
+
+        // moves BLAS out of sparse heap blocks and patches their instances before they're staged
+        blas_heap->defragment(cmd_buf, *top_as);
+
+        // the grids follow the cube BLAS when it's restreamed or moved by the heap
+        // frames in flight keep their copy of the generator's objects, the next generate() uploads the change
+        const residency_manager::entry grid_entry = residency_entries[instance_blas[0]];
+        const VkDeviceAddress cube_blas_address = residency->is_resident(grid_entry) ? bottom_as_list[instance_blas[0]]->get_address() : 0;
+        if (cube_blas_address != grid_blas_address) {
+            instance_generator::object* grid_objects = grid_generator->get_objects();
+            for (uint32_t i = 0; i < grid_generator->get_object_count(); i++)
+                grid_objects[i].blas = cube_blas_address;
+            grid_generator->mark_dirty();
+            grid_blas_address = cube_blas_address;
+        }
+
+        // every slot is rewritten each frame, one task per band of rows with its own handle
+        if (scene == scene_cpu_grid) {
+            const float time = float(to_sec(now()));
+            grid_jobs.run(GRID_TASK_COUNT, [&](uint32_t t) {
+                instance_writer::handle handle = grid_writer->get_handle();
+                for (uint32_t z = t * GRID_SIZE / GRID_TASK_COUNT; z < (t + 1) * GRID_SIZE / GRID_TASK_COUNT; z++) {
+                    for (uint32_t x = 0; x < GRID_SIZE; x++) {
+                        const glm::vec3 position = { (float(x) - 0.5f * GRID_SIZE) * 0.25f, -0.75f + 0.1f * std::sin(time * 2.0f + 0.5f * float(x + z)),
+                                                     (float(z) - 0.5f * GRID_SIZE) * 0.25f };
+                        const glm::mat3x4 transform = glm::transpose(glm::mat4x3(glm::translate(glm::mat4(1.0f), position) * glm::scale(glm::mat4(1.0f), glm::vec3(0.3f))));
+
+                        VkAccelerationStructureInstanceKHR instance = { .instanceCustomIndex = top_as->get_instances()[(x + z) % INSTANCE_COUNT].instanceCustomIndex,
+                                                                        .mask = 0xff,
+                                                                        .accelerationStructureReference = grid_blas_address };
+                        memcpy(&instance.transform, glm::value_ptr(transform), sizeof(VkTransformMatrixKHR));
+                        handle.set(grid_slots[z * GRID_SIZE + x], instance);
+                    }
+                }
+            });
+        }
+
+        // the ring region of this frame is no longer used by the GPU, lava waited for its fence
+        frame_uploads->begin_frame(frame);
+
+        const upload_ring::allocation previous_transforms = frame_uploads->upload(top_as->get_previous_transforms());
+        const upload_ring::allocation uniform_upload = frame_uploads->upload(uniforms);
+        // builds of older frames might still read their copy, so the instances are staged every frame
+        const upload_ring::allocation instances = frame_uploads->upload(top_as->get_instances());
+        frame_uploads->flush();
+
+        uniform_offset = uint32_t(uniform_upload.offset);
+        top_as->set_instance_data(instances.address);
+
+        uniforms.frame_index++;
+        uniforms.sample_count++;
 
         // rebuild TLAS with new transformation matrices
 
@@ -505,7 +1186,65 @@ int main(int argc, char* argv[]) {
         // wait for the last trace
         app.device->call().vkCmdPipelineBarrier(cmd_buf, use, build, 0, 0, nullptr, 0, nullptr, 0, nullptr);
 
-        top_as->update(cmd_buf, scratch_buffer_address);
+        frame_scratch->begin_frame(frame);
+
+        // builds of the glTF meshes decoded so far, their instances are written before the scene's TLAS is built
+        if (gltf && !gltf->is_finished()) {
+            gltf_scratch->begin_frame(frame);
+            if (gltf->process(cmd_buf, *gltf_scratch) > 0) {
+                insert_build_barrier(app.device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+
+                instance_writer::handle handle = gltf_writer->get_handle();
+                for (lava::index m : gltf->get_ready()) {
+                    const gltf_loader::mesh& mesh = gltf->get_mesh(m);
+                    if (!mesh.blas)
+                        continue;
+
+                    // the glTF materials cycle through the cube colors, the default material is white
+                    const glm::vec3 palette[] = { instance_colors[0], instance_colors[1], deform_color };
+                    std::vector<uint32_t> materials;
+                    for (uint32_t material : mesh.materials) {
+                        const glm::vec3 color = material == ~0u ? glm::vec3(1.0f) : palette[material % std::size(palette)];
+                        materials.push_back(glm::packUnorm4x8(glm::vec4(glm::convertSRGBToLinear(color), 1.0f)));
+                    }
+                    if (!geometries->add(*mesh.blas, gltf_table_bases[m], materials.data()))
+                        continue;
+
+                    for (lava::index i : mesh.instances)
+                        handle.set(gltf_slots[i], gltf->make_instance(i, gltf_table_bases[m]));
+                }
+            }
+        }
+
+        // the deform pass overwrites what the last trace read, the barrier above orders it through the build stage
+        if (deform) {
+            deform_group->record(cmd_buf, *frame_scratch);
+            insert_build_barrier(app.device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+        }
+
+        if (residency_changed)
+            top_as->rebuild(cmd_buf, frame_scratch->allocate(top_as->scratch_buffer_size()));
+        else
+            top_as->update(cmd_buf, frame_scratch->allocate(top_as->scratch_buffer_size()));
+
+        // objects farther away than their cull distance are masked out
+        if (scene == scene_gpu_grid) {
+            grid_generator->generate(cmd_buf, glm::vec3(uniforms.inv_view[3]), grid_cull_scale, frame);
+            grid_generator->build(cmd_buf, frame_scratch->allocate(grid_generator->get_tlas()->scratch_buffer_size()));
+        } else if (scene == scene_gltf) {
+            gltf_tlas->set_instance_data(gltf_writer->submit(frame));
+            // meshes that finished loading activate their instances
+            if (gltf_writer->activity_changed())
+                gltf_tlas->invalidate();
+            gltf_tlas->build(cmd_buf, frame_scratch->allocate(gltf_tlas->scratch_buffer_size()));
+        } else if (scene == scene_cpu_grid) {
+            // only the slots written since this frame's buffer was last submitted are copied
+            grid_tlas->set_instance_data(grid_writer->submit(frame));
+            // evicting the cube BLAS turns the instances inactive, which an update can't do
+            if (grid_writer->activity_changed())
+                grid_tlas->invalidate();
+            grid_tlas->build(cmd_buf, frame_scratch->allocate(grid_tlas->scratch_buffer_size()));
+        }
 
         // wait for update to finish before the next trace
         const VkMemoryBarrier barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
@@ -513,27 +1252,118 @@ int main(int argc, char* argv[]) {
                                           .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR };
         app.device->call().vkCmdPipelineBarrier(cmd_buf, build, use, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-        // wait for previous image reads
-        app.device->call().vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+        // wait for previous image reads and for the last trace to write the history, the probe copy reads and writes images too
+        const VkMemoryBarrier history_barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                                  .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                  .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT };
+        const VkPipelineStageFlags trace_stages = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        app.device->call().vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | trace_stages, trace_stages,
+                                                0, 1, &history_barrier, 0, nullptr, 0, nullptr);
+
+        // the other scenes have no previous transforms, the hit shader uses the current ones without an address
+        const push_constant_data push_constants = { .geometry_table = geometries->get_address(),
+                                                    .previous_transforms = scene == scene_cubes ? previous_transforms.address : 0 };
+        const top_level_acceleration_structure::ptr scene_tlas[] = { top_as, grid_generator->get_tlas(), grid_tlas, gltf_tlas };
+        raytracing_bindings->set_acceleration_structure(0, *scene_tlas[scene]);
+        const VkShaderStageFlags push_constant_stages = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+
+        app.device->call().vkCmdResetQueryPool(cmd_buf, timestamp_pool, first_query, 2);
+        app.device->call().vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_pool, first_query);
+
+        if (execution == execution_wavefront) {
+            // called after every pass bind, the sort passes in between use their own layout
+            wavefront_passes.bind = [&](VkCommandBuffer cmd_buf, VkPipelineBindPoint bind_point) {
+                app.device->call().vkCmdBindDescriptorSets(cmd_buf, bind_point, raytracing_pipeline_layout, 0, 1, &shared_descriptor_set, 1, &uniform_offset);
+                if (bind_point == VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR)
+                    raytracing_bindings->push(cmd_buf);
+                app.device->call().vkCmdPushConstants(cmd_buf, raytracing_pipeline_layout, push_constant_stages, 0, sizeof(push_constants), &push_constants);
+            };
+
+            // bounces match the depth of the megakernel, the primary rays count as the first one
+            wavefront_tracer->record(cmd_buf, wavefront_passes, max_depth);
+        } else {
+            const pipeline_variants::variant raytracing = raytracing_variants->get(make_constants(max_depth));
+            raytracing.pipeline->bind(cmd_buf);
+
+            app.device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, raytracing_pipeline_layout, 0, 1, &shared_descriptor_set, 1, &uniform_offset);
+
+            // TLAS and ping-pong history images, no descriptor set allocation or update needed
+            raytracing_bindings->push(cmd_buf);
+
+            app.device->call().vkCmdPushConstants(cmd_buf, raytracing_pipeline_layout, push_constant_stages, 0, sizeof(push_constants), &push_constants);
 
-        raytracing_pipeline->bind(cmd_buf);
+            // trace rays!
 
-        app.device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, raytracing_pipeline_layout->get(), 0, 1, &shared_descriptor_set, 1, &uniform_offset);
-        app.device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, raytracing_pipeline_layout->get(), 1, 1, &raytracing_descriptor_set, 0, nullptr);
+            const glm::uvec3 size = { uniforms.viewport.z, uniforms.viewport.w, 1 };
 
-        // trace rays!
+            const VkStridedDeviceAddressRegionKHR raygen = raytracing.sbt->get_raygen_region();
+            app.device->call().vkCmdTraceRaysKHR(
+                cmd_buf,
+                &raygen, &raytracing.sbt->get_miss_region(), &raytracing.sbt->get_hit_region(), &raytracing.sbt->get_callable_region(),
+                size.x, size.y, size.z);
+        }
 
-        const glm::uvec3 size = { uniforms.viewport.z, uniforms.viewport.w, 1 };
+        app.device->call().vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_pool, first_query + 1);
+        timestamps_written[frame] = true;
+
+        // the wavefront passes don't write the G-buffer
+        if (execution == execution_megakernel && uniforms.accumulation_mode == accumulation_denoise)
+            output_denoiser->record(cmd_buf);
+
+        VkAccessFlags output_access = VK_ACCESS_SHADER_WRITE_BIT;
+        VkPipelineStageFlags output_stages = trace_stages;
+        if (show_probe) {
+            // the faces look along the axes, the Y faces use Z as up
+            const glm::vec3 probe_position = { 0.0f, 0.0f, 0.25f };
+            const glm::vec3 directions[] = { { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+                                             { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f } };
+            const glm::vec3 ups[] = { { 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, -1.0f },
+                                      { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } };
+            const glm::mat4 inv_proj = glm::inverse(perspective_matrix({ PROBE_SIZE, PROBE_SIZE }, 90.0f, 5.0f));
+
+            probe_views->begin_frame(frame);
+            for (lava::index i = 0; i < 6; i++)
+                probe_views->set_view(i, { .inv_view = glm::inverse(glm::lookAtLH(probe_position, probe_position + directions[i], ups[i])), .inv_proj = inv_proj });
+            probe_views->set_view_count(6);
+
+            probe_pipeline.pipeline->bind(cmd_buf);
+            app.device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, raytracing_pipeline_layout, 0, 1, &shared_descriptor_set, 1, &uniform_offset);
+            raytracing_bindings->push(cmd_buf);
+
+            // no motion vectors, the views follow the frame's constants
+            const push_constant_data probe_constants = { .geometry_table = geometries->get_address(), .previous_transforms = 0 };
+            const VkDeviceAddress views_address = probe_views->get_views_address();
+            app.device->call().vkCmdPushConstants(cmd_buf, raytracing_pipeline_layout, push_constant_stages, 0, sizeof(probe_constants), &probe_constants);
+            app.device->call().vkCmdPushConstants(cmd_buf, raytracing_pipeline_layout, push_constant_stages, sizeof(probe_constants), sizeof(views_address), &views_address);
+
+            probe_views->trace(cmd_buf, *probe_pipeline.sbt);
+
+            insert_image_memory_barrier(app.device, cmd_buf, probe_views->get_image()->get(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                        VK_PIPELINE_STAGE_TRANSFER_BIT, probe_views->get_image()->get_subresource_range());
+            insert_image_memory_barrier(app.device, cmd_buf, output_image->get(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, trace_stages,
+                                        VK_PIPELINE_STAGE_TRANSFER_BIT, output_image->get_subresource_range());
+
+            // one face after the other, as many as fit into the window
+            const glm::uvec2 output_size = output_image->get_size();
+            std::vector<VkImageCopy> regions;
+            for (uint32_t i = 0; i < 6 && i * PROBE_SIZE < output_size.x; i++) {
+                regions.push_back({ .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, i, 1 },
+                                    .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+                                    .dstOffset = { int32_t(i * PROBE_SIZE), 0, 0 },
+                                    .extent = { std::min(PROBE_SIZE, output_size.x - i * PROBE_SIZE), std::min(PROBE_SIZE, output_size.y), 1 } });
+            }
+            app.device->call().vkCmdCopyImage(cmd_buf, probe_views->get_image()->get(), VK_IMAGE_LAYOUT_GENERAL, output_image->get(), VK_IMAGE_LAYOUT_GENERAL,
+                                              uint32_t(regions.size()), regions.data());
 
-        const VkStridedDeviceAddressRegionKHR raygen = shader_binding->get_raygen_region();
-        app.device->call().vkCmdTraceRaysKHR(
-            cmd_buf,
-            &raygen, &shader_binding->get_miss_region(), &shader_binding->get_hit_region(), &shader_binding->get_callable_region(),
-            size.x, size.y, size.z);
+            output_access = VK_ACCESS_TRANSFER_WRITE_BIT;
+            output_stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        }
 
         // wait for trace to finish before reading the image
-        insert_image_memory_barrier(app.device, cmd_buf, output_image->get(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
-                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        insert_image_memory_barrier(app.device, cmd_buf, output_image->get(), output_access, VK_ACCESS_SHADER_READ_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, output_stages,
                                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, output_image->get_subresource_range());
     };
 
@@ -543,7 +1373,51 @@ int main(int argc, char* argv[]) {
         ImGui::Begin(app.get_name());
 
         ImGui::SetNextItemWidth(ImGui::GetWindowSize().x * 0.5f);
-        ImGui::SliderInt("Max ray depth", (int*) &uniforms.max_depth, 1, 5);
+        ImGui::SliderInt("Max ray depth", &max_depth, 1, 5);
+
+        // the glTF scene is only there with --gltf
+        const char* const scenes[] = { "Cubes", "GPU grid", "CPU grid", "glTF" };
+        ImGui::SetNextItemWidth(ImGui::GetWindowSize().x * 0.5f);
+        ImGui::Combo("Scene", &scene, scenes, IM_ARRAYSIZE(scenes) - (gltf ? 0 : 1));
+        if (scene == scene_gpu_grid) {
+            ImGui::SetNextItemWidth(ImGui::GetWindowSize().x * 0.5f);
+            ImGui::SliderFloat("Cull distance", &grid_cull_scale, 0.25f, 2.0f);
+        }
+        if (scene == scene_gltf && !gltf->is_finished())
+            ImGui::Text("Loading %s", gltf_path.c_str());
+
+        const char* const accumulation_modes[] = { "Off", "Progressive", "Temporal", "Denoiser" };
+        ImGui::SetNextItemWidth(ImGui::GetWindowSize().x * 0.5f);
+        ImGui::Combo("Accumulation", (int*) &uniforms.accumulation_mode, accumulation_modes, IM_ARRAYSIZE(accumulation_modes));
+
+        const char* const execution_modes[] = { "Megakernel", "Wavefront" };
+        ImGui::SetNextItemWidth(ImGui::GetWindowSize().x * 0.5f);
+        ImGui::Combo("Execution", &execution, execution_modes, IM_ARRAYSIZE(execution_modes));
+
+        ImGui::Checkbox("Deform", &deform);
+        ImGui::Checkbox("Probe", &show_probe);
+
+        if (ImGui::Button("Screenshot"))
+            screenshot_requested = true;
+
+        // wavefront counts every traced ray, the megakernel only its launch size
+        ImGui::Text("Trace: %.2f ms", trace_ms);
+        if (execution == execution_wavefront && trace_ms > 0.0f)
+            ImGui::Text("%.1f Mrays/s (%u rays)", float(traced_rays) / (trace_ms * 1000.0f), traced_rays);
+
+        ImGui::Separator();
+
+        ImGui::SetNextItemWidth(ImGui::GetWindowSize().x * 0.5f);
+        ImGui::SliderInt("AS limit (KB)", &residency_limit_kb, 0, 256);
+        ImGui::Checkbox("Release cubes", &release_cubes);
+
+        const residency_manager::footprint& footprint = residency->get_footprint();
+        ImGui::Text("AS %.1f KB, scratch %.1f KB, SBT %.1f KB", footprint.acceleration_structures / 1024.0f, footprint.scratch / 1024.0f, footprint.sbt / 1024.0f);
+        ImGui::Text("Limit %.1f MB, %u of %u BLAS resident", residency->get_limit() / (1024.0f * 1024.0f), residency->get_resident_count(),
+                    residency->get_resident_count() + residency->get_evicted_count());
+
+        const structure_heap::stats heap_stats = blas_heap->get_stats();
+        ImGui::Text("BLAS heap: %u blocks, %.1f of %.1f KB used", heap_stats.block_count, heap_stats.used / 1024.0f, heap_stats.allocated / 1024.0f);
 
         app.draw_about(true);
 
@@ -5,7 +5,7 @@ using namespace lava;
 device::ptr create_raytracing_device(platform& platform) {
     // https://www.khronos.org/blog/vulkan-ray-tracing-final-specification-release
 
-    const std::array<const char*, 9> extensions = {
+    const std::array<const char*, 10> extensions = {
         VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
         // next 3 required by VK_KHR_acceleration_structure
         VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
@@ -22,7 +22,9 @@ device::ptr create_raytracing_device(platform& platform) {
         // required by VK_KHR_spirv_1_4
         VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME,
         // new layout for tightly-packed buffers (always uses alignment of base type)
-        VK_EXT_SCALAR_BLOCK_LAYOUT_EXTENSION_NAME
+        VK_EXT_SCALAR_BLOCK_LAYOUT_EXTENSION_NAME,
+        // descriptors recorded straight into the command buffer
+        VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME
     };
 
     const VkPhysicalDeviceFeatures features = {
@@ -105,6 +107,9 @@ device::ptr create_raytracing_device(platform& platform) {
 
         device::create_param device_params = physical_device->create_default_device_param();
         device_params.extensions.insert(device_params.extensions.end(), extensions.begin(), extensions.end());
+        // heap budgets for the residency manager
+        if (physical_device->supported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+            device_params.extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
         device_params.features = features;
         device_params.next = &features_acceleration_structure;
 
@@ -124,3 +129,80 @@ device::ptr create_raytracing_device(platform& platform) {
 
     return nullptr;
 }
+
+bool has_memory_budget(device_p device) {
+    return device->get_physical_device()->supported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+}
+
+void job_pool::create(uint32_t thread_count) {
+    destroy();
+
+    if (thread_count == 0)
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+    generation = 0;
+    stop = false;
+    workers.reserve(thread_count - 1);
+    for (uint32_t i = 1; i < thread_count; i++)
+        workers.emplace_back(&job_pool::work, this);
+}
+
+void job_pool::destroy() {
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+    }
+    start.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+void job_pool::run(uint32_t task_count, const task_func& task) {
+    if (task_count == 0)
+        return;
+
+    {
+        std::lock_guard lock(mutex);
+        job = &task;
+        job_task_count = task_count;
+        next_task = 0;
+        pending = workers.size();
+        generation++;
+    }
+    if (!workers.empty())
+        start.notify_all();
+
+    run_tasks();
+
+    std::unique_lock lock(mutex);
+    done.wait(lock, [&] { return pending == 0; });
+    job = nullptr;
+}
+
+void job_pool::work() {
+    uint64_t last_generation = 0;
+    for (;;) {
+        {
+            std::unique_lock lock(mutex);
+            start.wait(lock, [&] { return stop || generation != last_generation; });
+            if (stop)
+                return;
+            last_generation = generation;
+        }
+
+        run_tasks();
+
+        {
+            std::lock_guard lock(mutex);
+            pending--;
+        }
+        done.notify_one();
+    }
+}
+
+void job_pool::run_tasks() {
+    // tasks are taken one at a time, so threads that start late just get fewer
+    for (uint32_t i = next_task++; i < job_task_count; i = next_task++)
+        (*job)(i);
+}
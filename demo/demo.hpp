@@ -1,5 +1,53 @@
 #pragma once
 
 #include "liblava/lava.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 lava::device::ptr create_raytracing_device(lava::platform& platform);
+
+// VK_EXT_memory_budget is optional, create_raytracing_device() enables it if the physical device supports it
+bool has_memory_budget(lava::device_p device);
+
+// persistent worker threads for work that is split into tasks every frame, e.g. writing TLAS instances from many threads
+// the threads are started by create() and wait for the next run() in between
+struct job_pool {
+    using task_func = std::function<void(uint32_t)>;
+
+    ~job_pool() {
+        destroy();
+    }
+
+    // thread_count includes the thread calling run(), 0 uses one thread per hardware thread
+    void create(uint32_t thread_count = 0);
+    void destroy();
+
+    // calls task(i) for every i < task_count and returns once all of them finished, the calling thread runs tasks too
+    void run(uint32_t task_count, const task_func& task);
+
+    uint32_t get_thread_count() const {
+        return uint32_t(workers.size()) + 1;
+    }
+
+private:
+    std::vector<std::thread> workers;
+
+    // the current run() call, workers pick up tasks when generation changes
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    bool stop = false;
+    // workers that haven't finished the current run() yet
+    size_t pending = 0;
+
+    const task_func* job = nullptr;
+    uint32_t job_task_count = 0;
+    std::atomic<uint32_t> next_task = 0;
+
+    void work();
+    void run_tasks();
+};
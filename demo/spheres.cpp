@@ -0,0 +1,429 @@
+#include <imgui.h>
+#include <glm/gtc/color_space.hpp>
+#include "demo.hpp"
+#include "liblava-extras/raytracing.hpp"
+
+using namespace lava;
+using namespace lava::extras::raytracing;
+
+struct uniform_data {
+    glm::mat4 inv_view;
+    glm::mat4 inv_proj;
+    glm::uvec4 viewport;
+    glm::vec4 background_color;
+    uint32_t max_depth;
+} uniforms;
+
+int main(int argc, char* argv[]) {
+    frame_env env;
+    env.info.app_name = "lava raytracing spheres";
+    env.cmd_line = { argc, argv };
+    env.info.req_api_version = api_version::v1_1;
+
+    app app(env);
+
+    app.config.surface.formats = { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB };
+
+    device::ptr device = create_raytracing_device(app.platform);
+    if (!device)
+        return error::not_ready;
+    app.device = device.get();
+
+    if (!app.setup())
+        return error::not_ready;
+
+    queue::ref queue = app.device->graphics_queue();
+
+    const size_t uniform_stride = align_up(sizeof(uniform_data), app.device->get_physical_device()->get_properties().limits.minUniformBufferOffsetAlignment);
+
+    // a grid of spheres, each one defined by its bounding box
+    // the intersection shader reconstructs center and radius from the box
+
+    constexpr size_t GRID_SIZE = 32;
+    constexpr size_t SPHERE_COUNT = GRID_SIZE * GRID_SIZE;
+    // boxes per BLAS, only chunks with moving spheres get refit
+    constexpr size_t CHUNK_SIZE = 64;
+    constexpr float RADIUS = 0.025f;
+
+    std::vector<glm::vec3> centers(SPHERE_COUNT);
+    std::vector<VkAabbPositionsKHR> aabbs(SPHERE_COUNT);
+
+    for (size_t i = 0; i < SPHERE_COUNT; i++) {
+        const glm::vec2 grid_pos = glm::vec2(i % GRID_SIZE, i / GRID_SIZE) / float(GRID_SIZE - 1);
+        centers[i] = { grid_pos.x * 2.0f - 1.0f, 0.0f, grid_pos.y * 2.0f - 1.0f };
+    }
+
+    auto set_aabb = [&](size_t i, const glm::vec3& center) {
+        aabbs[i] = { .minX = center.x - RADIUS, .minY = center.y - RADIUS, .minZ = center.z - RADIUS,
+                     .maxX = center.x + RADIUS, .maxY = center.y + RADIUS, .maxZ = center.z + RADIUS };
+    };
+
+    for (size_t i = 0; i < SPHERE_COUNT; i++)
+        set_aabb(i, centers[i]);
+
+    int animated_chunks = 1;
+
+    VkCommandPool pool = VK_NULL_HANDLE;
+    descriptor::pool::ptr descriptor_pool;
+
+    pipeline_layout::ptr blit_pipeline_layout;
+    render_pipeline::ptr blit_pipeline;
+
+    descriptor::ptr shared_descriptor_set_layout;
+    VkDescriptorSet shared_descriptor_set;
+
+    pipeline_layout::ptr raytracing_pipeline_layout;
+    raytracing_pipeline::ptr raytracing_pipeline;
+
+    shader_binding_table::ptr shader_binding;
+
+    descriptor::ptr raytracing_descriptor_set_layout;
+    VkDescriptorSet raytracing_descriptor_set;
+
+    aabb_geometry::ptr spheres;
+    top_level_acceleration_structure::ptr top_as;
+
+    buffer::ptr scratch_buffer;
+    VkDeviceAddress scratch_buffer_address = 0;
+
+    buffer::ptr uniform_buffer;
+
+    image::ptr output_image;
+
+    target_callback swapchain_callback;
+
+    swapchain_callback.on_created =
+        [&](VkAttachmentsRef, rect area) {
+            const glm::uvec2 size = area.get_size();
+            uniforms.inv_proj = glm::inverse(perspective_matrix(size, 90.0f, 5.0f));
+            uniforms.viewport = { area.get_origin(), size };
+
+            if (!output_image->create(app.device, size))
+                return false;
+
+            const VkDescriptorImageInfo image_info = { .sampler = VK_NULL_HANDLE,
+                                                       .imageView = output_image->get_view(),
+                                                       .imageLayout = VK_IMAGE_LAYOUT_GENERAL };
+            const VkWriteDescriptorSet write_info = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                      .dstSet = shared_descriptor_set,
+                                                      .dstBinding = 1,
+                                                      .descriptorCount = 1,
+                                                      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                      .pImageInfo = &image_info };
+            app.device->vkUpdateDescriptorSets({ write_info });
+
+            return one_time_submit_pool(
+                app.device, pool, queue, [&](VkCommandBuffer cmd_buf) {
+                    insert_image_memory_barrier(app.device, cmd_buf, output_image->get(), 0, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, output_image->get_subresource_range());
+                });
+        };
+
+    swapchain_callback.on_destroyed = [&]() {
+        app.device->wait_for_idle();
+        output_image->destroy();
+    };
+
+    app.target->add_callback(&swapchain_callback);
+
+    app.on_create = [&]() {
+        const VkCommandPoolCreateInfo create_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                                                      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                                                      .queueFamilyIndex = uint32_t(queue.family) };
+        if (!app.device->vkCreateCommandPool(&create_info, &pool))
+            return false;
+
+        descriptor_pool = descriptor::pool::make();
+        constexpr uint32_t set_count = 2;
+        const VkDescriptorPoolSizes sizes = {
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+            { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1 }
+        };
+        if (!descriptor_pool->create(app.device, sizes, set_count, 0))
+            return false;
+
+        uniform_buffer = buffer::make();
+        if (!uniform_buffer->create_mapped(app.device, nullptr, app.target->get_frame_count() * uniform_stride, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT))
+            return false;
+
+        VkFormat format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        output_image = image::make(format);
+        output_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        output_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+        output_image->set_aspect_mask(format_aspect_mask(format));
+
+        shared_descriptor_set_layout = descriptor::make();
+        shared_descriptor_set_layout->add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR);
+        shared_descriptor_set_layout->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        if (!shared_descriptor_set_layout->create(app.device))
+            return false;
+
+        shared_descriptor_set = shared_descriptor_set_layout->allocate(descriptor_pool->get());
+
+        blit_pipeline_layout = pipeline_layout::make();
+        blit_pipeline_layout->add(shared_descriptor_set_layout);
+        if (!blit_pipeline_layout->create(app.device))
+            return false;
+
+        blit_pipeline = render_pipeline::make(app.device);
+
+        if (!blit_pipeline->add_shader(file_data("spheres/vert.spv"), VK_SHADER_STAGE_VERTEX_BIT))
+            return false;
+        if (!blit_pipeline->add_shader(file_data("spheres/frag.spv"), VK_SHADER_STAGE_FRAGMENT_BIT))
+            return false;
+
+        blit_pipeline->add_color_blend_attachment();
+        blit_pipeline->set_layout(blit_pipeline_layout);
+
+        auto render_pass = app.shading.get_pass();
+        if (!blit_pipeline->create(render_pass->get()))
+            return false;
+
+        blit_pipeline->on_process = [&](VkCommandBuffer cmd_buf) {
+            const uint32_t uniform_offset = app.block.get_current_frame() * uniform_stride;
+            app.device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, blit_pipeline_layout->get(), 0, 1, &shared_descriptor_set, 1, &uniform_offset);
+            app.device->call().vkCmdDraw(cmd_buf, 3, 1, 0, 0);
+        };
+
+        render_pass->add_front(blit_pipeline);
+
+        // the intersection shader reads the boxes from the same buffer the BLAS are built from
+        raytracing_descriptor_set_layout = descriptor::make();
+        raytracing_descriptor_set_layout->add_binding(0, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        raytracing_descriptor_set_layout->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_INTERSECTION_BIT_KHR);
+        if (!raytracing_descriptor_set_layout->create(app.device))
+            return false;
+
+        raytracing_pipeline_layout = pipeline_layout::make();
+        raytracing_pipeline_layout->add(shared_descriptor_set_layout);
+        raytracing_pipeline_layout->add(raytracing_descriptor_set_layout);
+        if (!raytracing_pipeline_layout->create(app.device))
+            return false;
+
+        raytracing_descriptor_set = raytracing_descriptor_set_layout->allocate(descriptor_pool->get());
+
+        raytracing_pipeline = make_raytracing_pipeline(app.device);
+
+        if (!raytracing_pipeline->add_shader(file_data("spheres/rgen.spv"), VK_SHADER_STAGE_RAYGEN_BIT_KHR))
+            return false;
+        if (!raytracing_pipeline->add_shader(file_data("spheres/rmiss.spv"), VK_SHADER_STAGE_MISS_BIT_KHR))
+            return false;
+        if (!raytracing_pipeline->add_shader(file_data("spheres/rchit.spv"), VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR))
+            return false;
+        if (!raytracing_pipeline->add_shader(file_data("spheres/rint.spv"), VK_SHADER_STAGE_INTERSECTION_BIT_KHR))
+            return false;
+
+        enum rt_stage : uint32_t {
+            raygen = 0,
+            miss,
+            closest_hit,
+            intersection
+        };
+
+        raytracing_pipeline->add_shader_general_group(raygen);
+        raytracing_pipeline->add_shader_general_group(miss);
+        // procedural hit group
+        raytracing_pipeline->add_shader_hit_group(closest_hit, VK_SHADER_UNUSED_KHR, intersection);
+
+        raytracing_pipeline->set_max_recursion_depth(1);
+        raytracing_pipeline->set_layout(raytracing_pipeline_layout);
+
+        if (!raytracing_pipeline->create())
+            return false;
+
+        shader_binding = make_shader_binding_table();
+        if (!shader_binding->create(raytracing_pipeline))
+            return false;
+
+        // create acceleration structures
+        // - a BLAS for each chunk of boxes, refittable for the animation
+        // - one TLAS with an instance per chunk
+
+        spheres = make_aabb_geometry();
+        if (!spheres->create(app.device, aabbs.data(), aabbs.size(), CHUNK_SIZE, app.target->get_frame_count(), VK_GEOMETRY_OPAQUE_BIT_KHR,
+                             VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR))
+            return false;
+
+        top_as = make_top_level_acceleration_structure();
+
+        const bottom_level_acceleration_structure::list& chunks = spheres->get_chunks();
+        for (size_t i = 0; i < chunks.size(); i++) {
+            // instanceCustomIndex is the index of the first box, see spheres.rint
+            const VkAccelerationStructureInstanceKHR instance = { .transform = { .matrix = { { 1.0f, 0.0f, 0.0f, 0.0f },
+                                                                                            { 0.0f, 1.0f, 0.0f, 0.0f },
+                                                                                            { 0.0f, 0.0f, 1.0f, 0.0f } } },
+                                                                 .instanceCustomIndex = spheres->get_chunk_offset(i),
+                                                                 .mask = 0xff,
+                                                                 .accelerationStructureReference = chunks[i]->get_address() };
+            top_as->add_instance(instance);
+        }
+
+        if (!top_as->create(app.device, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR))
+            return false;
+
+        // BLAS and TLAS builds are separated by barriers, so they can share scratch memory
+        const VkDeviceSize scratch_buffer_size = std::max(spheres->scratch_buffer_size(), top_as->scratch_buffer_size());
+        scratch_buffer = buffer::make();
+        if (!scratch_buffer->create(app.device, nullptr, scratch_buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR))
+            return false;
+        scratch_buffer_address = scratch_buffer->get_address();
+
+        one_time_submit_pool(app.device, pool, queue, [&](VkCommandBuffer cmd_buf) {
+            const VkMemoryBarrier barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                              .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+                                              .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR };
+            const VkPipelineStageFlags src = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+            const VkPipelineStageFlags dst = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+
+            spheres->build(cmd_buf, scratch_buffer_address);
+            app.device->call().vkCmdPipelineBarrier(cmd_buf, src, dst, 0, 1, &barrier, 0, 0, 0, 0);
+            top_as->build(cmd_buf, scratch_buffer_address);
+            app.device->call().vkCmdPipelineBarrier(cmd_buf, src, dst | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &barrier, 0, 0, 0, 0);
+        });
+
+        VkDescriptorBufferInfo buffer_info = *uniform_buffer->get_descriptor_info();
+        buffer_info.range = uniform_stride;
+
+        const std::array<const VkWriteDescriptorSet, 3> write_sets = {
+            VkWriteDescriptorSet{ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                  .dstSet = shared_descriptor_set,
+                                  .dstBinding = 0,
+                                  .descriptorCount = 1,
+                                  .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                                  .pBufferInfo = &buffer_info },
+
+            VkWriteDescriptorSet{ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                  .pNext = top_as->get_descriptor_info(),
+                                  .dstSet = raytracing_descriptor_set,
+                                  .dstBinding = 0,
+                                  .descriptorCount = 1,
+                                  .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR },
+
+            VkWriteDescriptorSet{ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                  .dstSet = raytracing_descriptor_set,
+                                  .dstBinding = 1,
+                                  .descriptorCount = 1,
+                                  .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                  .pBufferInfo = spheres->get_buffer()->get_descriptor_info() }
+        };
+
+        app.device->vkUpdateDescriptorSets(write_sets.size(), write_sets.data());
+
+        glm::uvec2 size = app.target->get_size();
+
+        uniforms.inv_view = glm::inverse(glm::lookAtLH(glm::vec3(0.0f, 0.75f, -1.25f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+        uniforms.inv_proj = glm::inverse(perspective_matrix(size, 90.0f, 5.0f));
+        uniforms.viewport = { 0, 0, size };
+        uniforms.background_color = { glm::convertSRGBToLinear(render_pass->get_clear_color()), 1.0f };
+        uniforms.max_depth = 3;
+
+        swapchain_callback.on_created({}, { { 0, 0 }, size });
+
+        return true;
+    };
+
+    app.on_destroy = [&]() {
+        swapchain_callback.on_destroyed();
+        app.target->remove_callback(&swapchain_callback);
+
+        blit_pipeline->destroy();
+        blit_pipeline_layout->destroy();
+
+        raytracing_pipeline->destroy();
+        raytracing_pipeline_layout->destroy();
+
+        descriptor_pool->destroy();
+
+        shared_descriptor_set_layout->destroy();
+        raytracing_descriptor_set_layout->destroy();
+
+        top_as = nullptr;
+        spheres = nullptr;
+
+        scratch_buffer->destroy();
+        scratch_buffer_address = 0;
+
+        uniform_buffer->destroy();
+
+        app.device->vkDestroyCommandPool(pool);
+    };
+
+    app.on_update = [&](delta dt) {
+        // let the spheres of the first few chunks bob up and down
+        // the remaining chunks stay untouched and skip the refit
+        const size_t animated = std::min(size_t(animated_chunks) * CHUNK_SIZE, SPHERE_COUNT);
+        const float time = float(to_sec(now()));
+        for (size_t i = 0; i < animated; i++) {
+            const float phase = centers[i].x * 4.0f + centers[i].z * 2.0f;
+            set_aabb(i, centers[i] + glm::vec3(0.0f, 0.1f * glm::sin(2.0f * time + phase), 0.0f));
+        }
+        spheres->update(0, aabbs.data(), animated);
+
+        return true;
+    };
+
+    app.on_process = [&](VkCommandBuffer cmd_buf, lava::index frame) {
+        const uint32_t uniform_offset = frame * uniform_stride;
+        char* address = static_cast<char*>(uniform_buffer->get_mapped_data()) + uniform_offset;
+        *reinterpret_cast<uniform_data*>(address) = uniforms;
+
+        const VkPipelineStageFlags build = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+        const VkPipelineStageFlags use = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+
+        const VkMemoryBarrier barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                          .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                          .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR };
+
+        // wait for the last trace, the boxes of the changed chunks are copied before the refit
+        app.device->call().vkCmdPipelineBarrier(cmd_buf, use, build | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+        // refit the changed chunks, then the TLAS
+        // the TLAS update is still needed since the BLAS bounds changed
+        if (spheres->build(cmd_buf, scratch_buffer_address, frame) > 0)
+            app.device->call().vkCmdPipelineBarrier(cmd_buf, build, build, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        top_as->update(cmd_buf, scratch_buffer_address);
+
+        app.device->call().vkCmdPipelineBarrier(cmd_buf, build, use, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        // wait for previous image reads
+        app.device->call().vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+        raytracing_pipeline->bind(cmd_buf);
+
+        app.device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, raytracing_pipeline_layout->get(), 0, 1, &shared_descriptor_set, 1, &uniform_offset);
+        app.device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, raytracing_pipeline_layout->get(), 1, 1, &raytracing_descriptor_set, 0, nullptr);
+
+        const glm::uvec3 size = { uniforms.viewport.z, uniforms.viewport.w, 1 };
+
+        const VkStridedDeviceAddressRegionKHR raygen = shader_binding->get_raygen_region();
+        app.device->call().vkCmdTraceRaysKHR(
+            cmd_buf,
+            &raygen, &shader_binding->get_miss_region(), &shader_binding->get_hit_region(), &shader_binding->get_callable_region(),
+            size.x, size.y, size.z);
+
+        insert_image_memory_barrier(app.device, cmd_buf, output_image->get(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, output_image->get_subresource_range());
+    };
+
+    app.imgui.on_draw = [&]() {
+        ImGui::SetNextWindowPos(ImVec2(30, 30), ImGuiCond_FirstUseEver);
+
+        ImGui::Begin(app.get_name());
+
+        ImGui::SetNextItemWidth(ImGui::GetWindowSize().x * 0.5f);
+        ImGui::SliderInt("Max ray depth", (int*) &uniforms.max_depth, 1, 5);
+
+        ImGui::SetNextItemWidth(ImGui::GetWindowSize().x * 0.5f);
+        ImGui::SliderInt("Animated chunks", &animated_chunks, 0, int(spheres->get_chunks().size()));
+
+        app.draw_about(true);
+
+        ImGui::End();
+    };
+
+    return app.run();
+}
@@ -1,5 +1,30 @@
 #pragma once
 
+#include "liblava-extras/raytracing/aabb_geometry.hpp"
 #include "liblava-extras/raytracing/acceleration_structure.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+#include "liblava-extras/raytracing/blas_registry.hpp"
+#include "liblava-extras/raytracing/build_recorder.hpp"
+#include "liblava-extras/raytracing/build_size_cache.hpp"
+#include "liblava-extras/raytracing/deformable_mesh.hpp"
+#include "liblava-extras/raytracing/deletion_queue.hpp"
+#include "liblava-extras/raytracing/denoiser.hpp"
+#include "liblava-extras/raytracing/geometry_table.hpp"
+#include "liblava-extras/raytracing/gltf_loader.hpp"
+#include "liblava-extras/raytracing/host_memory.hpp"
+#include "liblava-extras/raytracing/instance_generator.hpp"
+#include "liblava-extras/raytracing/instance_writer.hpp"
+#include "liblava-extras/raytracing/lod_set.hpp"
+#include "liblava-extras/raytracing/multi_view.hpp"
 #include "liblava-extras/raytracing/pipeline.hpp"
+#include "liblava-extras/raytracing/pipeline_variants.hpp"
+#include "liblava-extras/raytracing/push_descriptor.hpp"
+#include "liblava-extras/raytracing/residency_manager.hpp"
+#include "liblava-extras/raytracing/scratch_allocator.hpp"
 #include "liblava-extras/raytracing/shader_binding_table.hpp"
+#include "liblava-extras/raytracing/static_batcher.hpp"
+#include "liblava-extras/raytracing/structure_heap.hpp"
+#include "liblava-extras/raytracing/tiled_tracer.hpp"
+#include "liblava-extras/raytracing/triangle_preprocessor.hpp"
+#include "liblava-extras/raytracing/upload_ring.hpp"
+#include "liblava-extras/raytracing/wavefront.hpp"
@@ -0,0 +1,167 @@
+#include "liblava-extras/raytracing/aabb_geometry.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+#include "liblava-extras/raytracing/build_size_cache.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool aabb_geometry::create(device_p dev, const VkAabbPositionsKHR* aabbs, size_t aabb_count, size_t aabb_chunk_size, uint32_t frame_count,
+                                       VkGeometryFlagsKHR geometry_flags, VkBuildAccelerationStructureFlagsKHR flags) {
+                if (aabb_count == 0)
+                    return false;
+
+                device = dev;
+                count = aabb_count;
+                chunk_size = aabb_chunk_size > 0 ? std::min(aabb_chunk_size, aabb_count) : aabb_count;
+
+                // storage buffer usage so intersection shaders can read the boxes
+                aabb_buffer = buffer::make();
+                if (!aabb_buffer->create(device, nullptr, sizeof(VkAabbPositionsKHR) * count,
+                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+                                             | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                         false, VMA_MEMORY_USAGE_GPU_ONLY))
+                    return false;
+
+                // room for all boxes in every frame, the first build() copies everything
+                staging = make_upload_ring();
+                if (!staging->create(device, sizeof(VkAabbPositionsKHR) * count, frame_count))
+                    return false;
+
+                boxes.assign(aabbs, aabbs + count);
+
+                const VkAccelerationStructureGeometryAabbsDataKHR data = { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR,
+                                                                           .data = { aabb_buffer->get_address() },
+                                                                           .stride = sizeof(VkAabbPositionsKHR) };
+
+                // all chunks but the last one have the same size, so they need only one size query
+                build_size_cache size_cache;
+
+                const size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+                for (size_t i = 0; i < chunk_count; i++) {
+                    const size_t first = i * chunk_size;
+                    const VkAccelerationStructureBuildRangeInfoKHR range = {
+                        .primitiveCount = uint32_t(std::min(chunk_size, count - first)),
+                        .primitiveOffset = uint32_t(first * sizeof(VkAabbPositionsKHR)) // in bytes
+                    };
+
+                    bottom_level_acceleration_structure::ptr chunk = make_bottom_level_acceleration_structure();
+                    chunk->add_geometry(data, range, geometry_flags);
+                    chunk->set_build_sizes(size_cache.get(device, *chunk, flags));
+                    if (!chunk->create(device, flags))
+                        return false;
+                    chunks.push_back(chunk);
+                }
+
+                dirty_chunks.assign(chunks.size(), true);
+
+                return true;
+            }
+
+            void aabb_geometry::destroy() {
+                chunks.clear();
+                dirty_chunks.clear();
+                boxes.clear();
+
+                if (staging) {
+                    staging->destroy();
+                    staging = nullptr;
+                }
+                if (aabb_buffer) {
+                    aabb_buffer->destroy();
+                    aabb_buffer = nullptr;
+                }
+
+                count = 0;
+                chunk_size = 0;
+                device = nullptr;
+            }
+
+            void aabb_geometry::update(index first, const VkAabbPositionsKHR* aabbs, size_t aabb_count) {
+                if (first >= count)
+                    return;
+                aabb_count = std::min(aabb_count, count - first);
+                memcpy(boxes.data() + first, aabbs, sizeof(VkAabbPositionsKHR) * aabb_count);
+                mark_dirty(first, aabb_count);
+            }
+
+            void aabb_geometry::mark_dirty(index first, size_t aabb_count) {
+                if (aabb_count == 0 || first >= count)
+                    return;
+                const size_t last = std::min(size_t(first) + aabb_count, count) - 1;
+                for (size_t i = first / chunk_size; i <= last / chunk_size; i++)
+                    dirty_chunks[i] = true;
+            }
+
+            uint32_t aabb_geometry::build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer, index frame) {
+                if (!dirty())
+                    return 0;
+
+                // one copy per run of consecutive chunks that need a build, the staging ranges are packed so runs stay contiguous
+                staging->begin_frame(frame);
+                std::vector<VkBufferCopy> copies;
+                for (size_t i = 0; i < chunks.size(); i++) {
+                    if (chunks[i]->is_built() && !dirty_chunks[i])
+                        continue;
+
+                    const size_t first = i * chunk_size;
+                    const VkDeviceSize size = sizeof(VkAabbPositionsKHR) * std::min(chunk_size, count - first);
+                    const upload_ring::allocation allocation = staging->upload(boxes.data() + first, size, alignof(VkAabbPositionsKHR));
+                    if (!allocation)
+                        return 0;
+
+                    const VkDeviceSize dst_offset = sizeof(VkAabbPositionsKHR) * first;
+                    if (!copies.empty() && copies.back().dstOffset + copies.back().size == dst_offset
+                        && copies.back().srcOffset + copies.back().size == allocation.offset)
+                        copies.back().size += size;
+                    else
+                        copies.push_back({ .srcOffset = allocation.offset, .dstOffset = dst_offset, .size = size });
+                }
+                staging->flush();
+
+                device->call().vkCmdCopyBuffer(cmd_buf, staging->get_buffer()->get(), aabb_buffer->get(), uint32_t(copies.size()), copies.data());
+
+                // build inputs and the intersection shaders read the copied boxes
+                insert_memory_barrier(device, cmd_buf, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+
+                uint32_t build_count = 0;
+                for (size_t i = 0; i < chunks.size(); i++) {
+                    const bottom_level_acceleration_structure::ptr& chunk = chunks[i];
+                    if (chunk->is_built() && !dirty_chunks[i])
+                        continue;
+
+                    // scratch memory is reused by the next build
+                    if (build_count > 0)
+                        insert_build_barrier(device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+                                             VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+
+                    // chunks that were never built and structures without ALLOW_UPDATE need a full build
+                    if (!chunk->update(cmd_buf, scratch_buffer) && !chunk->rebuild(cmd_buf, scratch_buffer))
+                        continue;
+
+                    dirty_chunks[i] = false;
+                    build_count++;
+                }
+
+                return build_count;
+            }
+
+            bool aabb_geometry::dirty() const {
+                for (size_t i = 0; i < chunks.size(); i++) {
+                    if (!chunks[i]->is_built() || dirty_chunks[i])
+                        return true;
+                }
+                return false;
+            }
+
+            VkDeviceSize aabb_geometry::scratch_buffer_size() const {
+                VkDeviceSize size = 0;
+                for (const bottom_level_acceleration_structure::ptr& chunk : chunks)
+                    size = std::max(size, chunk->scratch_buffer_size());
+                return size;
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+#include "liblava-extras/raytracing/upload_ring.hpp"
+
+// procedural geometry made of axis-aligned bounding boxes, e.g. for particles or volumes
+// the boxes live in one device-local buffer, but are split into chunks with a separate BLAS each:
+// updates can only refit entire structures, so splitting lets build() skip all chunks that didn't change
+// each chunk needs its own TLAS instance with a procedural hit group (closest hit + intersection shader)
+// changes go to a host copy, build() stages the dirty chunks in the region of the frame and copies them over before the refit,
+// so frames in flight keep reading the boxes their BLAS were refit for
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct aabb_geometry {
+                using ptr = std::shared_ptr<aabb_geometry>;
+
+                ~aabb_geometry() {
+                    destroy();
+                }
+
+                // chunk_size 0 puts all boxes into a single BLAS, frame_count is the number of frames in flight
+                bool create(device_p device, const VkAabbPositionsKHR* aabbs, size_t count, size_t chunk_size = 0, uint32_t frame_count = 1,
+                            VkGeometryFlagsKHR geometry_flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+                            VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+                void destroy();
+
+                // copy count boxes into the host copy, starting at box index first
+                void update(index first, const VkAabbPositionsKHR* aabbs, size_t count);
+
+                // for writing the host copy in place, call mark_dirty() for the changed range afterwards
+                VkAabbPositionsKHR* get_data() {
+                    return boxes.data();
+                }
+                void mark_dirty(index first, size_t count);
+
+                // copies the dirty chunks to the buffer, builds chunks that weren't built yet and refits the ones marked dirty
+                // frame is the index being recorded, its staging region was used frame_count frames ago
+                // wait for the last trace reading the boxes before this, the copies are in the transfer stage
+                // they all use the same scratch buffer, so there's a barrier between each build
+                // returns the number of recorded builds, insert a barrier before using the structures if it's > 0
+                uint32_t build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer, index frame = 0);
+
+                bool dirty() const;
+                VkDeviceSize scratch_buffer_size() const;
+
+                bottom_level_acceleration_structure::list const& get_chunks() const {
+                    return chunks;
+                }
+
+                // index of the first box in the chunk, use it as instanceCustomIndex to find the boxes in shaders
+                uint32_t get_chunk_offset(index chunk) const {
+                    return uint32_t(chunk * chunk_size);
+                }
+
+                size_t get_count() const {
+                    return count;
+                }
+
+                size_t get_chunk_size() const {
+                    return chunk_size;
+                }
+
+                // read by the builds and the intersection shaders
+                buffer::ptr get_buffer() const {
+                    return aabb_buffer;
+                }
+
+            private:
+                device_p device = nullptr;
+
+                buffer::ptr aabb_buffer;
+                upload_ring::ptr staging;
+                std::vector<VkAabbPositionsKHR> boxes;
+                size_t count = 0;
+                size_t chunk_size = 0;
+
+                bottom_level_acceleration_structure::list chunks;
+                // the buffer is behind the host copy
+                std::vector<bool> dirty_chunks;
+            };
+
+            inline aabb_geometry::ptr make_aabb_geometry() {
+                return std::make_shared<aabb_geometry>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -1,13 +1,18 @@
 #include "liblava-extras/raytracing/acceleration_structure.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
 
 namespace lava {
     namespace extras {
         namespace raytracing {
 
-            acceleration_structure::acceleration_structure()
+            acceleration_structure::acceleration_structure(std::pmr::memory_resource* resource)
             : properties({ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR }),
               create_info({ .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR }),
-              build_info({ .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR }) {
+              build_info({ .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR }),
+              sizes({ .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR }),
+              geometries(resource),
+              ranges(resource),
+              primitive_counts(resource) {
             }
 
             bool acceleration_structure::create_internal(device_p dev, VkBuildAccelerationStructureFlagsKHR flags) {
@@ -20,27 +25,21 @@ namespace lava {
                 build_info.type = create_info.type;
                 build_info.flags = flags;
 
+                // cached so scratch_buffer_size() doesn't query the driver for every structure again
+                // skip the query entirely if the sizes were set with set_build_sizes()
+                if (sizes.accelerationStructureSize == 0)
+                    sizes = get_sizes();
+
                 if (compact_size > 0) {
                     // set by compact() before calling create() on the new AS
                     create_info.size = compact_size;
                 } else {
-                    create_info.size = get_sizes().accelerationStructureSize;
+                    create_info.size = sizes.accelerationStructureSize;
                 }
 
-                as_buffer = buffer::make();
-                if (!as_buffer->create(device, nullptr, create_info.size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT))
-                    return false;
-                create_info.buffer = as_buffer->get();
-
-                if (!check(vkCreateAccelerationStructureKHR(device->get(), &create_info, memory::instance().alloc(), &handle)))
+                if (!create_handle())
                     return false;
 
-                const VkAccelerationStructureDeviceAddressInfoKHR address_info = {
-                    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
-                    .accelerationStructure = handle
-                };
-                address = device->call().vkGetAccelerationStructureDeviceAddressKHR(device->get(), &address_info);
-
                 const VkQueryPoolCreateInfo pool_info = {
                     .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
                     .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
@@ -53,34 +52,185 @@ namespace lava {
             }
 
             void acceleration_structure::destroy() {
-                if (handle != VK_NULL_HANDLE) {
-                    device->call().vkDestroyAccelerationStructureKHR(device->get(), handle, memory::instance().alloc());
+                evict();
+
+                geometries.clear();
+                ranges.clear();
+                primitive_counts.clear();
+
+                sizes = { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+            }
+
+            bool acceleration_structure::create_handle() {
+                if (placement) {
+                    if (!placement->allocate(create_info.size, as_buffer, buffer_offset))
+                        return false;
+                } else {
+                    as_buffer = buffer::make();
+                    if (!as_buffer->create(device, nullptr, create_info.size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT))
+                        return false;
+                    buffer_offset = 0;
+                }
+                create_info.buffer = as_buffer->get();
+                create_info.offset = buffer_offset;
+
+                if (!check(vkCreateAccelerationStructureKHR(device->get(), &create_info, memory::instance().alloc(), &handle))) {
+                    retire(VK_NULL_HANDLE, VK_NULL_HANDLE, as_buffer, buffer_offset);
+                    as_buffer = nullptr;
                     handle = VK_NULL_HANDLE;
-                    address = 0;
+                    return false;
                 }
 
-                if (query_pool != VK_NULL_HANDLE) {
-                    device->call().vkDestroyQueryPool(device->get(), query_pool, memory::instance().alloc());
+                const VkAccelerationStructureDeviceAddressInfoKHR address_info = {
+                    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+                    .accelerationStructure = handle
+                };
+                address = device->call().vkGetAccelerationStructureDeviceAddressKHR(device->get(), &address_info);
+
+                return true;
+            }
+
+            void acceleration_structure::retire(VkAccelerationStructureKHR old_handle, VkQueryPool old_query_pool, buffer::ptr old_buffer, VkDeviceSize old_offset) {
+                auto release = [dev = device, as_handle = old_handle, as_query_pool = old_query_pool, buf = old_buffer,
+                                mem = placement, offset = old_offset, size = create_info.size]() {
+                    if (as_handle != VK_NULL_HANDLE)
+                        dev->call().vkDestroyAccelerationStructureKHR(dev->get(), as_handle, memory::instance().alloc());
+                    if (as_query_pool != VK_NULL_HANDLE)
+                        dev->call().vkDestroyQueryPool(dev->get(), as_query_pool, memory::instance().alloc());
+                    if (buf) {
+                        if (mem)
+                            mem->free(buf, offset, size);
+                        else
+                            buf->destroy();
+                    }
+                };
+
+                // frames in flight might still trace against this structure
+                if (deletion)
+                    deletion->retire(std::move(release));
+                else
+                    release();
+            }
+
+            void acceleration_structure::evict() {
+                if (handle != VK_NULL_HANDLE || query_pool != VK_NULL_HANDLE || as_buffer) {
+                    retire(handle, query_pool, as_buffer, buffer_offset);
+
+                    handle = VK_NULL_HANDLE;
+                    address = 0;
                     query_pool = VK_NULL_HANDLE;
+                    as_buffer = nullptr;
+                    buffer_offset = 0;
                 }
 
-                if (as_buffer) {
-                    as_buffer->destroy();
-                    as_buffer = nullptr;
+                built = false;
+            }
+
+            bool acceleration_structure::relocate(VkCommandBuffer cmd_buf) {
+                if (!built || handle == VK_NULL_HANDLE)
+                    return false;
+
+                const VkAccelerationStructureKHR old_handle = handle;
+                const VkDeviceAddress old_address = address;
+                const buffer::ptr old_buffer = as_buffer;
+                const VkDeviceSize old_offset = buffer_offset;
+
+                if (!create_handle()) {
+                    handle = old_handle;
+                    address = old_address;
+                    as_buffer = old_buffer;
+                    buffer_offset = old_offset;
+                    create_info.buffer = as_buffer->get();
+                    create_info.offset = buffer_offset;
+                    return false;
                 }
 
-                geometries.clear();
-                ranges.clear();
+                const VkCopyAccelerationStructureInfoKHR copy_info = {
+                    .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+                    .src = old_handle,
+                    .dst = handle,
+                    .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR
+                };
+                device->call().vkCmdCopyAccelerationStructureKHR(cmd_buf, &copy_info);
 
-                built = false;
+                // the copy and frames in flight still read the old one
+                retire(old_handle, VK_NULL_HANDLE, old_buffer, old_offset);
+                return true;
+            }
+
+            bool acceleration_structure::restore(bool keep_compact_size) {
+                if (handle != VK_NULL_HANDLE || !device)
+                    return false;
+                // a rebuild needs the full size, the result is no longer compacted
+                if (!keep_compact_size)
+                    compact_size = 0;
+                // not create(), the TLAS version would add its instance geometry again
+                return create_internal(device, build_info.flags);
+            }
+
+            bool acceleration_structure::serialize(VkCommandBuffer cmd_buf, VkDeviceAddress data) const {
+                if (!built)
+                    return false;
+
+                const VkCopyAccelerationStructureToMemoryInfoKHR copy_info = {
+                    .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR,
+                    .src = handle,
+                    .dst = { .deviceAddress = data },
+                    .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR
+                };
+                device->call().vkCmdCopyAccelerationStructureToMemoryKHR(cmd_buf, &copy_info);
+                return true;
+            }
+
+            bool acceleration_structure::deserialize(VkCommandBuffer cmd_buf, VkDeviceAddress data) {
+                if (handle == VK_NULL_HANDLE)
+                    return false;
+
+                const VkCopyMemoryToAccelerationStructureInfoKHR copy_info = {
+                    .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR,
+                    .src = { .deviceAddress = data },
+                    .dst = handle,
+                    .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR
+                };
+                device->call().vkCmdCopyMemoryToAccelerationStructureKHR(cmd_buf, &copy_info);
+
+                // updates need the source's ALLOW_UPDATE flag, which build_info still has
+                built = true;
+                return true;
             }
 
             VkDeviceSize acceleration_structure::scratch_buffer_size() const {
-                const VkAccelerationStructureBuildSizesInfoKHR sizes = get_sizes();
                 return std::max(sizes.buildScratchSize, sizes.updateScratchSize);
             }
 
             bool acceleration_structure::build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer) {
+                if (!prepare_build(scratch_buffer))
+                    return false;
+
+                const VkAccelerationStructureBuildRangeInfoKHR* build_ranges = ranges.data();
+
+                device->call().vkCmdBuildAccelerationStructuresKHR(cmd_buf, 1, &build_info, &build_ranges);
+                finish_build(cmd_buf);
+
+                return true;
+            }
+
+            bool acceleration_structure::build_indirect(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer, VkDeviceAddress build_ranges) {
+                // primitive counts can change between indirect builds, updates require the same count as the source
+                invalidate();
+                if (!prepare_build(scratch_buffer))
+                    return false;
+
+                const uint32_t stride = sizeof(VkAccelerationStructureBuildRangeInfoKHR);
+                const uint32_t* max_primitive_counts = primitive_counts.data();
+
+                device->call().vkCmdBuildAccelerationStructuresIndirectKHR(cmd_buf, 1, &build_info, &build_ranges, &stride, &max_primitive_counts);
+                finish_build(cmd_buf);
+
+                return true;
+            }
+
+            bool acceleration_structure::prepare_build(VkDeviceAddress scratch_buffer) {
                 if (handle == VK_NULL_HANDLE)
                     return false;
                 if (built && !(build_info.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR))
@@ -91,26 +241,19 @@ namespace lava {
                 build_info.geometryCount = uint32_t(geometries.size());
                 build_info.pGeometries = geometries.data();
                 build_info.scratchData.deviceAddress = scratch_buffer;
+                return true;
+            }
 
-                const VkAccelerationStructureBuildRangeInfoKHR* build_ranges = ranges.data();
-
-                device->call().vkCmdBuildAccelerationStructuresKHR(cmd_buf, 1, &build_info, &build_ranges);
+            void acceleration_structure::finish_build(VkCommandBuffer cmd_buf, bool barrier) {
                 built = true;
 
                 if (build_info.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) {
-                    const VkMemoryBarrier barrier = {
-                        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-                        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
-                        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
-                    };
-                    device->call().vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
-                                                        1, &barrier, 0, nullptr, 0, nullptr);
+                    if (barrier)
+                        insert_build_barrier(device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
                     device->call().vkCmdResetQueryPool(cmd_buf, query_pool, 0, 1);
                     device->call().vkCmdWriteAccelerationStructuresPropertiesKHR(
                         cmd_buf, 1, &handle, VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, query_pool, 0);
                 }
-
-                return true;
             }
 
             acceleration_structure::ptr acceleration_structure::compact(VkCommandBuffer cmd_buf) {
@@ -121,15 +264,18 @@ namespace lava {
 
                 acceleration_structure::ptr new_structure = nullptr;
                 if (build_info.type == VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR)
-                    new_structure = make_bottom_level_acceleration_structure();
+                    new_structure = make_bottom_level_acceleration_structure(geometries.get_allocator().resource());
                 else if (build_info.type == VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR)
                     new_structure = make_top_level_acceleration_structure();
                 else
                     return nullptr;
 
+                new_structure->deletion = deletion;
+                new_structure->placement = placement;
                 new_structure->build_info = build_info;
                 new_structure->geometries = geometries;
                 new_structure->ranges = ranges;
+                new_structure->primitive_counts = primitive_counts;
                 new_structure->built = built;
 
                 check(device->call().vkGetQueryPoolResults(device->get(), query_pool, 0, 1, sizeof(VkDeviceSize), &new_structure->compact_size, sizeof(VkDeviceSize), VK_QUERY_RESULT_WAIT_BIT));
@@ -157,6 +303,7 @@ namespace lava {
                                        .geometry = geometry_data,
                                        .flags = flags });
                 ranges.push_back(range);
+                primitive_counts.push_back(range.primitiveCount);
             }
 
             VkAccelerationStructureBuildSizesInfoKHR acceleration_structure::get_sizes() const {
@@ -164,9 +311,6 @@ namespace lava {
                 build_info.geometryCount = uint32_t(geometries.size());
 
                 const VkAccelerationStructureBuildTypeKHR build_type = VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR;
-                std::vector<uint32_t> primitive_counts(ranges.size());
-                std::transform(ranges.begin(), ranges.end(), primitive_counts.begin(),
-                               [](const VkAccelerationStructureBuildRangeInfoKHR& r) { return r.primitiveCount; });
 
                 VkAccelerationStructureBuildSizesInfoKHR info = {
                     .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR
@@ -183,6 +327,11 @@ namespace lava {
             void bottom_level_acceleration_structure::clear_geometries() {
                 geometries.clear();
                 ranges.clear();
+                primitive_counts.clear();
+
+                // the next create() queries the sizes of the new geometries
+                sizes = { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+                compact_size = 0;
             }
 
             top_level_acceleration_structure::top_level_acceleration_structure()
@@ -194,7 +343,8 @@ namespace lava {
             bool top_level_acceleration_structure::create(device_p dev, VkBuildAccelerationStructureFlagsKHR flags) {
                 device = dev;
 
-                if (!instance_buffer.create_mapped(device, instances.data(), sizeof(decltype(instances)::value_type) * instances.size(),
+                instance_buffer = buffer::make();
+                if (!instance_buffer->create_mapped(device, instances.data(), sizeof(decltype(instances)::value_type) * instances.size(),
                                                    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR))
                     return false;
 
@@ -202,7 +352,7 @@ namespace lava {
                     .instances = {
                         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
                         .arrayOfPointers = VK_FALSE,
-                        .data = { .deviceAddress = instance_buffer.get_address() } }
+                        .data = { .deviceAddress = instance_buffer->get_address() } }
                 };
                 const VkAccelerationStructureBuildRangeInfoKHR range = {
                     .primitiveCount = uint32_t(instances.size()),
@@ -214,9 +364,36 @@ namespace lava {
                 return create_internal(dev, flags);
             }
 
+            bool top_level_acceleration_structure::create(device_p dev, VkDeviceAddress instance_data, uint32_t max_instance_count, VkBuildAccelerationStructureFlagsKHR flags) {
+                device = dev;
+
+                const VkAccelerationStructureGeometryDataKHR geometry = {
+                    .instances = {
+                        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+                        .arrayOfPointers = VK_FALSE,
+                        .data = { .deviceAddress = instance_data } }
+                };
+                const VkAccelerationStructureBuildRangeInfoKHR range = {
+                    .primitiveCount = max_instance_count,
+                    .primitiveOffset = 0
+                };
+                add_geometry(geometry, VK_GEOMETRY_TYPE_INSTANCES_KHR, range);
+
+                create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+                return create_internal(dev, flags);
+            }
+
             void top_level_acceleration_structure::destroy() {
                 instances.clear();
-                instance_buffer.destroy();
+                previous_transforms.clear();
+                if (instance_buffer) {
+                    // read by builds that might still be in flight
+                    if (deletion)
+                        deletion->retire([buf = instance_buffer]() { buf->destroy(); });
+                    else
+                        instance_buffer->destroy();
+                    instance_buffer = nullptr;
+                }
                 acceleration_structure::destroy();
             }
 
@@ -226,10 +403,11 @@ namespace lava {
                 instances.push_back(instance);
             }
 
-            void top_level_acceleration_structure::add_instance(bottom_level_acceleration_structure::ptr blas) {
+            void top_level_acceleration_structure::add_instance(bottom_level_acceleration_structure::ptr blas, uint32_t custom_index) {
                 if (built)
                     return;
                 instances.push_back({ .transform = *reinterpret_cast<const VkTransformMatrixKHR*>(glm::value_ptr(glm::identity<glm::mat4x3>())),
+                                      .instanceCustomIndex = custom_index,
                                       .mask = ~0u,
                                       .accelerationStructureReference = blas->get_address() });
             }
@@ -237,8 +415,8 @@ namespace lava {
             void top_level_acceleration_structure::update_instance(index i, const VkAccelerationStructureInstanceKHR& instance) {
                 if (i < instances.size()) {
                     instances[i] = instance;
-                    if (instance_buffer.valid()) {
-                        VkAccelerationStructureInstanceKHR* buffer_instances = static_cast<VkAccelerationStructureInstanceKHR*>(instance_buffer.get_mapped_data());
+                    if (instance_buffer) {
+                        VkAccelerationStructureInstanceKHR* buffer_instances = static_cast<VkAccelerationStructureInstanceKHR*>(instance_buffer->get_mapped_data());
                         buffer_instances[i] = instance;
                     }
                 }
@@ -247,8 +425,8 @@ namespace lava {
             void top_level_acceleration_structure::update_instance(index i, bottom_level_acceleration_structure::ptr blas) {
                 if (i < instances.size()) {
                     instances[i].accelerationStructureReference = blas->get_address();
-                    if (instance_buffer.valid()) {
-                        VkAccelerationStructureInstanceKHR* buffer_instances = static_cast<VkAccelerationStructureInstanceKHR*>(instance_buffer.get_mapped_data());
+                    if (instance_buffer) {
+                        VkAccelerationStructureInstanceKHR* buffer_instances = static_cast<VkAccelerationStructureInstanceKHR*>(instance_buffer->get_mapped_data());
                         buffer_instances[i].accelerationStructureReference = blas->get_address();
                     }
                 }
@@ -260,17 +438,47 @@ namespace lava {
                     const glm::mat3x4 transposed = glm::transpose(transform);
                     const VkTransformMatrixKHR& transform_ref = *reinterpret_cast<const VkTransformMatrixKHR*>(glm::value_ptr(transposed));
                     instances[i].transform = transform_ref;
-                    if (instance_buffer.valid()) {
-                        VkAccelerationStructureInstanceKHR* buffer_instances = static_cast<VkAccelerationStructureInstanceKHR*>(instance_buffer.get_mapped_data());
+                    if (instance_buffer) {
+                        VkAccelerationStructureInstanceKHR* buffer_instances = static_cast<VkAccelerationStructureInstanceKHR*>(instance_buffer->get_mapped_data());
                         buffer_instances[i].transform = transform_ref;
                     }
                 }
             }
 
+            void top_level_acceleration_structure::set_instance_data(VkDeviceAddress instance_data) {
+                if (geometries.empty())
+                    return;
+                if (!instance_data && instance_buffer)
+                    instance_data = instance_buffer->get_address();
+                geometries.front().geometry.instances.data.deviceAddress = instance_data;
+            }
+
+            void top_level_acceleration_structure::save_transforms() {
+                previous_transforms.resize(instances.size());
+                for (size_t i = 0; i < instances.size(); i++)
+                    previous_transforms[i] = instances[i].transform;
+            }
+
+            bool top_level_acceleration_structure::transforms_changed() const {
+                if (previous_transforms.size() != instances.size())
+                    return true;
+                for (size_t i = 0; i < instances.size(); i++) {
+                    if (memcmp(&previous_transforms[i], &instances[i].transform, sizeof(VkTransformMatrixKHR)) != 0)
+                        return true;
+                }
+                return false;
+            }
+
             void top_level_acceleration_structure::clear_instances() {
                 geometries.clear();
                 ranges.clear();
+                primitive_counts.clear();
                 instances.clear();
+                previous_transforms.clear();
+
+                // the next create() queries the sizes of the new instances
+                sizes = { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+                compact_size = 0;
             }
 
         } // namespace raytracing
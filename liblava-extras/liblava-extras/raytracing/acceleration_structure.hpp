@@ -1,15 +1,31 @@
 #pragma once
 
+#include "liblava-extras/raytracing/deletion_queue.hpp"
 #include "liblava/resource/buffer.hpp"
+#include <memory_resource>
 
 namespace lava {
     namespace extras {
         namespace raytracing {
 
+            // placement of structures in device memory, by default each structure gets its own buffer
+            // structure_heap implements it to suballocate structures from a few large blocks
+            struct structure_memory {
+                using ptr = std::shared_ptr<structure_memory>;
+
+                virtual ~structure_memory() = default;
+
+                // offset has to be 256 byte aligned, the buffer needs acceleration structure storage usage
+                virtual bool allocate(VkDeviceSize size, buffer::ptr& buffer, VkDeviceSize& offset) = 0;
+                // called once the deletion queue released the structure
+                virtual void free(const buffer::ptr& buffer, VkDeviceSize offset, VkDeviceSize size) = 0;
+            };
+
             struct acceleration_structure {
                 using ptr = std::shared_ptr<acceleration_structure>;
 
-                acceleration_structure();
+                // geometry arrays are allocated from resource, e.g. a host_pool when creating many structures at scene load
+                explicit acceleration_structure(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 
                 virtual ~acceleration_structure() {
                     destroy();
@@ -28,8 +44,48 @@ namespace lava {
                 bool update(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer) {
                     return built ? build(cmd_buf, scratch_buffer) : false;
                 }
+                // full build from scratch, for structures without ALLOW_UPDATE or when updates degraded quality too much
+                bool rebuild(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer) {
+                    invalidate();
+                    return build(cmd_buf, scratch_buffer);
+                }
+                // the next build() does a full build instead of an update
+                void invalidate() {
+                    built = false;
+                }
+                // full build with the ranges read from the GPU, one VkAccelerationStructureBuildRangeInfoKHR per geometry at build_ranges
+                // the primitive counts passed to add_geometry are the maximum, needs the accelerationStructureIndirectBuild feature
+                bool build_indirect(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer, VkDeviceAddress build_ranges);
                 acceleration_structure::ptr compact(VkCommandBuffer cmd_buf);
 
+                // frees the device memory but keeps the geometries and build sizes, restore() recreates it
+                // the address changes, TLAS instances referencing it have to be updated after restoring
+                void evict();
+                // recreates an evicted structure, build() or deserialize() it afterwards
+                // compacted structures get their full size back for a rebuild unless keep_compact_size, e.g. to deserialize a compacted copy
+                bool restore(bool keep_compact_size = false);
+
+                // moves a built structure to newly allocated memory with a clone copy, the old memory is retired
+                // the address changes like after compact(), but the object stays the same
+                // TLAS instances referencing it have to be updated, a relocated TLAS needs its descriptors written again
+                bool relocate(VkCommandBuffer cmd_buf);
+
+                // copies the structure to device memory at data, which needs the size of a
+                // VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR query
+                bool serialize(VkCommandBuffer cmd_buf, VkDeviceAddress data) const;
+                // fills a created structure of the serialized size from serialize() data written on a compatible device
+                bool deserialize(VkCommandBuffer cmd_buf, VkDeviceAddress data);
+
+                // for recording several builds in one vkCmdBuildAccelerationStructuresKHR call:
+                // prepare_build() fills the build info, pass get_build_info() and get_ranges().data() to the call,
+                // then call finish_build() for each structure. barrier can be false if a barrier after the builds was already recorded
+                bool prepare_build(VkDeviceAddress scratch_buffer);
+                void finish_build(VkCommandBuffer cmd_buf, bool barrier = true);
+
+                const VkAccelerationStructureBuildGeometryInfoKHR& get_build_info() const {
+                    return build_info;
+                }
+
                 VkAccelerationStructureKHR get() const {
                     return handle;
                 }
@@ -42,8 +98,67 @@ namespace lava {
                     return address;
                 }
 
+                bool is_built() const {
+                    return built;
+                }
+
+                // false after evict() until restore()
+                bool is_resident() const {
+                    return handle != VK_NULL_HANDLE;
+                }
+
+                // device memory of the structure, valid after create() and still the evicted size after evict()
+                VkDeviceSize get_size() const {
+                    return create_info.size;
+                }
+
+                // destroy() hands the handles to the queue instead of freeing them right away
+                // compacted structures inherit the queue
+                void set_deletion_queue(deletion_queue::ptr queue) {
+                    deletion = queue;
+                }
+
+                // call before create(), compacted structures inherit it
+                void set_memory(structure_memory::ptr memory) {
+                    placement = memory;
+                }
+
+                const buffer::ptr& get_buffer() const {
+                    return as_buffer;
+                }
+
+                VkDeviceSize get_buffer_offset() const {
+                    return buffer_offset;
+                }
+
+                const std::pmr::vector<VkAccelerationStructureGeometryKHR>& get_geometries() const {
+                    return geometries;
+                }
+
+                const std::pmr::vector<VkAccelerationStructureBuildRangeInfoKHR>& get_ranges() const {
+                    return ranges;
+                }
+
+                // call before adding geometries if their number is known, so the arrays are allocated once
+                void reserve_geometries(size_t count) {
+                    geometries.reserve(count);
+                    ranges.reserve(count);
+                    primitive_counts.reserve(count);
+                }
+
+                // only valid after create()
                 VkDeviceSize scratch_buffer_size() const;
 
+                const VkAccelerationStructureBuildSizesInfoKHR& get_build_sizes() const {
+                    return sizes;
+                }
+
+                // call before create() to skip the size query, e.g. with sizes from a build_size_cache
+                // they must have been queried with the same geometries and flags
+                void set_build_sizes(const VkAccelerationStructureBuildSizesInfoKHR& build_sizes) {
+                    sizes = build_sizes;
+                }
+
             protected:
                 device_p device = nullptr;
 
@@ -51,6 +166,7 @@ namespace lava {
 
                 VkAccelerationStructureCreateInfoKHR create_info;
                 mutable VkAccelerationStructureBuildGeometryInfoKHR build_info;
+                VkAccelerationStructureBuildSizesInfoKHR sizes;
 
                 VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
                 VkDeviceAddress address = 0;
@@ -58,16 +174,25 @@ namespace lava {
                 VkQueryPool query_pool = VK_NULL_HANDLE;
 
                 buffer::ptr as_buffer;
+                VkDeviceSize buffer_offset = 0;
+                structure_memory::ptr placement;
 
-                std::vector<VkAccelerationStructureGeometryKHR> geometries;
-                std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges;
+                std::pmr::vector<VkAccelerationStructureGeometryKHR> geometries;
+                std::pmr::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges;
+                // primitiveCount of each range, kept around for get_sizes()
+                std::pmr::vector<uint32_t> primitive_counts;
 
                 // this is set on the newly created acceleration structure by compact()
                 VkDeviceSize compact_size = 0;
 
                 bool built = false;
 
+                deletion_queue::ptr deletion;
+
                 bool create_internal(device_p dev, VkBuildAccelerationStructureFlagsKHR flags);
+                // allocates memory of create_info.size and creates the handle
+                bool create_handle();
+                void retire(VkAccelerationStructureKHR old_handle, VkQueryPool old_query_pool, buffer::ptr old_buffer, VkDeviceSize old_offset);
                 void add_geometry(const VkAccelerationStructureGeometryDataKHR& geometry_data, VkGeometryTypeKHR type, const VkAccelerationStructureBuildRangeInfoKHR& range, VkGeometryFlagsKHR flags = 0);
                 VkAccelerationStructureBuildSizesInfoKHR get_sizes() const;
             };
@@ -77,6 +202,9 @@ namespace lava {
                 using map = std::map<id, ptr>;
                 using list = std::vector<ptr>;
 
+                explicit bottom_level_acceleration_structure(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+                : acceleration_structure(resource) {}
+
                 virtual bool create(device_p device, VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR) override;
 
                 void add_geometry(const VkAccelerationStructureGeometryTrianglesDataKHR& triangles, const VkAccelerationStructureBuildRangeInfoKHR& range, VkGeometryFlagsKHR flags = 0) {
@@ -96,7 +224,16 @@ namespace lava {
 
                 top_level_acceleration_structure();
 
+                // the base destructor only reaches acceleration_structure::destroy(), the instance buffer is retired here
+                ~top_level_acceleration_structure() {
+                    destroy();
+                }
+
                 virtual bool create(device_p device, VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR) override;
+                // instances are written to instance_data by the GPU (e.g. instance_generator) instead of add_instance()
+                // the instance functions below do nothing for these
+                bool create(device_p device, VkDeviceAddress instance_data, uint32_t max_instance_count,
+                            VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
                 virtual void destroy() override;
 
                 const VkWriteDescriptorSetAccelerationStructureKHR* get_descriptor_info() const {
@@ -104,18 +241,40 @@ namespace lava {
                 };
 
                 void add_instance(const VkAccelerationStructureInstanceKHR& instance);
-                void add_instance(bottom_level_acceleration_structure::ptr blas);
+                // custom_index is available in shaders as gl_InstanceCustomIndexEXT (24 bits)
+                void add_instance(bottom_level_acceleration_structure::ptr blas, uint32_t custom_index = 0);
 
+                // not thread-safe, instance_writer takes writes from many threads
                 void update_instance(index i, const VkAccelerationStructureInstanceKHR& instance);
                 void update_instance(index i, bottom_level_acceleration_structure::ptr blas);
 
                 void set_instance_transform(index i, const glm::mat4x3& transform);
 
+                // the next build or update reads the instances from instance_data instead of the internal buffer
+                // e.g. a copy of get_instances() staged in an upload_ring, so builds in flight never see later writes
+                // instance_data must be 16 byte aligned and stay valid until the build finished, 0 switches back to the internal buffer
+                void set_instance_data(VkDeviceAddress instance_data);
+
+                const std::vector<VkAccelerationStructureInstanceKHR>& get_instances() const {
+                    return instances;
+                }
+
+                // keeps a copy of the current transforms, call once per frame before changing them
+                // shaders can use the previous transforms for motion vectors, e.g. indexed by gl_InstanceID
+                void save_transforms();
+                // true if any instance transform differs from the saved copy
+                bool transforms_changed() const;
+
+                const std::vector<VkTransformMatrixKHR>& get_previous_transforms() const {
+                    return previous_transforms;
+                }
+
                 void clear_instances();
 
             private:
                 std::vector<VkAccelerationStructureInstanceKHR> instances;
-                buffer instance_buffer;
+                std::vector<VkTransformMatrixKHR> previous_transforms;
+                buffer::ptr instance_buffer;
                 VkWriteDescriptorSetAccelerationStructureKHR descriptor;
             };
 
@@ -123,6 +282,11 @@ namespace lava {
                 return std::make_shared<bottom_level_acceleration_structure>();
             }
 
+            // the object with its control block and the geometry arrays come from resource, which must outlive the structure
+            inline bottom_level_acceleration_structure::ptr make_bottom_level_acceleration_structure(std::pmr::memory_resource* resource) {
+                return std::allocate_shared<bottom_level_acceleration_structure>(std::pmr::polymorphic_allocator<bottom_level_acceleration_structure>(resource), resource);
+            }
+
             inline top_level_acceleration_structure::ptr make_top_level_acceleration_structure() {
                 return std::make_shared<top_level_acceleration_structure>();
             }
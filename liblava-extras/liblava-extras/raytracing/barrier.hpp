@@ -0,0 +1,28 @@
+#pragma once
+
+#include "liblava/resource/image.hpp"
+
+// global memory barrier, the buffer and acceleration structure counterpart of lava's insert_image_memory_barrier
+// same argument order: access masks first, then stages
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            inline void insert_memory_barrier(device_p device, VkCommandBuffer cmd_buf, VkAccessFlags src_access, VkAccessFlags dst_access,
+                                              VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+                const VkMemoryBarrier barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                                  .srcAccessMask = src_access,
+                                                  .dstAccessMask = dst_access };
+                device->call().vkCmdPipelineBarrier(cmd_buf, src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            }
+
+            // between acceleration structure builds, copies and (de)serialization
+            inline void insert_build_barrier(device_p device, VkCommandBuffer cmd_buf, VkAccessFlags src_access, VkAccessFlags dst_access) {
+                insert_memory_barrier(device, cmd_buf, src_access, dst_access,
+                                      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR);
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,121 @@
+#include "liblava-extras/raytracing/blas_registry.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            namespace {
+
+                // 128-bit FNV-1a, the prime is 2^88 + 0x13b
+                struct fnv_hash {
+                    uint64_t low = 0x62b821756295c58dull;
+                    uint64_t high = 0x6c62272e07bb0142ull;
+
+                    void add_bytes(const void* bytes, size_t size) {
+                        const uint8_t* data = static_cast<const uint8_t*>(bytes);
+                        for (size_t i = 0; i < size; i++) {
+                            low ^= data[i];
+                            multiply();
+                        }
+                    }
+
+                    template<typename T>
+                    void add(const T& value) {
+                        add_bytes(&value, sizeof(T));
+                    }
+
+                    // (high, low) * (2^88 + 0x13b) mod 2^128, 0x13b is small enough to split low into 32-bit halves
+                    void multiply() {
+                        constexpr uint64_t prime_low = 0x13b;
+                        const uint64_t low_low = (low & 0xffffffffull) * prime_low;
+                        const uint64_t low_high = (low >> 32) * prime_low;
+                        const uint64_t product_low = low_low + (low_high << 32);
+                        const uint64_t carry = (low_high >> 32) + (product_low < low_low ? 1 : 0);
+                        high = high * prime_low + carry + (low << 24);
+                        low = product_low;
+                    }
+                };
+
+            } // namespace
+
+            blas_registry::key blas_registry::hash(const triangles_geometry::list& geometries, VkBuildAccelerationStructureFlagsKHR flags) {
+                fnv_hash hash;
+                hash.add(flags);
+                hash.add(geometries.size());
+
+                // members one by one, the structs have padding and device addresses that don't change the structure
+                // the transform is applied during the build, so its address is part of the input
+                for (const triangles_geometry& geometry : geometries) {
+                    hash.add(geometry.triangles.vertexFormat);
+                    hash.add(geometry.triangles.vertexStride);
+                    hash.add(geometry.triangles.maxVertex);
+                    hash.add(geometry.triangles.indexType);
+                    hash.add(geometry.triangles.transformData.deviceAddress);
+                    hash.add(geometry.range.primitiveCount);
+                    hash.add(geometry.range.primitiveOffset);
+                    hash.add(geometry.range.firstVertex);
+                    hash.add(geometry.range.transformOffset);
+                    hash.add(geometry.flags);
+                    hash.add(geometry.vertices.size);
+                    hash.add_bytes(geometry.vertices.ptr, geometry.vertices.size);
+                    hash.add(geometry.indices.size);
+                    hash.add_bytes(geometry.indices.ptr, geometry.indices.size);
+                }
+
+                return { .low = hash.low, .high = hash.high };
+            }
+
+            bottom_level_acceleration_structure::ptr blas_registry::get_or_create(device_p device, const triangles_geometry::list& geometries,
+                                                                                  VkBuildAccelerationStructureFlagsKHR flags, bool* created) {
+                if (created)
+                    *created = false;
+
+                const key k = hash(geometries, flags);
+                const auto it = entries.find(k);
+                if (it != entries.end())
+                    return it->second;
+
+                bottom_level_acceleration_structure::ptr blas = memory_resource ? make_bottom_level_acceleration_structure(memory_resource) : make_bottom_level_acceleration_structure();
+                blas->reserve_geometries(geometries.size());
+                for (const triangles_geometry& geometry : geometries)
+                    blas->add_geometry(geometry.triangles, geometry.range, geometry.flags);
+
+                if (heap)
+                    heap->add(blas);
+                if (!blas->create(device, flags))
+                    return nullptr;
+
+                entries[k] = blas;
+                if (created)
+                    *created = true;
+
+                return blas;
+            }
+
+            bottom_level_acceleration_structure::ptr blas_registry::find(const triangles_geometry::list& geometries, VkBuildAccelerationStructureFlagsKHR flags) const {
+                const auto it = entries.find(hash(geometries, flags));
+                return it != entries.end() ? it->second : nullptr;
+            }
+
+            void blas_registry::add(const triangles_geometry::list& geometries, VkBuildAccelerationStructureFlagsKHR flags, bottom_level_acceleration_structure::ptr blas) {
+                entries[hash(geometries, flags)] = blas;
+            }
+
+            size_t blas_registry::replace(const bottom_level_acceleration_structure::ptr& old_blas, bottom_level_acceleration_structure::ptr new_blas) {
+                size_t count = 0;
+                for (auto& entry : entries) {
+                    if (entry.second == old_blas) {
+                        entry.second = new_blas;
+                        count++;
+                    }
+                }
+                return count;
+            }
+
+            size_t blas_registry::evict_unused() {
+                return std::erase_if(entries, [](const auto& entry) { return entry.second.use_count() == 1; });
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "liblava-extras/raytracing/structure_heap.hpp"
+#include <unordered_map>
+
+// deduplicates BLAS for instanced meshes
+// geometries are identified by a 128-bit hash of their input (host copy of the buffer contents, range, format, transform, flags)
+// only the hash is kept, a collision between different inputs is unlikely enough to be ignored
+// the first request creates the BLAS, later requests with the same input get the same object
+// TLAS instances only store the BLAS address, so keep the returned ptr alive as long as it's referenced
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct blas_registry {
+                using ptr = std::shared_ptr<blas_registry>;
+
+                struct key {
+                    uint64_t low = 0;
+                    uint64_t high = 0;
+
+                    bool operator==(const key& other) const = default;
+                };
+
+                struct triangles_geometry {
+                    using list = std::vector<triangles_geometry>;
+
+                    VkAccelerationStructureGeometryTrianglesDataKHR triangles;
+                    VkAccelerationStructureBuildRangeInfoKHR range;
+                    VkGeometryFlagsKHR flags = 0;
+
+                    // host copies of the vertex and index data, only used for hashing
+                    cdata vertices;
+                    cdata indices;
+                };
+
+                // 128-bit FNV-1a of the input, the data is hashed in place without copying it
+                static key hash(const triangles_geometry::list& geometries, VkBuildAccelerationStructureFlagsKHR flags);
+
+                // returns the BLAS registered for these geometries or creates and registers a new one
+                // created is set to true if a new BLAS was created and needs to be built
+                bottom_level_acceleration_structure::ptr get_or_create(device_p device, const triangles_geometry::list& geometries,
+                                                                       VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+                                                                       bool* created = nullptr);
+
+                // new structures are allocated from resource, e.g. a host_pool, nullptr uses the default heap
+                // resource must outlive all structures created by the registry
+                void set_memory_resource(std::pmr::memory_resource* resource) {
+                    memory_resource = resource;
+                }
+
+                // new structures are placed in heap and defragmented by it, nullptr gives each structure its own buffer
+                void set_structure_heap(structure_heap::ptr structure_heap) {
+                    heap = structure_heap;
+                }
+
+                bottom_level_acceleration_structure::ptr find(const triangles_geometry::list& geometries, VkBuildAccelerationStructureFlagsKHR flags) const;
+                void add(const triangles_geometry::list& geometries, VkBuildAccelerationStructureFlagsKHR flags, bottom_level_acceleration_structure::ptr blas);
+
+                // swap in a new structure for all keys that map to the old one, e.g. after compact()
+                size_t replace(const bottom_level_acceleration_structure::ptr& old_blas, bottom_level_acceleration_structure::ptr new_blas);
+
+                // drop all structures that nobody but the registry references anymore
+                // returns the number of evicted structures
+                size_t evict_unused();
+
+                void clear() {
+                    entries.clear();
+                }
+
+                size_t size() const {
+                    return entries.size();
+                }
+
+            private:
+                struct key_hash {
+                    size_t operator()(const key& k) const {
+                        return size_t(k.low ^ k.high);
+                    }
+                };
+
+                std::unordered_map<key, bottom_level_acceleration_structure::ptr, key_hash> entries;
+                std::pmr::memory_resource* memory_resource = nullptr;
+                structure_heap::ptr heap;
+            };
+
+            inline blas_registry::ptr make_blas_registry() {
+                return std::make_shared<blas_registry>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,182 @@
+#include "liblava-extras/raytracing/build_recorder.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool build_recorder::create(device_p dev, uint32_t queue_family, uint32_t thread_count) {
+                device = dev;
+
+                if (thread_count == 0)
+                    thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+                slices.resize(thread_count);
+                cmd_bufs.reserve(thread_count);
+
+                // command pools must only be used by one thread at a time, so each slice gets its own
+                const VkCommandPoolCreateInfo pool_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                                                            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                                                            .queueFamilyIndex = queue_family };
+
+                for (slice& slice : slices) {
+                    if (!check(device->call().vkCreateCommandPool(device->get(), &pool_info, memory::instance().alloc(), &slice.pool)))
+                        return false;
+
+                    const VkCommandBufferAllocateInfo alloc_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                                                     .commandPool = slice.pool,
+                                                                     .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                                                                     .commandBufferCount = 1 };
+                    if (!check(device->call().vkAllocateCommandBuffers(device->get(), &alloc_info, &slice.cmd_buf)))
+                        return false;
+                }
+
+                generation = 0;
+                stop = false;
+                workers.reserve(thread_count - 1);
+                for (size_t i = 1; i < thread_count; i++)
+                    workers.emplace_back(&build_recorder::work, this, i);
+
+                return true;
+            }
+
+            void build_recorder::destroy() {
+                {
+                    std::lock_guard lock(mutex);
+                    stop = true;
+                }
+                start.notify_all();
+                for (std::thread& worker : workers)
+                    worker.join();
+                workers.clear();
+
+                for (slice& slice : slices) {
+                    // destroying the pool frees its command buffers
+                    if (slice.pool != VK_NULL_HANDLE)
+                        device->call().vkDestroyCommandPool(device->get(), slice.pool, memory::instance().alloc());
+                }
+
+                slices.clear();
+                cmd_bufs.clear();
+                device = nullptr;
+            }
+
+            VkDeviceSize build_recorder::scratch_buffer_size(const bottom_level_acceleration_structure::list& structures) const {
+                if (structures.empty() || slices.empty())
+                    return 0;
+
+                return get_scratch_stride(structures) * std::min<VkDeviceSize>(slices.size(), structures.size());
+            }
+
+            VkDeviceSize build_recorder::get_scratch_stride(const bottom_level_acceleration_structure::list& structures) {
+                if (structures.empty())
+                    return 0;
+
+                VkDeviceSize size = 0;
+                for (const bottom_level_acceleration_structure::ptr& structure : structures)
+                    size = std::max(size, structure->scratch_buffer_size());
+
+                const VkDeviceSize alignment = std::max<VkDeviceSize>(structures.front()->get_properties().minAccelerationStructureScratchOffsetAlignment, 1);
+                return align_up(size, alignment);
+            }
+
+            bool build_recorder::record(VkCommandBuffer cmd_buf, const bottom_level_acceleration_structure::list& structures, VkDeviceAddress scratch_buffer) {
+                if (slices.empty())
+                    return false;
+                if (structures.empty())
+                    return true;
+
+                const size_t per_slice = (structures.size() + slices.size() - 1) / slices.size();
+                const size_t slice_count = (structures.size() + per_slice - 1) / per_slice;
+
+                {
+                    std::lock_guard lock(mutex);
+                    job_structures = &structures;
+                    job_scratch_buffer = scratch_buffer;
+                    job_scratch_stride = get_scratch_stride(structures);
+                    job_per_slice = per_slice;
+                    job_slice_count = slice_count;
+                    pending = slice_count - 1;
+                    generation++;
+                }
+                if (slice_count > 1)
+                    start.notify_all();
+
+                // the calling thread records the first slice
+                record_range(0);
+
+                {
+                    std::unique_lock lock(mutex);
+                    done.wait(lock, [&] { return pending == 0; });
+                    job_structures = nullptr;
+                }
+
+                bool result = true;
+                cmd_bufs.clear();
+                for (size_t i = 0; i < slice_count; i++) {
+                    result = result && slices[i].result;
+                    cmd_bufs.push_back(slices[i].cmd_buf);
+                }
+
+                device->call().vkCmdExecuteCommands(cmd_buf, uint32_t(cmd_bufs.size()), cmd_bufs.data());
+
+                return result;
+            }
+
+            void build_recorder::work(size_t i) {
+                uint64_t last_generation = 0;
+                for (;;) {
+                    {
+                        std::unique_lock lock(mutex);
+                        start.wait(lock, [&] { return stop || generation != last_generation; });
+                        if (stop)
+                            return;
+                        last_generation = generation;
+                        // fewer structures than threads, this slice has nothing to do
+                        if (i >= job_slice_count)
+                            continue;
+                    }
+
+                    record_range(i);
+
+                    {
+                        std::lock_guard lock(mutex);
+                        pending--;
+                    }
+                    done.notify_one();
+                }
+            }
+
+            void build_recorder::record_range(size_t i) {
+                const bottom_level_acceleration_structure::list& structures = *job_structures;
+                const size_t first = i * job_per_slice;
+                const size_t count = std::min(job_per_slice, structures.size() - first);
+                slices[i].result = record_slice(slices[i], structures.data() + first, count, job_scratch_buffer + i * job_scratch_stride);
+            }
+
+            bool build_recorder::record_slice(slice& slice, const bottom_level_acceleration_structure::ptr* structures, size_t count, VkDeviceAddress scratch_buffer) {
+                check(device->call().vkResetCommandPool(device->get(), slice.pool, 0));
+
+                // no render pass, but secondary command buffers still need inheritance info
+                const VkCommandBufferInheritanceInfo inheritance_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+                const VkCommandBufferBeginInfo begin_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                                                              .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                                                              .pInheritanceInfo = &inheritance_info };
+                if (!check(device->call().vkBeginCommandBuffer(slice.cmd_buf, &begin_info)))
+                    return false;
+
+                bool result = true;
+                for (size_t i = 0; i < count; i++) {
+                    // scratch memory is reused by the next build in this slice
+                    if (i > 0)
+                        insert_build_barrier(device, slice.cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+                                             VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+                    result = structures[i]->build(slice.cmd_buf, scratch_buffer) && result;
+                }
+
+                return check(device->call().vkEndCommandBuffer(slice.cmd_buf)) && result;
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
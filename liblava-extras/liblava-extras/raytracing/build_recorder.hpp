@@ -0,0 +1,85 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// records acceleration structure builds on several threads
+// each thread has its own command pool and records a slice of the structures into a secondary command buffer,
+// the threads are started by create() and wait for the next record() in between
+// the primary command buffer then executes all of them, so they're submitted together
+// slices get separate scratch memory: builds in different slices don't wait for each other, builds in one slice do
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct build_recorder {
+                using ptr = std::shared_ptr<build_recorder>;
+
+                ~build_recorder() {
+                    destroy();
+                }
+
+                // thread_count 0 uses one thread per hardware thread
+                bool create(device_p device, uint32_t queue_family, uint32_t thread_count = 0);
+                void destroy();
+
+                // scratch memory needed by record() for these structures, slices start at multiples of get_scratch_stride()
+                VkDeviceSize scratch_buffer_size(const bottom_level_acceleration_structure::list& structures) const;
+                static VkDeviceSize get_scratch_stride(const bottom_level_acceleration_structure::list& structures);
+
+                // builds structures that weren't built yet and updates the others (see acceleration_structure::build)
+                // scratch_buffer must hold scratch_buffer_size() bytes for the same structures
+                // the secondary command buffers are reused, the previous submission must have finished
+                // insert a barrier after this before using the structures
+                // returns false if any build couldn't be recorded
+                bool record(VkCommandBuffer cmd_buf, const bottom_level_acceleration_structure::list& structures, VkDeviceAddress scratch_buffer);
+
+                uint32_t get_thread_count() const {
+                    return uint32_t(slices.size());
+                }
+
+            private:
+                device_p device = nullptr;
+
+                struct slice {
+                    VkCommandPool pool = VK_NULL_HANDLE;
+                    VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+                    bool result = true;
+                };
+
+                std::vector<slice> slices;
+                // preallocated for vkCmdExecuteCommands
+                std::vector<VkCommandBuffer> cmd_bufs;
+
+                // one per slice except the first, which the calling thread records
+                std::vector<std::thread> workers;
+
+                // the current record() call, workers pick up their slice when generation changes
+                std::mutex mutex;
+                std::condition_variable start;
+                std::condition_variable done;
+                uint64_t generation = 0;
+                size_t pending = 0;
+                bool stop = false;
+
+                const bottom_level_acceleration_structure::list* job_structures = nullptr;
+                VkDeviceAddress job_scratch_buffer = 0;
+                VkDeviceSize job_scratch_stride = 0;
+                size_t job_per_slice = 0;
+                size_t job_slice_count = 0;
+
+                void work(size_t i);
+                void record_range(size_t i);
+                bool record_slice(slice& slice, const bottom_level_acceleration_structure::ptr* structures, size_t count, VkDeviceAddress scratch_buffer);
+            };
+
+            inline build_recorder::ptr make_build_recorder() {
+                return std::make_shared<build_recorder>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,115 @@
+#include "liblava-extras/raytracing/build_size_cache.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            namespace {
+
+                template<typename T>
+                void append(string& key, const T& value) {
+                    key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+                }
+
+            } // namespace
+
+            void build_size_cache::make_key(VkAccelerationStructureTypeKHR type, const acceleration_structure& structure, VkBuildAccelerationStructureFlagsKHR flags) {
+                const std::pmr::vector<VkAccelerationStructureGeometryKHR>& geometries = structure.get_geometries();
+                const std::pmr::vector<VkAccelerationStructureBuildRangeInfoKHR>& ranges = structure.get_ranges();
+
+                key.clear();
+                append(key, type);
+                append(key, flags);
+                append(key, geometries.size());
+
+                // only the members that affect the sizes, addresses are ignored
+                for (size_t i = 0; i < geometries.size(); i++) {
+                    const VkAccelerationStructureGeometryKHR& geometry = geometries[i];
+                    append(key, geometry.geometryType);
+                    append(key, geometry.flags);
+                    append(key, ranges[i].primitiveCount);
+
+                    switch (geometry.geometryType) {
+                    case VK_GEOMETRY_TYPE_TRIANGLES_KHR: {
+                        const VkAccelerationStructureGeometryTrianglesDataKHR& triangles = geometry.geometry.triangles;
+                        append(key, triangles.vertexFormat);
+                        append(key, triangles.vertexStride);
+                        append(key, triangles.maxVertex);
+                        append(key, triangles.indexType);
+                        append(key, triangles.transformData.deviceAddress != 0);
+                        break;
+                    }
+                    case VK_GEOMETRY_TYPE_AABBS_KHR:
+                        append(key, geometry.geometry.aabbs.stride);
+                        break;
+                    case VK_GEOMETRY_TYPE_INSTANCES_KHR:
+                        append(key, geometry.geometry.instances.arrayOfPointers);
+                        break;
+                    default:
+                        break;
+                    }
+                }
+            }
+
+            VkAccelerationStructureBuildSizesInfoKHR build_size_cache::get(device_p device, VkAccelerationStructureTypeKHR type, const acceleration_structure& structure,
+                                                                           VkBuildAccelerationStructureFlagsKHR flags) {
+                make_key(type, structure, flags);
+
+                auto it = entries.find(key);
+                if (it != entries.end()) {
+                    hits++;
+                    return it->second;
+                }
+
+                const std::pmr::vector<VkAccelerationStructureGeometryKHR>& geometries = structure.get_geometries();
+                const std::pmr::vector<VkAccelerationStructureBuildRangeInfoKHR>& ranges = structure.get_ranges();
+
+                primitive_counts.resize(ranges.size());
+                for (size_t i = 0; i < ranges.size(); i++)
+                    primitive_counts[i] = ranges[i].primitiveCount;
+
+                const VkAccelerationStructureBuildGeometryInfoKHR build_info = { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+                                                                                 .type = type,
+                                                                                 .flags = flags,
+                                                                                 .geometryCount = uint32_t(geometries.size()),
+                                                                                 .pGeometries = geometries.data() };
+
+                VkAccelerationStructureBuildSizesInfoKHR sizes = {
+                    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR
+                };
+                device->call().vkGetAccelerationStructureBuildSizesKHR(device->get(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &build_info, primitive_counts.data(), &sizes);
+
+                entries.emplace(key, sizes);
+                return sizes;
+            }
+
+            build_size_cache::batch_sizes build_size_cache::prepare(device_p device, const bottom_level_acceleration_structure::list& structures,
+                                                                    VkBuildAccelerationStructureFlagsKHR flags) {
+                if (scratch_alignment == 0) {
+                    VkPhysicalDeviceAccelerationStructurePropertiesKHR properties = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR };
+                    VkPhysicalDeviceProperties2 properties2 = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+                                                                .pNext = &properties };
+                    vkGetPhysicalDeviceProperties2(device->get_vk_physical_device(), &properties2);
+                    scratch_alignment = std::max<VkDeviceSize>(properties.minAccelerationStructureScratchOffsetAlignment, 1);
+                }
+
+                // acceleration structures must be placed at offsets that are a multiple of 256
+                constexpr VkDeviceSize as_alignment = 256;
+
+                batch_sizes result;
+                for (const bottom_level_acceleration_structure::ptr& structure : structures) {
+                    const VkAccelerationStructureBuildSizesInfoKHR sizes = get(device, *structure, flags);
+                    structure->set_build_sizes(sizes);
+
+                    const VkDeviceSize scratch_size = std::max(sizes.buildScratchSize, sizes.updateScratchSize);
+                    result.acceleration_structure_size += align_up(sizes.accelerationStructureSize, as_alignment);
+                    result.max_scratch_size = std::max(result.max_scratch_size, scratch_size);
+                    result.total_scratch_size += align_up(scratch_size, scratch_alignment);
+                }
+
+                return result;
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
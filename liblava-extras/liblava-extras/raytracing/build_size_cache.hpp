@@ -0,0 +1,72 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+#include <unordered_map>
+
+// caches vkGetAccelerationStructureBuildSizesKHR results
+// sizes only depend on the layout of the geometries (type, formats, strides, counts) and the build flags, not on buffer contents or addresses,
+// so structures with the same topology share one query
+// prepare() sizes a whole batch upfront and hands the sizes to the structures, so their create() doesn't query again
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct build_size_cache {
+                using ptr = std::shared_ptr<build_size_cache>;
+
+                // memory needed for a batch of structures
+                struct batch_sizes {
+                    // sum of all structure sizes, each aligned to 256 bytes so they can be placed in one buffer
+                    VkDeviceSize acceleration_structure_size = 0;
+                    // largest scratch size, enough to build the structures one after the other
+                    VkDeviceSize max_scratch_size = 0;
+                    // sum of all scratch sizes, aligned to minAccelerationStructureScratchOffsetAlignment, enough to build all at once
+                    VkDeviceSize total_scratch_size = 0;
+                };
+
+                VkAccelerationStructureBuildSizesInfoKHR get(device_p device, VkAccelerationStructureTypeKHR type, const acceleration_structure& structure,
+                                                             VkBuildAccelerationStructureFlagsKHR flags);
+                VkAccelerationStructureBuildSizesInfoKHR get(device_p device, const bottom_level_acceleration_structure& blas,
+                                                             VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR) {
+                    return get(device, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, blas, flags);
+                }
+
+                // queries sizes for all structures and sets them with set_build_sizes()
+                // call before create() with the same flags
+                batch_sizes prepare(device_p device, const bottom_level_acceleration_structure::list& structures,
+                                    VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+
+                void clear() {
+                    entries.clear();
+                }
+
+                size_t size() const {
+                    return entries.size();
+                }
+
+                // number of driver queries saved
+                size_t get_hits() const {
+                    return hits;
+                }
+
+            private:
+                std::unordered_map<string, VkAccelerationStructureBuildSizesInfoKHR> entries;
+                size_t hits = 0;
+
+                VkDeviceSize scratch_alignment = 0;
+
+                // reused between queries
+                string key;
+                std::vector<uint32_t> primitive_counts;
+
+                void make_key(VkAccelerationStructureTypeKHR type, const acceleration_structure& structure, VkBuildAccelerationStructureFlagsKHR flags);
+            };
+
+            inline build_size_cache::ptr make_build_size_cache() {
+                return std::make_shared<build_size_cache>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
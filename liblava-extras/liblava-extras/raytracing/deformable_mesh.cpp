@@ -0,0 +1,78 @@
+#include "liblava-extras/raytracing/deformable_mesh.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool deformable_mesh::create(device_p device, uint32_t count, VkDeviceAddress index_data, uint32_t index_count, VkIndexType index_type,
+                                         VkGeometryFlagsKHR geometry_flags, VkBuildAccelerationStructureFlagsKHR flags) {
+                if (count == 0 || index_count < 3)
+                    return false;
+
+                vertex_count = count;
+
+                // device-local, only the GPU writes and reads it
+                position_buffer = buffer::make();
+                if (!position_buffer->create(device, nullptr, sizeof(glm::vec3) * vertex_count,
+                                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                             false, VMA_MEMORY_USAGE_GPU_ONLY))
+                    return false;
+
+                const VkAccelerationStructureGeometryTrianglesDataKHR triangles = { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                                                                                    .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+                                                                                    .vertexData = { position_buffer->get_address() },
+                                                                                    .vertexStride = sizeof(glm::vec3),
+                                                                                    .maxVertex = vertex_count - 1,
+                                                                                    .indexType = index_type,
+                                                                                    .indexData = { index_data } };
+                const VkAccelerationStructureBuildRangeInfoKHR range = { .primitiveCount = index_count / 3 };
+
+                blas = make_bottom_level_acceleration_structure();
+                blas->add_geometry(triangles, range, geometry_flags);
+                if (!blas->create(device, flags))
+                    return false;
+
+                return true;
+            }
+
+            void deformable_mesh::destroy() {
+                blas = nullptr;
+
+                if (position_buffer) {
+                    position_buffer->destroy();
+                    position_buffer = nullptr;
+                }
+
+                vertex_count = 0;
+            }
+
+            bool deformable_group::record(VkCommandBuffer cmd_buf, scratch_allocator& scratch) {
+                if (meshes.empty())
+                    return true;
+
+                device_p device = blas_list.front()->get_device();
+
+                // last frame's refit still reads the positions
+                insert_memory_barrier(device, cmd_buf, 0, 0, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+                if (on_skin)
+                    on_skin(cmd_buf, meshes);
+
+                // build inputs are read with VK_ACCESS_SHADER_READ_BIT in the build stage
+                insert_memory_barrier(device, cmd_buf, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR);
+
+                if (rebuild_interval > 0 && ++frames_since_rebuild >= rebuild_interval) {
+                    for (const bottom_level_acceleration_structure::ptr& blas : blas_list)
+                        blas->invalidate();
+                    frames_since_rebuild = 0;
+                }
+
+                // the first call builds, after that it's an update
+                return scratch.build(cmd_buf, blas_list);
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
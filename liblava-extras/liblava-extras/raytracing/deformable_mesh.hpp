@@ -0,0 +1,100 @@
+#pragma once
+
+#include "liblava-extras/raytracing/scratch_allocator.hpp"
+#include <functional>
+
+// BLAS for skinned or otherwise deforming meshes
+// a compute pass writes the posed positions into a device-local buffer, the BLAS is then refit from it in place
+// the index data is static and provided by the application
+// deformable_group refits all meshes sharing a pose together, without any host round-trips
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct deformable_mesh {
+                using ptr = std::shared_ptr<deformable_mesh>;
+                using list = std::vector<ptr>;
+
+                ~deformable_mesh() {
+                    destroy();
+                }
+
+                // positions are tightly packed vec3 (VK_FORMAT_R32G32B32_SFLOAT)
+                bool create(device_p device, uint32_t vertex_count, VkDeviceAddress index_data, uint32_t index_count, VkIndexType index_type = VK_INDEX_TYPE_UINT32,
+                            VkGeometryFlagsKHR geometry_flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+                            VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+                void destroy();
+
+                // written by the skinning pass, bind it as a storage buffer or use the address
+                buffer::ptr get_position_buffer() const {
+                    return position_buffer;
+                }
+
+                VkDeviceAddress get_position_address() const {
+                    return position_buffer ? position_buffer->get_address() : 0;
+                }
+
+                bottom_level_acceleration_structure::ptr get_blas() const {
+                    return blas;
+                }
+
+                uint32_t get_vertex_count() const {
+                    return vertex_count;
+                }
+
+            private:
+                buffer::ptr position_buffer;
+                bottom_level_acceleration_structure::ptr blas;
+                uint32_t vertex_count = 0;
+            };
+
+            inline deformable_mesh::ptr make_deformable_mesh() {
+                return std::make_shared<deformable_mesh>();
+            }
+
+            struct deformable_group {
+                using ptr = std::shared_ptr<deformable_group>;
+
+                // records the compute dispatches that write the posed positions of all meshes
+                using skinning_func = std::function<void(VkCommandBuffer cmd_buf, const deformable_mesh::list& meshes)>;
+                skinning_func on_skin;
+
+                void add(deformable_mesh::ptr mesh) {
+                    meshes.push_back(mesh);
+                    blas_list.push_back(mesh->get_blas());
+                }
+
+                void clear() {
+                    meshes.clear();
+                    blas_list.clear();
+                }
+
+                // refits degrade trace performance over time, rebuild all meshes every frames frames (0 never rebuilds)
+                void set_rebuild_interval(uint32_t frames) {
+                    rebuild_interval = frames;
+                }
+
+                // records skinning, the refit of all meshes and the barriers in between
+                // insert a barrier after this before tracing against the meshes
+                bool record(VkCommandBuffer cmd_buf, scratch_allocator& scratch);
+
+                deformable_mesh::list const& get_meshes() const {
+                    return meshes;
+                }
+
+            private:
+                deformable_mesh::list meshes;
+                bottom_level_acceleration_structure::list blas_list;
+
+                uint32_t rebuild_interval = 0;
+                uint32_t frames_since_rebuild = 0;
+            };
+
+            inline deformable_group::ptr make_deformable_group() {
+                return std::make_shared<deformable_group>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,44 @@
+#include "liblava-extras/raytracing/deletion_queue.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            void deletion_queue::retire(deleter&& func) {
+                std::lock_guard<std::mutex> lock(mutex);
+                entries.push_back({ .frame = frame, .func = std::move(func) });
+            }
+
+            void deletion_queue::next_frame() {
+                std::vector<entry> expired;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    frame++;
+
+                    // entries are in retire order, so the expired ones are at the front
+                    auto it = std::find_if(entries.begin(), entries.end(), [&](const entry& e) {
+                        return e.frame + frames_in_flight > frame;
+                    });
+                    expired.assign(std::make_move_iterator(entries.begin()), std::make_move_iterator(it));
+                    entries.erase(entries.begin(), it);
+                }
+
+                // run outside the lock, deleters may retire other objects
+                for (entry& e : expired)
+                    e.func();
+            }
+
+            void deletion_queue::flush() {
+                std::vector<entry> all;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    all.swap(entries);
+                }
+
+                for (entry& e : all)
+                    e.func();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// defers freeing GPU objects until the frames that might still use them have finished
+// objects retired while recording frame N are freed when frame N + frame_count starts,
+// lava waits for that frame slot's fence before recording it again
+// acceleration structures and shader binding tables with a queue set retire their handles on destroy() instead of freeing them,
+// anything else (e.g. a raytracing_pipeline) can be kept alive with retire(ptr)
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct deletion_queue {
+                using ptr = std::shared_ptr<deletion_queue>;
+                using deleter = std::function<void()>;
+
+                ~deletion_queue() {
+                    flush();
+                }
+
+                // frame_count is the number of frames in flight
+                void create(uint32_t frame_count) {
+                    frames_in_flight = std::max(frame_count, 1u);
+                }
+
+                void retire(deleter&& func);
+
+                // holds a reference until it's safe to free the object
+                template<typename T>
+                void retire(std::shared_ptr<T> object) {
+                    if (object)
+                        retire([object]() mutable { object.reset(); });
+                }
+
+                // call once per frame before recording, frees everything that's old enough
+                void next_frame();
+
+                // frees everything, only call this when the device is idle
+                void flush();
+
+                size_t size() const {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    return entries.size();
+                }
+
+            private:
+                struct entry {
+                    uint64_t frame;
+                    deleter func;
+                };
+
+                mutable std::mutex mutex;
+                std::vector<entry> entries;
+
+                uint64_t frame = 0;
+                uint32_t frames_in_flight = 1;
+            };
+
+            inline deletion_queue::ptr make_deletion_queue() {
+                return std::make_shared<deletion_queue>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,242 @@
+#include "liblava-extras/raytracing/denoiser.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            namespace {
+
+                // threads per workgroup in each dimension, matches denoise.comp
+                constexpr uint32_t group_size = 8;
+
+            } // namespace
+
+            bool denoiser::create(device_p dev, cdata const& shader_data) {
+                if (!shader_data.ptr) {
+                    log()->error("denoiser shader data, denoise.comp has to be compiled to SPIR-V");
+                    return false;
+                }
+
+                device = dev;
+
+                // binding order of denoise.comp: color, normal_depth, albedo, motion, previous_normal_depth, history, moments[2], filter[2]
+                constexpr uint32_t binding_count = 10;
+
+                descriptor_layout = descriptor::make();
+                for (uint32_t binding = 0; binding < binding_count; binding++)
+                    descriptor_layout->add_binding(binding, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+                if (!descriptor_layout->create(device))
+                    return false;
+
+                descriptor_pool = descriptor::pool::make();
+                const VkDescriptorPoolSizes sizes = {
+                    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, binding_count }
+                };
+                if (!descriptor_pool->create(device, sizes, 1, 0))
+                    return false;
+
+                // rewritten by resize()
+                descriptor_set = descriptor_layout->allocate(descriptor_pool->get());
+
+                layout = pipeline_layout::make();
+                layout->add(descriptor_layout);
+                layout->add({ .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT, .offset = 0, .size = sizeof(push_constants) });
+                if (!layout->create(device))
+                    return false;
+
+                pipeline = compute_pipeline::make(device);
+                if (!pipeline->set_shader_stage(shader_data, VK_SHADER_STAGE_COMPUTE_BIT))
+                    return false;
+                pipeline->set_layout(layout);
+                if (!pipeline->create())
+                    return false;
+
+                return true;
+            }
+
+            void denoiser::destroy() {
+                if (pipeline) {
+                    pipeline->destroy();
+                    pipeline = nullptr;
+                }
+
+                if (layout) {
+                    layout->destroy();
+                    layout = nullptr;
+                }
+
+                // destroying the pool frees the set
+                if (descriptor_pool) {
+                    descriptor_pool->destroy();
+                    descriptor_pool = nullptr;
+                    descriptor_set = VK_NULL_HANDLE;
+                }
+
+                if (descriptor_layout) {
+                    descriptor_layout->destroy();
+                    descriptor_layout = nullptr;
+                }
+
+                destroy_images();
+                device = nullptr;
+            }
+
+            bool denoiser::resize(image::ptr color) {
+                if (!color) {
+                    log()->error("denoiser without color image");
+                    return false;
+                }
+                if (!pipeline)
+                    return false;
+
+                destroy_images();
+
+                color_image = color;
+                size = color->get_size();
+
+                // RGBA16F is guaranteed to support storage, two-channel formats would need shaderStorageImageExtendedFormats
+                const VkFormat format = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+                normal_depth_image = create_image(format, VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+                albedo_image = create_image(VK_FORMAT_R8G8B8A8_UNORM, 0);
+                motion_image = create_image(format, 0);
+                previous_normal_depth_image = create_image(format, VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+                history_image = create_image(format, 0);
+                for (image::ptr& moments_image : moments_images)
+                    moments_image = create_image(format, 0);
+                for (image::ptr& filter_image : filter_images)
+                    filter_image = create_image(format, 0);
+
+                // binding order of denoise.comp
+                const std::array<image::ptr, 10> images = { color_image, normal_depth_image, albedo_image, motion_image, previous_normal_depth_image,
+                                                            history_image, moments_images[0], moments_images[1], filter_images[0], filter_images[1] };
+                for (const image::ptr& img : images) {
+                    if (!img)
+                        return false;
+                }
+
+                // the set isn't used by a frame in flight while resizing, so it can be updated in place
+                std::array<VkDescriptorImageInfo, images.size()> image_infos;
+                std::array<VkWriteDescriptorSet, images.size()> writes;
+                for (uint32_t binding = 0; binding < images.size(); binding++) {
+                    image_infos[binding] = { .sampler = VK_NULL_HANDLE,
+                                             .imageView = images[binding]->get_view(),
+                                             .imageLayout = VK_IMAGE_LAYOUT_GENERAL };
+                    writes[binding] = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                        .dstSet = descriptor_set,
+                                        .dstBinding = binding,
+                                        .descriptorCount = 1,
+                                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                        .pImageInfo = &image_infos[binding] };
+                }
+                device->vkUpdateDescriptorSets(uint32_t(writes.size()), writes.data());
+
+                images_initialized = false;
+                history_valid = false;
+                moments_index = 0;
+
+                return true;
+            }
+
+            void denoiser::destroy_images() {
+                for (image::ptr* img : { &normal_depth_image, &albedo_image, &motion_image, &previous_normal_depth_image, &history_image,
+                                         &moments_images[0], &moments_images[1], &filter_images[0], &filter_images[1] }) {
+                    if (*img) {
+                        (*img)->destroy();
+                        *img = nullptr;
+                    }
+                }
+
+                // owned by the caller
+                color_image = nullptr;
+
+                size = { 0, 0 };
+            }
+
+            void denoiser::record(VkCommandBuffer cmd_buf, const settings& config) {
+                if (!pipeline || !color_image)
+                    return;
+
+                const VkPipelineStageFlags compute = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                const VkAccessFlags shader_access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+                if (!images_initialized) {
+                    // the G-buffer is transitioned by the caller before it's written
+                    for (const image::ptr& img : { previous_normal_depth_image, history_image, moments_images[0], moments_images[1], filter_images[0], filter_images[1] }) {
+                        insert_image_memory_barrier(device, cmd_buf, img->get(), 0, shader_access, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, compute, img->get_subresource_range());
+                    }
+                    images_initialized = true;
+                    history_valid = false;
+                }
+
+                // color and G-buffer writes of the raygen shader or a compute pass
+                insert_memory_barrier(device, cmd_buf, VK_ACCESS_SHADER_WRITE_BIT, shader_access, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | compute, compute);
+
+                pipeline->bind(cmd_buf);
+                device->call().vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, layout->get(), 0, 1, &descriptor_set, 0, nullptr);
+
+                push_constants constants = { .size = size,
+                                             .stage = temporal,
+                                             .flags = history_valid ? 0u : flag_reset,
+                                             .step = 1,
+                                             .moments = moments_index,
+                                             .source = 0,
+                                             .color_alpha = config.color_alpha,
+                                             .moments_alpha = config.moments_alpha,
+                                             .phi_color = config.phi_color,
+                                             .phi_normal = config.phi_normal,
+                                             .phi_depth = config.phi_depth };
+
+                // writes filter image 0
+                dispatch(cmd_buf, constants);
+
+                const uint32_t iterations = std::max(config.iterations, 1u);
+                for (uint32_t i = 0; i < iterations; i++) {
+                    insert_memory_barrier(device, cmd_buf, shader_access, shader_access, compute, compute);
+
+                    constants.stage = filter;
+                    constants.step = 1u << i;
+                    constants.source = i % 2;
+                    constants.flags = (i == 0 ? flag_feedback : 0u) | (i == iterations - 1 ? flag_last : 0u);
+                    dispatch(cmd_buf, constants);
+                }
+
+                // keep this frame's normals and depth for the next reprojection test
+                insert_memory_barrier(device, cmd_buf, shader_access, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, compute, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+                const VkImageSubresourceLayers subresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1 };
+                const VkImageCopy region = { .srcSubresource = subresource,
+                                             .srcOffset = { 0, 0, 0 },
+                                             .dstSubresource = subresource,
+                                             .dstOffset = { 0, 0, 0 },
+                                             .extent = { size.x, size.y, 1 } };
+                device->call().vkCmdCopyImage(cmd_buf, normal_depth_image->get(), VK_IMAGE_LAYOUT_GENERAL, previous_normal_depth_image->get(), VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+
+                // the next frame overwrites the G-buffer
+                insert_memory_barrier(device, cmd_buf, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, shader_access,
+                                      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | compute);
+
+                moments_index = 1 - moments_index;
+                history_valid = true;
+            }
+
+            image::ptr denoiser::create_image(VkFormat format, VkImageUsageFlags usage) {
+                image::ptr img = image::make(format);
+                img->set_usage(VK_IMAGE_USAGE_STORAGE_BIT | usage);
+                img->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+                img->set_aspect_mask(format_aspect_mask(format));
+                if (!img->create(device, size))
+                    return nullptr;
+                return img;
+            }
+
+            void denoiser::dispatch(VkCommandBuffer cmd_buf, const push_constants& constants) {
+                device->call().vkCmdPushConstants(cmd_buf, layout->get(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+                device->call().vkCmdDispatch(cmd_buf, (size.x + group_size - 1) / group_size, (size.y + group_size - 1) / group_size, 1);
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
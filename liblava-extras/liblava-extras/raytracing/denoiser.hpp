@@ -0,0 +1,147 @@
+#pragma once
+
+#include "liblava/block/descriptor.hpp"
+#include "liblava/block/pipeline_layout.hpp"
+#include "liblava/block/pipeline.hpp"
+#include "liblava/resource/image.hpp"
+#include <array>
+
+// spatio-temporal denoiser for low sample counts (SVGF-style) in compute, between the raytracing output and its consumers
+// a temporal pass accumulates the demodulated color and its luminance moments along the motion vectors,
+// then a few à-trous wavelet iterations filter it guided by the G-buffer and the estimated variance
+// the first iteration's result becomes the next frame's history, the last one is remodulated with the albedo into the color image
+// raygen shaders write the G-buffer of the primary hit:
+// - normal and depth: world space normal in xyz, distance to the camera in w, 0 for the background
+// - albedo: surface color the lighting is divided by, 1 for the background
+// - motion: screen position in the last frame minus the current one in xy, in uv units
+// the shader is res/raytracing/denoise.comp
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct denoiser {
+                using ptr = std::shared_ptr<denoiser>;
+
+                struct settings {
+                    // à-trous iterations with step widths 1, 2, 4, ...
+                    uint32_t iterations = 5;
+                    // minimum weight of the current frame, lower is smoother but lags behind
+                    float color_alpha = 0.2f;
+                    float moments_alpha = 0.2f;
+                    // edge-stopping functions, higher values preserve more detail
+                    float phi_color = 4.0f;
+                    float phi_normal = 128.0f;
+                    float phi_depth = 1.0f;
+                };
+
+                ~denoiser() {
+                    destroy();
+                }
+
+                // shader_data is the SPIR-V of denoise.comp, creates the pipeline, call resize() before record()
+                bool create(device_p device, cdata const& shader_data);
+                bool create(device_p device, cdata const& shader_data, image::ptr color) {
+                    return create(device, shader_data) && resize(color);
+                }
+                void destroy();
+
+                // color is the noisy input and receives the result, it needs storage usage and general layout
+                // recreates the G-buffer and history images at the size of color, call it when color is recreated
+                // the previous images must no longer be in use, e.g. after vkDeviceWaitIdle
+                bool resize(image::ptr color);
+
+                // records the temporal pass and the filter iterations
+                // the G-buffer and color writes have to be done, the result is written by the compute stage
+                void record(VkCommandBuffer cmd_buf, const settings& config);
+                void record(VkCommandBuffer cmd_buf) {
+                    record(cmd_buf, settings());
+                }
+
+                // drops the history, e.g. after a camera cut
+                void reset() {
+                    history_valid = false;
+                }
+
+                // bind as storage images in the raygen shader, transition them to general layout after resize()
+                image::ptr get_normal_depth() const {
+                    return normal_depth_image;
+                }
+                image::ptr get_albedo() const {
+                    return albedo_image;
+                }
+                image::ptr get_motion() const {
+                    return motion_image;
+                }
+
+            private:
+                device_p device = nullptr;
+                glm::uvec2 size = { 0, 0 };
+
+                image::ptr color_image;
+
+                image::ptr normal_depth_image;
+                image::ptr albedo_image;
+                image::ptr motion_image;
+
+                // copy of the last frame's normal_depth_image for the reprojection test
+                image::ptr previous_normal_depth_image;
+                // first iteration output of the last frame
+                image::ptr history_image;
+                // luminance moments and history length, written and read alternately
+                std::array<image::ptr, 2> moments_images;
+                // color and variance, ping-pong between the iterations
+                std::array<image::ptr, 2> filter_images;
+
+                descriptor::pool::ptr descriptor_pool;
+                descriptor::ptr descriptor_layout;
+                VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+
+                pipeline_layout::ptr layout;
+                compute_pipeline::ptr pipeline;
+
+                bool images_initialized = false;
+                bool history_valid = false;
+                uint32_t moments_index = 0;
+
+                enum stage : uint32_t {
+                    temporal = 0,
+                    filter
+                };
+
+                enum flags : uint32_t {
+                    // ignore the history
+                    flag_reset = 1,
+                    // write the result to the history
+                    flag_feedback = 2,
+                    // remodulate and write the result to the color image
+                    flag_last = 4
+                };
+
+                // matches denoise.comp
+                struct push_constants {
+                    glm::uvec2 size;
+                    uint32_t stage;
+                    uint32_t flags;
+                    uint32_t step;
+                    uint32_t moments; // written this frame
+                    uint32_t source; // filter image read by this iteration
+                    float color_alpha;
+                    float moments_alpha;
+                    float phi_color;
+                    float phi_normal;
+                    float phi_depth;
+                };
+
+                image::ptr create_image(VkFormat format, VkImageUsageFlags usage);
+                void destroy_images();
+                void dispatch(VkCommandBuffer cmd_buf, const push_constants& constants);
+            };
+
+            inline denoiser::ptr make_denoiser() {
+                return std::make_shared<denoiser>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
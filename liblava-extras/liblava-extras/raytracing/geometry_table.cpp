@@ -0,0 +1,129 @@
+#include "liblava-extras/raytracing/geometry_table.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool geometry_table::create(device_p dev, uint32_t table_capacity) {
+                if (table_capacity == 0)
+                    return false;
+
+                device = dev;
+                capacity = table_capacity;
+                used = 0;
+
+                const std::vector<entry> entries(capacity);
+                table_buffer = buffer::make();
+                if (!table_buffer->create_mapped(device, entries.data(), sizeof(entry) * capacity,
+                                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT))
+                    return false;
+
+                free_ranges = { { .first = 0, .count = capacity } };
+
+                return true;
+            }
+
+            void geometry_table::destroy() {
+                if (table_buffer) {
+                    table_buffer->destroy();
+                    table_buffer = nullptr;
+                }
+
+                free_ranges.clear();
+                capacity = 0;
+                used = 0;
+                device = nullptr;
+            }
+
+            bool geometry_table::add(const entry* entries, uint32_t count, uint32_t& base) {
+                if (!table_buffer || count == 0)
+                    return false;
+
+                // first fit
+                auto it = std::find_if(free_ranges.begin(), free_ranges.end(), [&](const slot_range& range) {
+                    return range.count >= count;
+                });
+                if (it == free_ranges.end()) {
+                    log()->error("geometry table is full ({} of {} slots used, {} requested)", used, capacity, count);
+                    return false;
+                }
+
+                base = it->first;
+                it->first += count;
+                it->count -= count;
+                if (it->count == 0)
+                    free_ranges.erase(it);
+
+                memcpy(get_mapped_data() + base, entries, sizeof(entry) * count);
+                used += count;
+
+                return true;
+            }
+
+            bool geometry_table::add(const bottom_level_acceleration_structure& blas, uint32_t& base, const uint32_t* materials) {
+                const std::pmr::vector<VkAccelerationStructureGeometryKHR>& geometries = blas.get_geometries();
+                const std::pmr::vector<VkAccelerationStructureBuildRangeInfoKHR>& ranges = blas.get_ranges();
+
+                std::vector<entry> entries(geometries.size());
+                for (size_t i = 0; i < geometries.size(); i++)
+                    entries[i] = make_entry(geometries[i], ranges[i], materials ? materials[i] : 0);
+
+                return add(entries.data(), uint32_t(entries.size()), base);
+            }
+
+            void geometry_table::update(uint32_t slot, const entry& entry) {
+                if (!table_buffer || slot >= capacity)
+                    return;
+                get_mapped_data()[slot] = entry;
+            }
+
+            void geometry_table::remove(uint32_t base, uint32_t count) {
+                if (count == 0 || base >= capacity)
+                    return;
+                count = std::min(count, capacity - base);
+
+                auto it = std::lower_bound(free_ranges.begin(), free_ranges.end(), base, [](const slot_range& range, uint32_t slot) {
+                    return range.first < slot;
+                });
+                it = free_ranges.insert(it, { .first = base, .count = count });
+
+                // merge with the following and preceding range
+                auto next = std::next(it);
+                if (next != free_ranges.end() && it->first + it->count == next->first) {
+                    it->count += next->count;
+                    free_ranges.erase(next);
+                }
+                if (it != free_ranges.begin()) {
+                    auto prev = std::prev(it);
+                    if (prev->first + prev->count == it->first) {
+                        prev->count += it->count;
+                        free_ranges.erase(it);
+                    }
+                }
+
+                used -= std::min(used, count);
+            }
+
+            geometry_table::entry geometry_table::make_entry(const VkAccelerationStructureGeometryKHR& geometry, const VkAccelerationStructureBuildRangeInfoKHR& range, uint32_t material) {
+                entry result = { .material = material };
+
+                if (geometry.geometryType == VK_GEOMETRY_TYPE_TRIANGLES_KHR) {
+                    const VkAccelerationStructureGeometryTrianglesDataKHR& triangles = geometry.geometry.triangles;
+                    // primitiveOffset is in bytes, firstVertex is an index
+                    result.vertices = triangles.vertexData.deviceAddress + VkDeviceAddress(range.firstVertex) * triangles.vertexStride;
+                    if (triangles.indexType != VK_INDEX_TYPE_NONE_KHR) {
+                        result.indices = triangles.indexData.deviceAddress + range.primitiveOffset;
+                    } else {
+                        // non-indexed triangles take primitiveOffset from the vertex data
+                        result.vertices += range.primitiveOffset;
+                    }
+                } else if (geometry.geometryType == VK_GEOMETRY_TYPE_AABBS_KHR) {
+                    result.vertices = geometry.geometry.aabbs.data.deviceAddress + range.primitiveOffset;
+                }
+
+                return result;
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
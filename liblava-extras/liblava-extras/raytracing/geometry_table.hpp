@@ -0,0 +1,93 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+
+// scene-wide table of buffer device addresses for the vertex and index data of each BLAS geometry
+// hit shaders find their geometry at table[gl_InstanceCustomIndexEXT + gl_GeometryIndexEXT] with GL_EXT_buffer_reference,
+// so meshes can live in separate buffers and be added or removed without touching any descriptors
+// pass get_address() to the shaders, e.g. in a push constant
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct geometry_table {
+                using ptr = std::shared_ptr<geometry_table>;
+
+                // matches the scalar layout of the shader struct: two 64-bit references + uint, padded to 8 bytes
+                struct entry {
+                    VkDeviceAddress vertices = 0; // first vertex, firstVertex of the build range is already applied
+                    VkDeviceAddress indices = 0; // first index, primitiveOffset of the build range is already applied
+                    uint32_t material = 0; // free for the application, e.g. a material index
+                    uint32_t padding = 0;
+                };
+
+                static_assert(sizeof(entry) == 24);
+
+                ~geometry_table() {
+                    destroy();
+                }
+
+                bool create(device_p device, uint32_t capacity);
+                void destroy();
+
+                // reserves count consecutive slots and writes the entries, base is the first slot
+                // use base as instanceCustomIndex for all instances that should see these entries
+                bool add(const entry* entries, uint32_t count, uint32_t& base);
+
+                // one entry for each geometry in the BLAS, materials is either nullptr or has one value per geometry
+                // aabb geometries get the address of their first box in vertices and no indices
+                bool add(const bottom_level_acceleration_structure& blas, uint32_t& base, const uint32_t* materials = nullptr);
+
+                void update(uint32_t slot, const entry& entry);
+
+                // returns the slots to the free list
+                // shaders of frames still in flight might read them, only call this after they finished
+                void remove(uint32_t base, uint32_t count);
+
+                static entry make_entry(const VkAccelerationStructureGeometryKHR& geometry, const VkAccelerationStructureBuildRangeInfoKHR& range, uint32_t material = 0);
+
+                VkDeviceAddress get_address() const {
+                    return table_buffer ? table_buffer->get_address() : 0;
+                }
+
+                buffer::ptr get_buffer() const {
+                    return table_buffer;
+                }
+
+                uint32_t get_capacity() const {
+                    return capacity;
+                }
+
+                // number of slots in use
+                uint32_t get_count() const {
+                    return used;
+                }
+
+            private:
+                device_p device = nullptr;
+
+                buffer::ptr table_buffer;
+                uint32_t capacity = 0;
+                uint32_t used = 0;
+
+                struct slot_range {
+                    uint32_t first;
+                    uint32_t count;
+                };
+
+                // sorted by first slot, neighbours are merged on remove()
+                std::vector<slot_range> free_ranges;
+
+                entry* get_mapped_data() {
+                    return static_cast<entry*>(table_buffer->get_mapped_data());
+                }
+            };
+
+            inline geometry_table::ptr make_geometry_table() {
+                return std::make_shared<geometry_table>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,736 @@
+#include "liblava-extras/raytracing/gltf_loader.hpp"
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            namespace {
+
+                constexpr uint32_t glb_magic = 0x46546C67; // "glTF"
+                constexpr uint32_t glb_json_chunk = 0x4E4F534A; // "JSON"
+                constexpr uint32_t glb_binary_chunk = 0x004E4942; // "BIN\0"
+
+                // vertices per chunk, 192 MB of vertex data keeps the buffers well below maxMemoryAllocationSize
+                constexpr VkDeviceSize chunk_vertex_count = 4 * 1024 * 1024;
+
+                enum component_type : uint32_t {
+                    type_byte = 5120,
+                    type_unsigned_byte = 5121,
+                    type_short = 5122,
+                    type_unsigned_short = 5123,
+                    type_unsigned_int = 5125,
+                    type_float = 5126
+                };
+
+                uint32_t component_size(uint32_t type) {
+                    switch (type) {
+                    case type_byte:
+                    case type_unsigned_byte:
+                        return 1;
+                    case type_short:
+                    case type_unsigned_short:
+                        return 2;
+                    case type_unsigned_int:
+                    case type_float:
+                        return 4;
+                    default:
+                        return 0;
+                    }
+                }
+
+                uint32_t component_count(const std::string& type) {
+                    if (type == "SCALAR")
+                        return 1;
+                    if (type == "VEC2")
+                        return 2;
+                    if (type == "VEC3")
+                        return 3;
+                    if (type == "VEC4" || type == "MAT2")
+                        return 4;
+                    if (type == "MAT3")
+                        return 9;
+                    if (type == "MAT4")
+                        return 16;
+                    return 0;
+                }
+
+                // missing members read as empty, the document isn't modified
+                const json& member(const json& object, const char* key) {
+                    static const json empty;
+                    const auto it = object.find(key);
+                    return it != object.end() ? *it : empty;
+                }
+
+                std::vector<char> read_file(const std::filesystem::path& path) {
+                    std::ifstream file(path, std::ios::binary | std::ios::ate);
+                    if (!file)
+                        return {};
+
+                    const std::streamsize size = file.tellg();
+                    if (size <= 0)
+                        return {};
+
+                    std::vector<char> result(size_t(size), 0);
+                    file.seekg(0);
+                    if (!file.read(result.data(), size))
+                        return {};
+                    return result;
+                }
+
+                // payload of a data: URI, only base64 is valid for buffers
+                std::vector<char> decode_data_uri(const std::string& uri) {
+                    const size_t comma = uri.find(',');
+                    if (comma == std::string::npos || uri.rfind(";base64", comma) == std::string::npos)
+                        return {};
+
+                    std::vector<char> result;
+                    result.reserve((uri.size() - comma) / 4 * 3);
+
+                    uint32_t bits = 0;
+                    int bit_count = 0;
+                    for (size_t i = comma + 1; i < uri.size(); i++) {
+                        const char c = uri[i];
+                        int value;
+                        if (c >= 'A' && c <= 'Z')
+                            value = c - 'A';
+                        else if (c >= 'a' && c <= 'z')
+                            value = c - 'a' + 26;
+                        else if (c >= '0' && c <= '9')
+                            value = c - '0' + 52;
+                        else if (c == '+' || c == '-')
+                            value = 62;
+                        else if (c == '/' || c == '_')
+                            value = 63;
+                        else
+                            break;
+
+                        bits = (bits << 6) | uint32_t(value);
+                        bit_count += 6;
+                        if (bit_count >= 8) {
+                            bit_count -= 8;
+                            result.push_back(char((bits >> bit_count) & 0xff));
+                        }
+                    }
+                    return result;
+                }
+
+                // relative URIs are percent-encoded
+                std::string decode_uri(const std::string& uri) {
+                    std::string result;
+                    result.reserve(uri.size());
+                    for (size_t i = 0; i < uri.size(); i++) {
+                        if (uri[i] == '%' && i + 2 < uri.size() && std::isxdigit(uri[i + 1]) && std::isxdigit(uri[i + 2])) {
+                            result.push_back(char(std::stoi(uri.substr(i + 1, 2), nullptr, 16)));
+                            i += 2;
+                        } else {
+                            result.push_back(uri[i]);
+                        }
+                    }
+                    return result;
+                }
+
+                template<typename T>
+                float to_float(T value, bool normalized) {
+                    if constexpr (std::is_same_v<T, float>)
+                        return value;
+                    if (!normalized)
+                        return float(value);
+                    if constexpr (std::is_signed_v<T>)
+                        return std::max(float(value) / float(std::numeric_limits<T>::max()), -1.0f);
+                    return float(value) / float(std::numeric_limits<T>::max());
+                }
+
+                template<typename T>
+                void convert(const char* source, size_t source_stride, uint32_t count, uint32_t components, bool normalized, char* target, size_t target_stride) {
+                    for (uint32_t i = 0; i < count; i++) {
+                        float* out = reinterpret_cast<float*>(target + i * target_stride);
+                        for (uint32_t c = 0; c < components; c++) {
+                            T value;
+                            memcpy(&value, source + i * source_stride + c * sizeof(T), sizeof(T));
+                            out[c] = to_float(value, normalized);
+                        }
+                    }
+                }
+
+                template<typename T>
+                bool convert_indices(const char* source, size_t source_stride, uint32_t count, uint32_t vertex_count, uint32_t* target) {
+                    for (uint32_t i = 0; i < count; i++) {
+                        T value;
+                        memcpy(&value, source + i * source_stride, sizeof(T));
+                        if (value >= vertex_count)
+                            return false;
+                        target[i] = uint32_t(value);
+                    }
+                    return true;
+                }
+
+                glm::mat4 node_transform(const json& node) {
+                    glm::mat4 result(1.0f);
+
+                    const std::vector<float> matrix = node.value("matrix", std::vector<float>());
+                    if (matrix.size() == 16) {
+                        // column-major like glm
+                        for (int c = 0; c < 4; c++)
+                            for (int r = 0; r < 4; r++)
+                                result[c][r] = matrix[c * 4 + r];
+                        return result;
+                    }
+
+                    const std::vector<float> t = node.value("translation", std::vector<float>{ 0.0f, 0.0f, 0.0f });
+                    const std::vector<float> q = node.value("rotation", std::vector<float>{ 0.0f, 0.0f, 0.0f, 1.0f });
+                    const std::vector<float> s = node.value("scale", std::vector<float>{ 1.0f, 1.0f, 1.0f });
+                    if (t.size() != 3 || q.size() != 4 || s.size() != 3)
+                        return result;
+
+                    // T * R * S, the rotation is a unit quaternion (x, y, z, w)
+                    const float x = q[0], y = q[1], z = q[2], w = q[3];
+                    const float rotation[3][3] = { { 1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y) },
+                                                   { 2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x) },
+                                                   { 2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y) } };
+                    for (int c = 0; c < 3; c++) {
+                        for (int r = 0; r < 3; r++)
+                            result[c][r] = rotation[c][r] * s[c];
+                        result[3][c] = t[c];
+                    }
+                    return result;
+                }
+
+            } // namespace
+
+            bool gltf_loader::load(device_p dev, string_ref path, uint32_t thread_count, VkBuildAccelerationStructureFlagsKHR flags) {
+                device = dev;
+                build_flags = flags;
+
+                std::vector<char> file = read_file(path);
+                if (file.empty()) {
+                    log()->error("gltf_loader failed to read {}", path);
+                    return false;
+                }
+
+                // .glb is a header followed by the JSON chunk and an optional binary chunk
+                std::string_view text(file.data(), file.size());
+                std::vector<char> binary_chunk;
+                uint32_t magic = 0;
+                if (file.size() >= 12)
+                    memcpy(&magic, file.data(), sizeof(magic));
+                if (magic == glb_magic) {
+                    text = {};
+                    size_t offset = 12;
+                    while (offset + 8 <= file.size()) {
+                        uint32_t chunk_header[2];
+                        memcpy(chunk_header, file.data() + offset, sizeof(chunk_header));
+                        offset += sizeof(chunk_header);
+
+                        const size_t length = chunk_header[0];
+                        if (length > file.size() - offset)
+                            break;
+
+                        if (chunk_header[1] == glb_json_chunk && text.empty())
+                            text = std::string_view(file.data() + offset, length);
+                        else if (chunk_header[1] == glb_binary_chunk && binary_chunk.empty())
+                            binary_chunk.assign(file.data() + offset, file.data() + offset + length);
+
+                        offset += align_up<size_t>(length, 4);
+                    }
+                }
+
+                const json document = json::parse(text.begin(), text.end(), nullptr, false);
+                if (document.is_discarded() || !document.is_object()) {
+                    log()->error("gltf_loader failed to parse {}", path);
+                    return false;
+                }
+
+                // the reading threads start during parse(), everything after it overlaps with them
+                try {
+                    const std::string version = member(document, "asset").value("version", std::string());
+                    if (!version.starts_with("2.")) {
+                        log()->error("gltf_loader doesn't support glTF version {} of {}", version, path);
+                        return false;
+                    }
+
+                    if (!parse(document, std::filesystem::path(path).parent_path().string(), std::move(binary_chunk))) {
+                        destroy();
+                        return false;
+                    }
+                } catch (const json::exception& e) {
+                    log()->error("gltf_loader failed to parse {}: {}", path, e.what());
+                    destroy();
+                    return false;
+                }
+
+                if (!create_chunks()) {
+                    destroy();
+                    return false;
+                }
+
+                if (thread_count == 0)
+                    thread_count = std::max(1u, std::thread::hardware_concurrency());
+                thread_count = std::min(thread_count, uint32_t(meshes.size()));
+
+                workers.reserve(thread_count);
+                for (uint32_t i = 0; i < thread_count; i++)
+                    workers.emplace_back(&gltf_loader::decode_meshes, this);
+
+                return true;
+            }
+
+            void gltf_loader::destroy() {
+                cancel = true;
+                for (std::thread& worker : workers)
+                    worker.join();
+                workers.clear();
+
+                // waits for the reading threads
+                buffers.clear();
+                views.clear();
+                accessors.clear();
+
+                meshes.clear();
+                for (chunk& c : chunks) {
+                    if (c.vertices)
+                        c.vertices->destroy();
+                    if (c.indices)
+                        c.indices->destroy();
+                }
+                chunks.clear();
+                instances.clear();
+
+                decoded.clear();
+                ready.clear();
+                batch.clear();
+                recorded_count = 0;
+
+                next_mesh = 0;
+                failed_count = 0;
+                cancel = false;
+
+                device = nullptr;
+            }
+
+            uint32_t gltf_loader::process(VkCommandBuffer cmd_buf, scratch_allocator& scratch) {
+                ready.clear();
+                batch.clear();
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    VkDeviceSize available = scratch.available();
+                    size_t taken = 0;
+                    for (; taken < decoded.size(); taken++) {
+                        const index m = decoded[taken];
+                        const bottom_level_acceleration_structure::ptr& blas = meshes[m].result.blas;
+                        if (!blas)
+                            continue;
+
+                        const VkDeviceSize size = blas->scratch_buffer_size();
+                        if (size > scratch.get_region_size()) {
+                            log()->error("gltf_loader mesh {} needs {} bytes of scratch memory, more than the region size {}", m, size, scratch.get_region_size());
+                            failed_count.fetch_add(1, std::memory_order_relaxed);
+                            continue;
+                        }
+                        if (!batch.empty() && size > available)
+                            break;
+
+                        available -= std::min(available, size);
+                        batch.push_back(blas);
+                        ready.push_back(m);
+                    }
+
+                    recorded_count += uint32_t(taken);
+                    decoded.erase(decoded.begin(), decoded.begin() + taken);
+                }
+
+                if (!batch.empty() && !scratch.build(cmd_buf, batch))
+                    log()->error("gltf_loader failed to record the builds of {} meshes", batch.size());
+
+                return uint32_t(ready.size());
+            }
+
+            bool gltf_loader::is_finished() const {
+                std::lock_guard<std::mutex> lock(mutex);
+                return recorded_count == meshes.size();
+            }
+
+            VkAccelerationStructureInstanceKHR gltf_loader::make_instance(index i, uint32_t custom_index) const {
+                const instance& node = instances[i];
+                const bottom_level_acceleration_structure::ptr& blas = meshes[node.mesh].result.blas;
+
+                VkAccelerationStructureInstanceKHR result = { .instanceCustomIndex = custom_index,
+                                                              .mask = 0xff,
+                                                              .accelerationStructureReference = blas ? blas->get_address() : 0 };
+
+                // VkTransformMatrixKHR is row-major
+                const glm::mat3x4 transposed = glm::transpose(node.transform);
+                memcpy(&result.transform, glm::value_ptr(transposed), sizeof(VkTransformMatrixKHR));
+
+                return result;
+            }
+
+            bool gltf_loader::parse(const json& document, const std::string& directory, std::vector<char>&& binary_chunk) {
+                // start reading right away, the rest of the parsing and the chunk allocations overlap with it
+                for (const json& b : member(document, "buffers")) {
+                    const auto uri = b.find("uri");
+                    if (uri == b.end()) {
+                        // only the first buffer can refer to the GLB binary chunk
+                        std::promise<std::vector<char>> binary;
+                        binary.set_value(buffers.empty() ? std::move(binary_chunk) : std::vector<char>());
+                        buffers.push_back(binary.get_future().share());
+                        continue;
+                    }
+
+                    const std::string reference = uri->get<std::string>();
+                    if (reference.starts_with("data:")) {
+                        buffers.push_back(std::async(std::launch::async, [reference] {
+                                              return decode_data_uri(reference);
+                                          }).share());
+                    } else {
+                        const std::filesystem::path file = std::filesystem::path(directory) / decode_uri(reference);
+                        buffers.push_back(std::async(std::launch::async, [file] {
+                                              return read_file(file);
+                                          }).share());
+                    }
+                }
+
+                for (const json& v : member(document, "bufferViews")) {
+                    views.push_back({ .buffer = v.value("buffer", no_view),
+                                      .offset = v.value("byteOffset", size_t(0)),
+                                      .size = v.value("byteLength", size_t(0)),
+                                      .stride = v.value("byteStride", size_t(0)) });
+                }
+
+                for (const json& a : member(document, "accessors")) {
+                    accessor& result = accessors.emplace_back();
+                    result.view = a.value("bufferView", no_view);
+                    result.offset = a.value("byteOffset", size_t(0));
+                    result.component_type = a.value("componentType", 0u);
+                    result.normalized = a.value("normalized", false);
+                    result.count = a.value("count", 0u);
+
+                    // sparse accessors aren't supported, they fail to decode
+                    if (!a.contains("sparse"))
+                        result.component_count = component_count(a.value("type", std::string()));
+                }
+
+                if (!parse_meshes(document))
+                    return false;
+                parse_nodes(document);
+
+                return true;
+            }
+
+            bool gltf_loader::parse_meshes(const json& document) {
+                const json& materials = member(document, "materials");
+
+                auto attribute = [this](const json& attributes, const char* semantic) {
+                    const index a = member(attributes, semantic).is_number_unsigned() ? member(attributes, semantic).get<index>() : no_accessor;
+                    return a < accessors.size() ? a : no_accessor;
+                };
+
+                for (const json& m : member(document, "meshes")) {
+                    mesh_data& data = meshes.emplace_back();
+
+                    for (const json& p : member(m, "primitives")) {
+                        // points and lines can't be traced, strips and fans aren't supported
+                        if (p.value("mode", 4) != 4)
+                            continue;
+
+                        const json& attributes = member(p, "attributes");
+                        primitive result = { .position = attribute(attributes, "POSITION"),
+                                             .normal = attribute(attributes, "NORMAL"),
+                                             .uv = attribute(attributes, "TEXCOORD_0"),
+                                             .color = attribute(attributes, "COLOR_0"),
+                                             .indices = attribute(p, "indices"),
+                                             .material = p.value("material", ~0u) };
+                        if (result.position == no_accessor)
+                            continue;
+
+                        result.vertex_count = accessors[result.position].count;
+                        result.index_count = result.indices != no_accessor ? accessors[result.indices].count : result.vertex_count;
+                        result.index_count -= result.index_count % 3;
+                        if (result.vertex_count == 0 || result.index_count == 0)
+                            continue;
+
+                        // blended and masked materials need the any-hit shader
+                        if (result.material < materials.size())
+                            result.opaque = materials[result.material].value("alphaMode", std::string("OPAQUE")) == "OPAQUE";
+
+                        data.primitives.push_back(result);
+                    }
+                }
+
+                if (meshes.size() >= no_accessor) {
+                    log()->error("gltf_loader doesn't support {} meshes", meshes.size());
+                    return false;
+                }
+
+                return true;
+            }
+
+            void gltf_loader::parse_nodes(const json& document) {
+                const json& nodes = member(document, "nodes");
+                if (nodes.empty())
+                    return;
+
+                // nodes of the default scene, without scenes every node that isn't a child is a root
+                std::vector<index> roots;
+                const json& scenes = member(document, "scenes");
+                const index scene = document.value("scene", 0u);
+                if (scene < scenes.size()) {
+                    roots = scenes[scene].value("nodes", std::vector<index>());
+                } else {
+                    std::vector<bool> child(nodes.size(), false);
+                    for (const json& node : nodes) {
+                        for (const json& c : member(node, "children")) {
+                            if (c.get<index>() < child.size())
+                                child[c.get<index>()] = true;
+                        }
+                    }
+                    for (index i = 0; i < child.size(); i++) {
+                        if (!child[i])
+                            roots.push_back(i);
+                    }
+                }
+
+                struct pending {
+                    index node;
+                    glm::mat4 parent;
+                };
+
+                std::vector<pending> stack;
+                for (auto root = roots.rbegin(); root != roots.rend(); ++root)
+                    stack.push_back({ *root, glm::mat4(1.0f) });
+
+                // the hierarchy has to be a tree, visited guards against broken files
+                std::vector<bool> visited(nodes.size(), false);
+                while (!stack.empty()) {
+                    const pending current = stack.back();
+                    stack.pop_back();
+
+                    if (current.node >= nodes.size() || visited[current.node])
+                        continue;
+                    visited[current.node] = true;
+
+                    const json& node = nodes[current.node];
+                    const glm::mat4 world = current.parent * node_transform(node);
+
+                    const index m = node.value("mesh", no_accessor);
+                    if (m < meshes.size()) {
+                        meshes[m].result.instances.push_back(index(instances.size()));
+                        instances.push_back({ .mesh = m, .transform = glm::mat4x3(world) });
+                    }
+
+                    const std::vector<index> children = node.value("children", std::vector<index>());
+                    for (auto c = children.rbegin(); c != children.rend(); ++c)
+                        stack.push_back({ *c, world });
+                }
+            }
+
+            bool gltf_loader::create_chunks() {
+                for (mesh_data& data : meshes) {
+                    VkDeviceSize vertex_count = 0;
+                    for (const primitive& p : data.primitives)
+                        vertex_count += p.vertex_count;
+
+                    if (chunks.empty() || (chunks.back().vertex_count > 0 && chunks.back().vertex_count + vertex_count > chunk_vertex_count))
+                        chunks.emplace_back();
+
+                    chunk& c = chunks.back();
+                    data.chunk = index(chunks.size() - 1);
+                    for (primitive& p : data.primitives) {
+                        p.first_vertex = c.vertex_count;
+                        p.first_index = c.index_count;
+                        c.vertex_count += p.vertex_count;
+                        c.index_count += p.index_count;
+                    }
+                }
+
+                // decoding writes straight into the build input, on devices with resizable BAR this is device local memory
+                const VkBufferUsageFlags usage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+                                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+                for (chunk& c : chunks) {
+                    if (c.vertex_count == 0)
+                        continue;
+
+                    c.vertices = buffer::make();
+                    c.indices = buffer::make();
+                    if (!c.vertices->create_mapped(device, nullptr, sizeof(vertex) * c.vertex_count, usage, VMA_MEMORY_USAGE_CPU_TO_GPU) ||
+                        !c.indices->create_mapped(device, nullptr, sizeof(uint32_t) * c.index_count, usage, VMA_MEMORY_USAGE_CPU_TO_GPU)) {
+                        log()->error("gltf_loader failed to allocate {} vertices and {} indices", c.vertex_count, c.index_count);
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            void gltf_loader::decode_meshes() {
+                // reused for all meshes of this thread
+                std::vector<vertex> vertices;
+                std::vector<uint32_t> indices;
+
+                while (!cancel.load(std::memory_order_relaxed)) {
+                    const index m = next_mesh.fetch_add(1, std::memory_order_relaxed);
+                    if (m >= meshes.size())
+                        return;
+
+                    if (!decode_mesh(meshes[m], vertices, indices)) {
+                        log()->error("gltf_loader failed to decode mesh {}", m);
+                        meshes[m].result.blas = nullptr;
+                        failed_count.fetch_add(1, std::memory_order_relaxed);
+                    }
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    decoded.push_back(m);
+                }
+            }
+
+            bool gltf_loader::decode_mesh(mesh_data& data, std::vector<vertex>& vertices, std::vector<uint32_t>& indices) {
+                if (data.primitives.empty())
+                    return true;
+
+                const chunk& c = chunks[data.chunk];
+                vertex* vertex_data = static_cast<vertex*>(c.vertices->get_mapped_data());
+                uint32_t* index_data = static_cast<uint32_t*>(c.indices->get_mapped_data());
+
+                bottom_level_acceleration_structure::ptr blas = make_bottom_level_acceleration_structure();
+                blas->reserve_geometries(data.primitives.size());
+
+                for (const primitive& p : data.primitives) {
+                    if (!decode_primitive(p, vertices, indices))
+                        return false;
+
+                    // the mapped memory might be write-combined, it's only written in one sequential copy
+                    memcpy(vertex_data + p.first_vertex, vertices.data(), sizeof(vertex) * p.vertex_count);
+                    memcpy(index_data + p.first_index, indices.data(), sizeof(uint32_t) * p.index_count);
+
+                    const VkAccelerationStructureGeometryTrianglesDataKHR triangles = { .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                                                                                        .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+                                                                                        .vertexData = { c.vertices->get_address() + sizeof(vertex) * p.first_vertex },
+                                                                                        .vertexStride = sizeof(vertex),
+                                                                                        .maxVertex = p.vertex_count - 1,
+                                                                                        .indexType = VK_INDEX_TYPE_UINT32,
+                                                                                        .indexData = { c.indices->get_address() + sizeof(uint32_t) * p.first_index } };
+                    blas->add_geometry(triangles, { .primitiveCount = p.index_count / 3 }, p.opaque ? VK_GEOMETRY_OPAQUE_BIT_KHR : 0);
+
+                    data.result.materials.push_back(p.material);
+                }
+
+                // primitives of a mesh are consecutive in the chunk
+                const primitive& first = data.primitives.front();
+                const primitive& last = data.primitives.back();
+                c.vertices->flush(sizeof(vertex) * first.first_vertex, sizeof(vertex) * (last.first_vertex + last.vertex_count - first.first_vertex));
+                c.indices->flush(sizeof(uint32_t) * first.first_index, sizeof(uint32_t) * (last.first_index + last.index_count - first.first_index));
+
+                // size queries and allocations are thread-safe, only the builds are left for process()
+                if (!blas->create(device, build_flags))
+                    return false;
+
+                data.result.blas = blas;
+                return true;
+            }
+
+            bool gltf_loader::decode_primitive(const primitive& p, std::vector<vertex>& vertices, std::vector<uint32_t>& indices) const {
+                vertices.assign(p.vertex_count, vertex{ .position = glm::vec3(0.0f), .color = glm::vec4(1.0f), .uv = glm::vec2(0.0f), .normal = glm::vec3(0.0f) });
+
+                char* target = reinterpret_cast<char*>(vertices.data());
+                if (!read_floats(accessors[p.position], p.vertex_count, 3, target + offsetof(vertex, position)))
+                    return false;
+                if (p.normal != no_accessor && !read_floats(accessors[p.normal], p.vertex_count, 3, target + offsetof(vertex, normal)))
+                    return false;
+                if (p.uv != no_accessor && !read_floats(accessors[p.uv], p.vertex_count, 2, target + offsetof(vertex, uv)))
+                    return false;
+                // RGB colors keep an alpha of 1
+                if (p.color != no_accessor && !read_floats(accessors[p.color], p.vertex_count, 4, target + offsetof(vertex, color)))
+                    return false;
+
+                indices.resize(p.index_count);
+                if (p.indices == no_accessor) {
+                    std::iota(indices.begin(), indices.end(), 0u);
+                    return true;
+                }
+
+                const accessor& a = accessors[p.indices];
+                size_t stride = 0;
+                const char* source = get_data(a, stride);
+                if (!source || a.component_count != 1)
+                    return false;
+
+                switch (a.component_type) {
+                case type_unsigned_byte:
+                    return convert_indices<uint8_t>(source, stride, p.index_count, p.vertex_count, indices.data());
+                case type_unsigned_short:
+                    return convert_indices<uint16_t>(source, stride, p.index_count, p.vertex_count, indices.data());
+                case type_unsigned_int:
+                    return convert_indices<uint32_t>(source, stride, p.index_count, p.vertex_count, indices.data());
+                default:
+                    return false;
+                }
+            }
+
+            const char* gltf_loader::get_data(const accessor& a, size_t& stride) const {
+                if (a.view >= views.size() || a.count == 0)
+                    return nullptr;
+
+                const buffer_view& view = views[a.view];
+                if (view.buffer >= buffers.size())
+                    return nullptr;
+
+                // blocks until the buffer was read
+                const std::vector<char>& data = buffers[view.buffer].get();
+
+                const size_t element_size = size_t(component_size(a.component_type)) * a.component_count;
+                stride = view.stride > 0 ? view.stride : element_size;
+                if (element_size == 0 || view.offset > data.size() || view.size > data.size() - view.offset ||
+                    a.offset + stride * (a.count - 1) + element_size > view.size)
+                    return nullptr;
+
+                return data.data() + view.offset + a.offset;
+            }
+
+            bool gltf_loader::read_floats(const accessor& a, uint32_t count, uint32_t components, char* target) const {
+                if (a.count < count || a.component_count == 0)
+                    return false;
+
+                components = std::min(components, a.component_count);
+
+                // accessors without buffer view are zero
+                if (a.view == no_view) {
+                    for (uint32_t i = 0; i < count; i++)
+                        memset(target + i * sizeof(vertex), 0, sizeof(float) * components);
+                    return true;
+                }
+
+                size_t stride = 0;
+                const char* source = get_data(a, stride);
+                if (!source)
+                    return false;
+
+                switch (a.component_type) {
+                case type_float:
+                    convert<float>(source, stride, count, components, a.normalized, target, sizeof(vertex));
+                    return true;
+                case type_byte:
+                    convert<int8_t>(source, stride, count, components, a.normalized, target, sizeof(vertex));
+                    return true;
+                case type_unsigned_byte:
+                    convert<uint8_t>(source, stride, count, components, a.normalized, target, sizeof(vertex));
+                    return true;
+                case type_short:
+                    convert<int16_t>(source, stride, count, components, a.normalized, target, sizeof(vertex));
+                    return true;
+                case type_unsigned_short:
+                    convert<uint16_t>(source, stride, count, components, a.normalized, target, sizeof(vertex));
+                    return true;
+                default:
+                    return false;
+                }
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
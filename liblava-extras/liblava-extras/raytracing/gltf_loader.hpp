@@ -0,0 +1,179 @@
+#pragma once
+
+#include "liblava-extras/raytracing/scratch_allocator.hpp"
+#include "liblava/file/json_file.hpp"
+#include "liblava/resource/mesh.hpp"
+#include <future>
+#include <mutex>
+
+// loads glTF 2.0 scenes (.gltf with external or embedded buffers, .glb) into acceleration structures without blocking the first frame
+// load() only parses the JSON, the buffers are read on one thread each and the meshes are decoded on a pool of workers
+// that write vertices and indices straight into mapped build input buffers and create the BLAS
+// process() records the builds of the meshes decoded so far, so reading, decoding and building overlap
+// and the scene fills in over the first frames instead of loading everything up front
+// every glTF mesh becomes one BLAS with one geometry per triangle primitive, every node referencing it one instance
+// vertices use the lava::vertex layout, hit shaders can read them through geometry_table::add(*mesh.blas, ...)
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct gltf_loader {
+                using ptr = std::shared_ptr<gltf_loader>;
+
+                struct mesh {
+                    // nullptr if the mesh has no triangles or couldn't be decoded
+                    bottom_level_acceleration_structure::ptr blas;
+                    // glTF material of each geometry, ~0u for the default material
+                    std::vector<uint32_t> materials;
+                    // instances referencing this mesh
+                    std::vector<index> instances;
+                };
+
+                struct instance {
+                    index mesh = 0;
+                    // world transform of the node
+                    glm::mat4x3 transform = glm::mat4x3(1.0f);
+                };
+
+                ~gltf_loader() {
+                    destroy();
+                }
+
+                // parses the file and the node hierarchy, then starts reading and decoding in the background
+                // thread_count 0 uses one decoding thread per hardware thread
+                bool load(device_p device, string_ref path, uint32_t thread_count = 0,
+                          VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+                // waits for the threads, only call this when the device is idle
+                void destroy();
+
+                // records the builds of decoded meshes, as many as fit into the scratch memory left in the current region (at least one)
+                // call once per frame after scratch_allocator::begin_frame(), returns the number of meshes whose builds were recorded
+                // insert a barrier after this before building a TLAS with their instances
+                uint32_t process(VkCommandBuffer cmd_buf, scratch_allocator& scratch);
+
+                // meshes recorded by the last process(), add the instances of these to the TLAS
+                const std::vector<index>& get_ready() const {
+                    return ready;
+                }
+
+                // all meshes were decoded and their builds recorded
+                bool is_finished() const;
+
+                // meshes that failed to decode, the rest of the scene is still loaded
+                uint32_t get_failed_count() const {
+                    return failed_count.load(std::memory_order_relaxed);
+                }
+
+                const mesh& get_mesh(index i) const {
+                    return meshes[i].result;
+                }
+                size_t get_mesh_count() const {
+                    return meshes.size();
+                }
+
+                const std::vector<instance>& get_instances() const {
+                    return instances;
+                }
+
+                // the instance referencing its mesh's BLAS, which has to be built
+                VkAccelerationStructureInstanceKHR make_instance(index i, uint32_t custom_index = 0) const;
+
+            private:
+                struct buffer_view {
+                    index buffer = 0;
+                    size_t offset = 0;
+                    size_t size = 0;
+                    size_t stride = 0;
+                };
+
+                struct accessor {
+                    // no_view reads zeros
+                    index view = no_view;
+                    size_t offset = 0;
+                    uint32_t component_type = 0;
+                    uint32_t component_count = 0;
+                    bool normalized = false;
+                    uint32_t count = 0;
+                };
+
+                struct primitive {
+                    index position = no_accessor;
+                    index normal = no_accessor;
+                    index uv = no_accessor;
+                    index color = no_accessor;
+                    index indices = no_accessor;
+                    uint32_t material = ~0u;
+                    bool opaque = true;
+
+                    uint32_t vertex_count = 0;
+                    uint32_t index_count = 0;
+                    // in vertices and indices from the start of the mesh's chunk
+                    VkDeviceSize first_vertex = 0;
+                    VkDeviceSize first_index = 0;
+                };
+
+                struct mesh_data {
+                    std::vector<primitive> primitives;
+                    index chunk = 0;
+                    mesh result;
+                };
+
+                // build input memory, meshes don't span chunks
+                struct chunk {
+                    buffer::ptr vertices;
+                    buffer::ptr indices;
+                    VkDeviceSize vertex_count = 0;
+                    VkDeviceSize index_count = 0;
+                };
+
+                static constexpr index no_view = ~0u;
+                static constexpr index no_accessor = ~0u;
+
+                device_p device = nullptr;
+                VkBuildAccelerationStructureFlagsKHR build_flags = 0;
+
+                // filled by the reading threads, decoding waits for the buffers it needs
+                std::vector<std::shared_future<std::vector<char>>> buffers;
+                std::vector<buffer_view> views;
+                std::vector<accessor> accessors;
+
+                std::vector<mesh_data> meshes;
+                std::vector<chunk> chunks;
+                std::vector<instance> instances;
+
+                std::vector<std::thread> workers;
+                std::atomic<index> next_mesh = 0;
+                std::atomic<bool> cancel = false;
+                std::atomic<uint32_t> failed_count = 0;
+
+                // decoded meshes waiting for process()
+                mutable std::mutex mutex;
+                std::vector<index> decoded;
+                uint32_t recorded_count = 0;
+
+                std::vector<index> ready;
+                bottom_level_acceleration_structure::list batch;
+
+                bool parse(const json& document, const std::string& directory, std::vector<char>&& binary_chunk);
+                bool parse_meshes(const json& document);
+                void parse_nodes(const json& document);
+                bool create_chunks();
+
+                void decode_meshes();
+                bool decode_mesh(mesh_data& data, std::vector<vertex>& vertices, std::vector<uint32_t>& indices);
+                bool decode_primitive(const primitive& p, std::vector<vertex>& vertices, std::vector<uint32_t>& indices) const;
+                // first element of the accessor and the distance between elements, waits for the buffer
+                // nullptr if the accessor doesn't fit into its buffer view or the buffer couldn't be read
+                const char* get_data(const accessor& a, size_t& stride) const;
+                // converts to float components of count vertices, target is the attribute in the first vertex
+                bool read_floats(const accessor& a, uint32_t count, uint32_t components, char* target) const;
+            };
+
+            inline gltf_loader::ptr make_gltf_loader() {
+                return std::make_shared<gltf_loader>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,176 @@
+#include "liblava-extras/raytracing/host_memory.hpp"
+#include <cstring>
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            void allocation_counters::allocated(size_t size) {
+                allocations++;
+                const size_t current = bytes += size;
+                size_t peak = peak_bytes.load();
+                while (current > peak && !peak_bytes.compare_exchange_weak(peak, current))
+                    ;
+            }
+
+            void allocation_counters::deallocated(size_t size) {
+                deallocations++;
+                bytes -= size;
+            }
+
+            allocation_stats allocation_counters::get() const {
+                return { .allocations = allocations.load(),
+                         .deallocations = deallocations.load(),
+                         .bytes = bytes.load(),
+                         .peak_bytes = peak_bytes.load() };
+            }
+
+            void allocation_counters::reset() {
+                // keep the current size, it's freed later and would underflow otherwise
+                allocations = 0;
+                deallocations = 0;
+                peak_bytes = bytes.load();
+            }
+
+            void* counting_resource::do_allocate(size_t bytes, size_t alignment) {
+                void* p = upstream->allocate(bytes, alignment);
+                counters.allocated(bytes);
+                return p;
+            }
+
+            void counting_resource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+                upstream->deallocate(p, bytes, alignment);
+                counters.deallocated(bytes);
+            }
+
+            namespace {
+
+                // memory resources need size and alignment for deallocation, Vulkan only passes the pointer
+                // the header sits right before the returned pointer, the allocation starts offset bytes before that
+                struct allocation_header {
+                    size_t size;
+                    size_t alignment;
+                    size_t offset;
+                    VkSystemAllocationScope scope;
+                };
+
+                allocation_header* get_header(void* memory) {
+                    return static_cast<allocation_header*>(memory) - 1;
+                }
+
+            } // namespace
+
+            vulkan_allocation_callbacks::vulkan_allocation_callbacks(std::pmr::memory_resource* resource)
+            : resource(resource),
+              callbacks({ .pUserData = this,
+                          .pfnAllocation = allocation_function,
+                          .pfnReallocation = reallocation_function,
+                          .pfnFree = free_function,
+                          .pfnInternalAllocation = internal_allocation_notification,
+                          .pfnInternalFree = internal_free_notification }) {
+            }
+
+            allocation_stats vulkan_allocation_callbacks::get_stats() const {
+                allocation_stats total;
+                for (const allocation_counters& counters : scopes) {
+                    const allocation_stats stats = counters.get();
+                    total.allocations += stats.allocations;
+                    total.deallocations += stats.deallocations;
+                    total.bytes += stats.bytes;
+                    // sum of the peaks, the scopes don't peak at the same time
+                    total.peak_bytes += stats.peak_bytes;
+                }
+                return total;
+            }
+
+            allocation_stats vulkan_allocation_callbacks::get_stats(VkSystemAllocationScope scope) const {
+                return size_t(scope) < scope_count ? scopes[scope].get() : allocation_stats{};
+            }
+
+            void vulkan_allocation_callbacks::reset_stats() {
+                for (allocation_counters& counters : scopes)
+                    counters.reset();
+                internal.reset();
+            }
+
+            void* vulkan_allocation_callbacks::allocate(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+                if (size == 0)
+                    return nullptr;
+
+                alignment = std::max(alignment, alignof(allocation_header));
+                const size_t offset = align_up(sizeof(allocation_header), alignment);
+
+                void* block = nullptr;
+                {
+                    std::lock_guard<std::mutex> lock(resource_mutex);
+                    try {
+                        block = resource->allocate(offset + size, alignment);
+                    } catch (const std::bad_alloc&) {
+                        // Vulkan expects nullptr and turns it into VK_ERROR_OUT_OF_HOST_MEMORY
+                        return nullptr;
+                    }
+                }
+
+                void* memory = static_cast<char*>(block) + offset;
+                *get_header(memory) = { .size = size, .alignment = alignment, .offset = offset, .scope = scope };
+
+                if (size_t(scope) < scope_count)
+                    scopes[scope].allocated(size);
+
+                return memory;
+            }
+
+            void* vulkan_allocation_callbacks::reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+                if (!original)
+                    return allocate(size, alignment, scope);
+                if (size == 0) {
+                    free(original);
+                    return nullptr;
+                }
+
+                // the spec requires the same alignment as the original allocation
+                void* memory = allocate(size, alignment, scope);
+                if (!memory)
+                    return nullptr; // original stays valid
+
+                memcpy(memory, original, std::min(size, get_header(original)->size));
+                free(original);
+
+                return memory;
+            }
+
+            void vulkan_allocation_callbacks::free(void* memory) {
+                if (!memory)
+                    return;
+
+                const allocation_header header = *get_header(memory);
+                if (size_t(header.scope) < scope_count)
+                    scopes[header.scope].deallocated(header.size);
+
+                std::lock_guard<std::mutex> lock(resource_mutex);
+                resource->deallocate(static_cast<char*>(memory) - header.offset, header.offset + header.size, header.alignment);
+            }
+
+            void* vulkan_allocation_callbacks::allocation_function(void* user_data, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+                return static_cast<vulkan_allocation_callbacks*>(user_data)->allocate(size, alignment, scope);
+            }
+
+            void* vulkan_allocation_callbacks::reallocation_function(void* user_data, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+                return static_cast<vulkan_allocation_callbacks*>(user_data)->reallocate(original, size, alignment, scope);
+            }
+
+            void vulkan_allocation_callbacks::free_function(void* user_data, void* memory) {
+                static_cast<vulkan_allocation_callbacks*>(user_data)->free(memory);
+            }
+
+            void vulkan_allocation_callbacks::internal_allocation_notification(void* user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope) {
+                static_cast<vulkan_allocation_callbacks*>(user_data)->internal.allocated(size);
+            }
+
+            void vulkan_allocation_callbacks::internal_free_notification(void* user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope) {
+                static_cast<vulkan_allocation_callbacks*>(user_data)->internal.deallocated(size);
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "liblava/base/memory.hpp"
+#include <array>
+#include <atomic>
+#include <memory_resource>
+#include <mutex>
+
+// host allocation layer for scene build time, on top of std::pmr
+// counting_resource counts what goes through it, host_arena and host_pool allocate their blocks from one
+// host_arena is a bump allocator for objects that live until the scene is unloaded, release() frees everything at once
+// host_pool hands out blocks from per-size pools, e.g. for BLAS objects, their control blocks and geometry arrays
+// vulkan_allocation_callbacks adapts a memory resource to VkAllocationCallbacks with counters per allocation scope
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct allocation_stats {
+                size_t allocations = 0;
+                size_t deallocations = 0;
+                // currently allocated
+                size_t bytes = 0;
+                size_t peak_bytes = 0;
+            };
+
+            // thread-safe counters behind allocation_stats
+            struct allocation_counters {
+                void allocated(size_t size);
+                void deallocated(size_t size);
+
+                allocation_stats get() const;
+                void reset();
+
+            private:
+                std::atomic<size_t> allocations = 0;
+                std::atomic<size_t> deallocations = 0;
+                std::atomic<size_t> bytes = 0;
+                std::atomic<size_t> peak_bytes = 0;
+            };
+
+            struct counting_resource : std::pmr::memory_resource {
+                explicit counting_resource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+                : upstream(upstream) {}
+
+                allocation_stats get_stats() const {
+                    return counters.get();
+                }
+                void reset_stats() {
+                    counters.reset();
+                }
+
+            private:
+                std::pmr::memory_resource* upstream;
+                allocation_counters counters;
+
+                void* do_allocate(size_t bytes, size_t alignment) override;
+                void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+                bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+                    return this == &other;
+                }
+            };
+
+            // not thread-safe
+            // objects created with make() aren't destroyed by release(), destroy them first unless they're trivially destructible
+            struct host_arena {
+                using ptr = std::shared_ptr<host_arena>;
+
+                explicit host_arena(size_t initial_size = 64 * 1024, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+                : counter(upstream), arena(initial_size, &counter) {}
+
+                std::pmr::memory_resource* get_resource() {
+                    return &arena;
+                }
+
+                template<typename T, typename... Args>
+                std::shared_ptr<T> make(Args&&... args) {
+                    return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(&arena), std::forward<Args>(args)...);
+                }
+
+                void release() {
+                    arena.release();
+                }
+
+                // blocks the arena requested from upstream
+                allocation_stats get_stats() const {
+                    return counter.get_stats();
+                }
+
+            private:
+                counting_resource counter;
+                std::pmr::monotonic_buffer_resource arena;
+            };
+
+            // thread-safe, freed blocks go back to their pool and are reused by the next allocation of the same size
+            struct host_pool {
+                using ptr = std::shared_ptr<host_pool>;
+
+                // allocations larger than largest_block go straight to upstream
+                explicit host_pool(size_t largest_block = 4096, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+                : counter(upstream), pool({ .max_blocks_per_chunk = 0, .largest_required_pool_block = largest_block }, &counter) {}
+
+                std::pmr::memory_resource* get_resource() {
+                    return &pool;
+                }
+
+                template<typename T, typename... Args>
+                std::shared_ptr<T> make(Args&&... args) {
+                    return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(&pool), std::forward<Args>(args)...);
+                }
+
+                void release() {
+                    pool.release();
+                }
+
+                // chunks the pools requested from upstream
+                allocation_stats get_stats() const {
+                    return counter.get_stats();
+                }
+
+            private:
+                counting_resource counter;
+                std::pmr::synchronized_pool_resource pool;
+            };
+
+            inline host_arena::ptr make_host_arena(size_t initial_size = 64 * 1024) {
+                return std::make_shared<host_arena>(initial_size);
+            }
+
+            inline host_pool::ptr make_host_pool(size_t largest_block = 4096) {
+                return std::make_shared<host_pool>(largest_block);
+            }
+
+            // pass get() to vkCreate*/vkDestroy* or install it as lava's memory callbacks
+            // the resource is locked for every call, drivers can allocate from any thread
+            struct vulkan_allocation_callbacks {
+                explicit vulkan_allocation_callbacks(std::pmr::memory_resource* resource = std::pmr::new_delete_resource());
+
+                const VkAllocationCallbacks* get() const {
+                    return &callbacks;
+                }
+
+                // all scopes combined
+                allocation_stats get_stats() const;
+                allocation_stats get_stats(VkSystemAllocationScope scope) const;
+                // allocations the driver made on its own and reported through the notification callbacks
+                allocation_stats get_internal_stats() const {
+                    return internal.get();
+                }
+
+                void reset_stats();
+
+            private:
+                static constexpr size_t scope_count = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+                std::pmr::memory_resource* resource;
+                std::mutex resource_mutex;
+
+                VkAllocationCallbacks callbacks;
+                std::array<allocation_counters, scope_count> scopes;
+                allocation_counters internal;
+
+                void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+                void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+                void free(void* memory);
+
+                static VKAPI_ATTR void* VKAPI_CALL allocation_function(void* user_data, size_t size, size_t alignment, VkSystemAllocationScope scope);
+                static VKAPI_ATTR void* VKAPI_CALL reallocation_function(void* user_data, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+                static VKAPI_ATTR void VKAPI_CALL free_function(void* user_data, void* memory);
+                static VKAPI_ATTR void VKAPI_CALL internal_allocation_notification(void* user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+                static VKAPI_ATTR void VKAPI_CALL internal_free_notification(void* user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+            };
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,150 @@
+#include "liblava-extras/raytracing/instance_generator.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool instance_generator::create(device_p dev, cdata const& shader_data, uint32_t instance_capacity, uint32_t frame_count, bool indirect,
+                                            VkBuildAccelerationStructureFlagsKHR flags) {
+                if (instance_capacity == 0 || frame_count == 0)
+                    return false;
+
+                device = dev;
+                capacity = instance_capacity;
+                object_count = 0;
+
+                objects.assign(capacity, {});
+                version = 0;
+                region_versions.assign(frame_count, version);
+
+                indirect_build = false;
+                if (indirect) {
+                    VkPhysicalDeviceAccelerationStructureFeaturesKHR features = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
+                    VkPhysicalDeviceFeatures2 features2 = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                                                            .pNext = &features };
+                    vkGetPhysicalDeviceFeatures2(device->get_vk_physical_device(), &features2);
+                    indirect_build = features.accelerationStructureIndirectBuild;
+                    if (!indirect_build)
+                        log()->info("indirect acceleration structure builds not supported, culled instances are masked out");
+                }
+
+                object_buffer = buffer::make();
+                if (!object_buffer->create_mapped(device, nullptr, sizeof(object) * capacity * frame_count, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT))
+                    return false;
+
+                instance_buffer = buffer::make();
+                if (!instance_buffer->create(device, nullptr, sizeof(VkAccelerationStructureInstanceKHR) * capacity,
+                                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                             false, VMA_MEMORY_USAGE_GPU_ONLY))
+                    return false;
+
+                // transfer dst to reset the count before each pass
+                const VkAccelerationStructureBuildRangeInfoKHR range = {};
+                range_buffer = buffer::make();
+                if (!range_buffer->create(device, &range, sizeof(range),
+                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                          false, VMA_MEMORY_USAGE_CPU_TO_GPU))
+                    return false;
+
+                layout = pipeline_layout::make();
+                layout->add({ .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT, .offset = 0, .size = sizeof(push_constant_data) });
+                if (!layout->create(device))
+                    return false;
+
+                pipeline = compute_pipeline::make(device);
+                if (!pipeline->set_shader_stage(shader_data, VK_SHADER_STAGE_COMPUTE_BIT))
+                    return false;
+                pipeline->set_layout(layout);
+                if (!pipeline->create())
+                    return false;
+
+                tlas = make_top_level_acceleration_structure();
+                if (!tlas->create(device, instance_buffer->get_address(), capacity, flags))
+                    return false;
+
+                return true;
+            }
+
+            void instance_generator::destroy() {
+                tlas = nullptr;
+
+                if (pipeline) {
+                    pipeline->destroy();
+                    pipeline = nullptr;
+                }
+
+                if (layout) {
+                    layout->destroy();
+                    layout = nullptr;
+                }
+
+                for (buffer::ptr* buf : { &object_buffer, &instance_buffer, &range_buffer }) {
+                    if (*buf) {
+                        (*buf)->destroy();
+                        *buf = nullptr;
+                    }
+                }
+
+                objects.clear();
+                region_versions.clear();
+
+                capacity = 0;
+                object_count = 0;
+                device = nullptr;
+            }
+
+            void instance_generator::generate(VkCommandBuffer cmd_buf, const glm::vec3& camera, float distance_scale, index frame) {
+                // lava waited for the fence of the frame, so its region is free
+                const index region = frame % region_versions.size();
+                const VkDeviceSize region_offset = sizeof(object) * capacity * region;
+                if (region_versions[region] != version && object_count > 0) {
+                    memcpy(static_cast<char*>(object_buffer->get_mapped_data()) + region_offset, objects.data(), sizeof(object) * object_count);
+                    object_buffer->flush(region_offset, sizeof(object) * object_count);
+                }
+                region_versions[region] = version;
+
+                // last frame's build still reads the instances and the range
+                insert_memory_barrier(device, cmd_buf, 0, 0, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+                if (indirect_build) {
+                    device->call().vkCmdFillBuffer(cmd_buf, range_buffer->get(), 0, sizeof(uint32_t), 0);
+
+                    insert_memory_barrier(device, cmd_buf, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                                          VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+                }
+
+                // without indirect builds, all slots are built, so every slot must hold a valid instance
+                const uint32_t slot_count = indirect_build ? object_count : capacity;
+                const push_constant_data push_constants = { .objects = object_buffer->get_address() + region_offset,
+                                                            .instances = instance_buffer->get_address(),
+                                                            .range = range_buffer->get_address(),
+                                                            .object_count = object_count,
+                                                            .distance_scale = distance_scale,
+                                                            .camera = camera,
+                                                            .compact = indirect_build ? 1u : 0u,
+                                                            .slot_count = slot_count };
+
+                pipeline->bind(cmd_buf);
+                device->call().vkCmdPushConstants(cmd_buf, layout->get(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+                device->call().vkCmdDispatch(cmd_buf, (slot_count + 63) / 64, 1, 1);
+
+                // instances are read with VK_ACCESS_SHADER_READ_BIT in the build stage, the indirect range as an indirect command
+                insert_memory_barrier(device, cmd_buf, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR);
+            }
+
+            bool instance_generator::build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer) {
+                if (!tlas)
+                    return false;
+
+                if (indirect_build)
+                    return tlas->build_indirect(cmd_buf, scratch_buffer, range_buffer->get_address());
+
+                // the instance count never changes, so this can be an update if the TLAS allows it
+                return tlas->build(cmd_buf, scratch_buffer) || tlas->rebuild(cmd_buf, scratch_buffer);
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+#include "liblava/block/pipeline_layout.hpp"
+#include "liblava/block/pipeline.hpp"
+
+// generates the TLAS instance buffer on the GPU from a compact array of objects
+// a compute pass culls objects by distance to the camera and writes VkAccelerationStructureInstanceKHR for the rest,
+// so the CPU only touches objects when they change instead of writing every instance each frame
+// with the accelerationStructureIndirectBuild feature, culled objects are left out and the TLAS is built with the live count,
+// otherwise every object keeps its slot and culled ones get mask 0
+// objects are written to a host copy, generate() copies them to the region of the frame in flight when they changed
+// the shader is in liblava-extras/res/raytracing/instance_generator.comp
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct instance_generator {
+                using ptr = std::shared_ptr<instance_generator>;
+
+                // matches the shader struct (scalar layout)
+                struct object {
+                    glm::mat4x3 transform = glm::mat4x3(1.0f);
+                    VkDeviceAddress blas = 0;
+                    uint32_t custom_index = 0;
+                    uint32_t sbt_offset = 0;
+                    uint32_t mask = 0xff;
+                    VkGeometryInstanceFlagsKHR flags = 0;
+                    // culled when farther away from the camera, scaled by distance_scale in generate()
+                    // 0 is never culled
+                    float cull_distance = 0.0f;
+                    float padding = 0.0f;
+                };
+
+                static_assert(sizeof(object) == 80);
+
+                ~instance_generator() {
+                    destroy();
+                }
+
+                // shader_data is the SPIR-V of instance_generator.comp, frame_count the number of frames in flight
+                // indirect is only used if the device supports accelerationStructureIndirectBuild, enable the feature when creating the device
+                bool create(device_p device, cdata const& shader_data, uint32_t capacity, uint32_t frame_count = 1, bool indirect = true,
+                            VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR);
+                void destroy();
+
+                // host copy, call mark_dirty() after changing objects, set_object_count() marks them as well
+                // frames in flight keep reading their own copy, so this never waits for the GPU
+                object* get_objects() {
+                    return objects.data();
+                }
+                void mark_dirty() {
+                    version++;
+                }
+                void set_object_count(uint32_t count) {
+                    object_count = std::min(count, capacity);
+                    mark_dirty();
+                }
+                uint32_t get_object_count() const {
+                    return object_count;
+                }
+
+                // records the compute pass that writes the instances, frame is the index being recorded
+                // its object region is rewritten if the objects changed since it was last used
+                void generate(VkCommandBuffer cmd_buf, const glm::vec3& camera, float distance_scale = 1.0f, index frame = 0);
+
+                // records the TLAS build from the generated instances, call after generate()
+                // insert a barrier after this before tracing
+                bool build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer);
+
+                top_level_acceleration_structure::ptr get_tlas() const {
+                    return tlas;
+                }
+
+                bool is_indirect() const {
+                    return indirect_build;
+                }
+
+            private:
+                device_p device = nullptr;
+
+                uint32_t capacity = 0;
+                uint32_t object_count = 0;
+                bool indirect_build = false;
+
+                std::vector<object> objects;
+                uint64_t version = 0;
+                // version of the objects in each region, one region per frame in flight
+                std::vector<uint64_t> region_versions;
+
+                buffer::ptr object_buffer;
+                buffer::ptr instance_buffer;
+                // VkAccelerationStructureBuildRangeInfoKHR for the indirect build
+                buffer::ptr range_buffer;
+
+                pipeline_layout::ptr layout;
+                compute_pipeline::ptr pipeline;
+
+                top_level_acceleration_structure::ptr tlas;
+
+                struct push_constant_data {
+                    VkDeviceAddress objects;
+                    VkDeviceAddress instances;
+                    VkDeviceAddress range;
+                    uint32_t object_count;
+                    float distance_scale;
+                    glm::vec3 camera;
+                    uint32_t compact;
+                    uint32_t slot_count;
+                };
+            };
+
+            inline instance_generator::ptr make_instance_generator() {
+                return std::make_shared<instance_generator>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
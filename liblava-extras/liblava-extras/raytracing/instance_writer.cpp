@@ -0,0 +1,178 @@
+#include "liblava-extras/raytracing/instance_writer.hpp"
+#include <bit>
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool instance_writer::create(device_p dev, uint32_t instance_capacity, uint32_t frame_count) {
+                if (instance_capacity == 0 || frame_count == 0)
+                    return false;
+
+                device = dev;
+                capacity = instance_capacity;
+                word_count = (capacity + 63) / 64;
+
+                const VkDeviceSize size = sizeof(VkAccelerationStructureInstanceKHR) * capacity;
+                const VkBufferUsageFlags usage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+
+                // the handles read back references and the copies read dirty slots, so writes go to host-cached memory
+                write_buffer = buffer::make();
+                if (!write_buffer->create_mapped(device, nullptr, size, usage, VMA_MEMORY_USAGE_GPU_TO_CPU))
+                    return false;
+                write_data = static_cast<VkAccelerationStructureInstanceKHR*>(write_buffer->get_mapped_data());
+                // unused slots are inactive
+                memset(write_data, 0, size);
+
+                if (frame_count == 1) {
+                    frame_buffers = { write_buffer };
+                } else {
+                    frame_buffers.resize(frame_count);
+                    for (buffer::ptr& frame_buffer : frame_buffers) {
+                        frame_buffer = buffer::make();
+                        if (!frame_buffer->create_mapped(device, write_data, size, usage, VMA_MEMORY_USAGE_CPU_TO_GPU))
+                            return false;
+                    }
+                }
+
+                dirty = std::make_unique<std::atomic<uint64_t>[]>(word_count);
+                pending.assign(frame_count, std::vector<uint64_t>(word_count, 0));
+
+                next_free = std::make_unique<std::atomic<uint32_t>[]>(capacity);
+                free_head = no_slot;
+                high_water = 0;
+
+                activity = false;
+                rebuild_needed = true;
+                submitted_count = 0;
+
+                return true;
+            }
+
+            void instance_writer::destroy() {
+                for (buffer::ptr& frame_buffer : frame_buffers) {
+                    if (frame_buffer != write_buffer)
+                        frame_buffer->destroy();
+                }
+                frame_buffers.clear();
+
+                if (write_buffer) {
+                    write_buffer->destroy();
+                    write_buffer = nullptr;
+                }
+                write_data = nullptr;
+
+                dirty = nullptr;
+                pending.clear();
+                next_free = nullptr;
+
+                capacity = 0;
+                word_count = 0;
+                device = nullptr;
+            }
+
+            instance_writer::slot instance_writer::allocate(const VkAccelerationStructureInstanceKHR& instance) {
+                slot s = no_slot;
+
+                // pop a released slot
+                uint64_t head = free_head.load(std::memory_order_acquire);
+                while (slot(head) != no_slot) {
+                    const uint64_t new_head = (((head >> 32) + 1) << 32) | next_free[slot(head)].load(std::memory_order_relaxed);
+                    if (free_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire)) {
+                        s = slot(head);
+                        break;
+                    }
+                }
+
+                // or take a fresh one
+                if (s == no_slot) {
+                    uint32_t fresh = high_water.load(std::memory_order_relaxed);
+                    while (fresh < capacity && !high_water.compare_exchange_weak(fresh, fresh + 1, std::memory_order_relaxed))
+                        ;
+                    if (fresh >= capacity)
+                        return no_slot;
+                    s = fresh;
+                }
+
+                write_data[s] = instance;
+                if (instance.accelerationStructureReference != 0)
+                    activity.store(true, std::memory_order_relaxed);
+                mark_dirty(s);
+                return s;
+            }
+
+            void instance_writer::release(slot s) {
+                if (s >= capacity)
+                    return;
+
+                if (write_data[s].accelerationStructureReference != 0)
+                    activity.store(true, std::memory_order_relaxed);
+                write_data[s] = {};
+                mark_dirty(s);
+
+                uint64_t head = free_head.load(std::memory_order_relaxed);
+                uint64_t new_head;
+                do {
+                    next_free[s].store(slot(head), std::memory_order_relaxed);
+                    new_head = (head & 0xffffffff00000000ull) | s;
+                } while (!free_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+            }
+
+            VkDeviceAddress instance_writer::submit(index frame) {
+                if (!write_buffer)
+                    return 0;
+
+                const size_t frame_index = frame % frame_buffers.size();
+                std::vector<uint64_t>& frame_pending = pending[frame_index];
+
+                // every frame buffer misses what was written since, only this one is refreshed now
+                for (uint32_t w = 0; w < word_count; w++) {
+                    const uint64_t bits = dirty[w].exchange(0, std::memory_order_acquire);
+                    if (bits) {
+                        for (std::vector<uint64_t>& frame_bits : pending)
+                            frame_bits[w] |= bits;
+                    }
+                }
+
+                rebuild_needed = activity.exchange(false, std::memory_order_relaxed);
+
+                // with one frame the builds read the write buffer directly, there's nothing to copy
+                if (frame_buffers.size() == 1) {
+                    submitted_count = 0;
+                    for (uint64_t& bits : frame_pending) {
+                        submitted_count += uint32_t(std::popcount(bits));
+                        bits = 0;
+                    }
+                    write_buffer->flush();
+                    return write_buffer->get_address();
+                }
+
+                VkAccelerationStructureInstanceKHR* frame_data = static_cast<VkAccelerationStructureInstanceKHR*>(frame_buffers[frame_index]->get_mapped_data());
+
+                submitted_count = 0;
+                for (uint32_t w = 0; w < word_count; w++) {
+                    uint64_t bits = frame_pending[w];
+                    frame_pending[w] = 0;
+                    while (bits) {
+                        const slot s = w * 64 + uint32_t(std::countr_zero(bits));
+                        frame_data[s] = write_data[s];
+                        bits &= bits - 1;
+                        submitted_count++;
+                    }
+                }
+
+                if (submitted_count > 0)
+                    frame_buffers[frame_index]->flush();
+
+                return frame_buffers[frame_index]->get_address();
+            }
+
+            VkDeviceAddress instance_writer::get_instance_data(index frame) const {
+                if (frame_buffers.empty())
+                    return 0;
+                return frame_buffers[frame % frame_buffers.size()]->get_address();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+#include <atomic>
+
+// TLAS instances written concurrently by job threads, without funneling the writes through one thread
+// slots are allocated and released lock-free from a fixed capacity, released slots are inactive (null reference)
+// each thread writes through its own handle straight into mapped memory and marks the slots dirty in an atomic bitset
+// submit() merges the dirty bits once per frame and copies only the dirty slots into that frame's instance buffer
+// create the TLAS with top_level_acceleration_structure::create(device, get_instance_data(0), get_capacity())
+// and pass the address submit() returns to set_instance_data() before each build
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct instance_writer {
+                using ptr = std::shared_ptr<instance_writer>;
+                using slot = uint32_t;
+
+                static constexpr slot no_slot = ~0u;
+
+                // writes from one thread, slots must not be written by two handles at the same time
+                // dirty bits are collected locally and published when the handle moves to another 64 slot block or is destroyed,
+                // so sequential slots cost one atomic operation per block
+                struct handle {
+                    explicit handle(instance_writer& writer)
+                    : writer(&writer), instances(writer.write_data) {}
+
+                    handle(handle&& other) noexcept
+                    : writer(other.writer), instances(other.instances), word(other.word), bits(other.bits) {
+                        other.bits = 0;
+                    }
+
+                    handle(const handle&) = delete;
+                    handle& operator=(const handle&) = delete;
+
+                    ~handle() {
+                        commit();
+                    }
+
+                    void set(slot s, const VkAccelerationStructureInstanceKHR& instance) {
+                        if ((instances[s].accelerationStructureReference == 0) != (instance.accelerationStructureReference == 0))
+                            writer->activity.store(true, std::memory_order_relaxed);
+                        instances[s] = instance;
+                        mark(s);
+                    }
+
+                    void set_transform(slot s, const glm::mat4x3& transform) {
+                        static_assert(sizeof(glm::mat4x3) == sizeof(VkTransformMatrixKHR::matrix));
+                        const glm::mat3x4 transposed = glm::transpose(transform);
+                        memcpy(&instances[s].transform, glm::value_ptr(transposed), sizeof(VkTransformMatrixKHR));
+                        mark(s);
+                    }
+
+                    void set_mask(slot s, uint8_t mask) {
+                        instances[s].mask = mask;
+                        mark(s);
+                    }
+
+                    void set_blas(slot s, const bottom_level_acceleration_structure& blas) {
+                        if (instances[s].accelerationStructureReference == 0)
+                            writer->activity.store(true, std::memory_order_relaxed);
+                        instances[s].accelerationStructureReference = blas.get_address();
+                        mark(s);
+                    }
+
+                    // publishes the local dirty bits, called by the destructor
+                    void commit() {
+                        if (bits) {
+                            writer->dirty[word].fetch_or(bits, std::memory_order_release);
+                            bits = 0;
+                        }
+                    }
+
+                private:
+                    instance_writer* writer;
+                    VkAccelerationStructureInstanceKHR* instances;
+                    uint32_t word = 0;
+                    uint64_t bits = 0;
+
+                    void mark(slot s) {
+                        const uint32_t w = s / 64;
+                        if (w != word) {
+                            commit();
+                            word = w;
+                        }
+                        bits |= 1ull << (s % 64);
+                    }
+                };
+
+                ~instance_writer() {
+                    destroy();
+                }
+
+                // capacity is the maximum number of instances, frame_count the number of frames in flight
+                // with one frame the handles write into the buffer the builds read, the caller has to make sure no build is in flight
+                // with more, they write into a host-cached copy and submit() copies the dirty slots into the frame's buffer
+                bool create(device_p device, uint32_t capacity, uint32_t frame_count = 1);
+                void destroy();
+
+                // thread-safe, the slot starts out with instance, returns no_slot if the capacity is exhausted
+                slot allocate(const VkAccelerationStructureInstanceKHR& instance);
+                // thread-safe, the slot turns inactive and can be handed out again
+                void release(slot s);
+
+                handle get_handle() {
+                    return handle(*this);
+                }
+
+                // call once per frame from one thread after all handles were committed, frame is the index being recorded
+                // returns the instance data address for top_level_acceleration_structure::set_instance_data()
+                VkDeviceAddress submit(index frame);
+
+                // slots turned active or inactive before the last submit(), which needs a TLAS rebuild instead of an update
+                bool activity_changed() const {
+                    return rebuild_needed;
+                }
+
+                // slots copied by the last submit()
+                uint32_t get_submitted_count() const {
+                    return submitted_count;
+                }
+
+                VkDeviceAddress get_instance_data(index frame) const;
+
+                uint32_t get_capacity() const {
+                    return capacity;
+                }
+
+            private:
+                device_p device = nullptr;
+                uint32_t capacity = 0;
+                uint32_t word_count = 0;
+
+                // read by the builds, one per frame in flight
+                std::vector<buffer::ptr> frame_buffers;
+                // written by the handles, host-cached if there is more than one frame
+                buffer::ptr write_buffer;
+                VkAccelerationStructureInstanceKHR* write_data = nullptr;
+
+                // slots written since the last submit()
+                std::unique_ptr<std::atomic<uint64_t>[]> dirty;
+                // slots each frame buffer is missing, only touched by submit()
+                std::vector<std::vector<uint64_t>> pending;
+
+                // free list of released slots, the upper 32 bits of the head count the pops against ABA
+                std::unique_ptr<std::atomic<uint32_t>[]> next_free;
+                std::atomic<uint64_t> free_head = no_slot;
+                // slots never handed out start here
+                std::atomic<uint32_t> high_water = 0;
+
+                std::atomic<bool> activity = false;
+                bool rebuild_needed = false;
+                uint32_t submitted_count = 0;
+
+                void mark_dirty(slot s) {
+                    dirty[s / 64].fetch_or(1ull << (s % 64), std::memory_order_release);
+                }
+            };
+
+            inline instance_writer::ptr make_instance_writer() {
+                return std::make_shared<instance_writer>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
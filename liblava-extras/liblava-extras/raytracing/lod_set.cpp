@@ -0,0 +1,79 @@
+#include "liblava-extras/raytracing/lod_set.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            index lod_set::select(float size) const {
+                for (size_t i = 0; i < levels.size(); i++) {
+                    if (size >= levels[i].min_size)
+                        return index(i);
+                }
+                return levels.empty() ? 0 : index(levels.size() - 1);
+            }
+
+            int32_t lod_set::resolve(index desired) const {
+                // coarser levels first, they're cheaper and more likely to stay resident
+                for (size_t i = desired; i < levels.size(); i++) {
+                    if (levels[i].blas)
+                        return int32_t(i);
+                }
+                for (size_t i = std::min<size_t>(desired, levels.size()); i > 0; i--) {
+                    if (levels[i - 1].blas)
+                        return int32_t(i - 1);
+                }
+                return -1;
+            }
+
+            void lod_selector::add_instance(index i, lod_set::ptr set) {
+                instances.push_back({ .tlas_index = i, .set = set });
+            }
+
+            uint32_t lod_selector::update(top_level_acceleration_structure& tlas, const glm::vec3& camera, float fov_y, float bias) {
+                const std::vector<VkAccelerationStructureInstanceKHR>& tlas_instances = tlas.get_instances();
+                const float projection = 1.0f / std::tan(fov_y * 0.5f);
+
+                uint32_t patched = 0;
+                for (instance& ins : instances) {
+                    if (ins.tlas_index >= tlas_instances.size())
+                        continue;
+
+                    // VkTransformMatrixKHR is a row-major 3x4 matrix
+                    const float(&m)[3][4] = tlas_instances[ins.tlas_index].transform.matrix;
+                    const glm::vec3 position = { m[0][3], m[1][3], m[2][3] };
+                    const float scale = std::max({ glm::length(glm::vec3(m[0][0], m[1][0], m[2][0])),
+                                                   glm::length(glm::vec3(m[0][1], m[1][1], m[2][1])),
+                                                   glm::length(glm::vec3(m[0][2], m[1][2], m[2][2])) });
+
+                    // bounding sphere diameter relative to the viewport height
+                    const float distance = std::max(glm::distance(position, camera), 0.0001f);
+                    const float size = bias * projection * ins.set->get_radius() * scale / distance;
+
+                    index desired = ins.set->select(size);
+                    if (ins.current >= 0 && desired > index(ins.current)) {
+                        // stay on the finer level until the size is clearly below its threshold
+                        const float threshold = ins.set->get_levels()[ins.current].min_size;
+                        if (size >= threshold * (1.0f - hysteresis))
+                            desired = index(ins.current);
+                    }
+
+                    const int32_t level = ins.set->resolve(desired);
+                    if (level < 0)
+                        continue;
+
+                    // set_level() may have swapped the BLAS of the current level, so compare the reference too
+                    const bottom_level_acceleration_structure::ptr& blas = ins.set->get_levels()[level].blas;
+                    if (level == ins.current && tlas_instances[ins.tlas_index].accelerationStructureReference == blas->get_address())
+                        continue;
+
+                    tlas.update_instance(ins.tlas_index, blas);
+                    ins.current = level;
+                    patched++;
+                }
+
+                return patched;
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
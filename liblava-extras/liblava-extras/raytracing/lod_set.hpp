@@ -0,0 +1,97 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+
+// level of detail for TLAS instances
+// a lod_set holds several BLAS of one mesh, each level is used above a projected size (bounding sphere height relative to the viewport height)
+// levels can be streamed in and out with set_level(), instances fall back to the closest resident level, preferring coarser ones,
+// so keep the coarsest level resident
+// lod_selector picks a level per instance each frame and patches the changed instances with update_instance()
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct lod_set {
+                using ptr = std::shared_ptr<lod_set>;
+
+                struct level {
+                    bottom_level_acceleration_structure::ptr blas;
+                    float min_size = 0.0f;
+                };
+
+                // radius of the mesh's bounding sphere in object space
+                explicit lod_set(float radius = 1.0f)
+                : radius(radius) {}
+
+                // add from most to least detailed, min_size is the smallest projected size this level is used for
+                void add_level(bottom_level_acceleration_structure::ptr blas, float min_size) {
+                    levels.push_back({ .blas = blas, .min_size = min_size });
+                }
+
+                // nullptr marks the level as not resident
+                // instances using the level pick up the new BLAS with the next lod_selector::update()
+                void set_level(index i, bottom_level_acceleration_structure::ptr blas) {
+                    if (i < levels.size())
+                        levels[i].blas = blas;
+                }
+
+                // desired level for a projected size
+                index select(float size) const;
+                // closest resident level to the desired one, -1 if none is resident
+                int32_t resolve(index desired) const;
+
+                std::vector<level> const& get_levels() const {
+                    return levels;
+                }
+
+                float get_radius() const {
+                    return radius;
+                }
+
+            private:
+                std::vector<level> levels;
+                float radius = 1.0f;
+            };
+
+            inline lod_set::ptr make_lod_set(float radius = 1.0f) {
+                return std::make_shared<lod_set>(radius);
+            }
+
+            struct lod_selector {
+                using ptr = std::shared_ptr<lod_selector>;
+
+                // the TLAS instance i uses the levels of set
+                void add_instance(index i, lod_set::ptr set);
+                void clear() {
+                    instances.clear();
+                }
+
+                // a coarser level is only picked when the size drops this fraction below its threshold, avoids flickering between levels
+                void set_hysteresis(float fraction) {
+                    hysteresis = fraction;
+                }
+
+                // picks the level for every instance from its position in the TLAS and patches the ones that changed
+                // fov_y is the vertical field of view in radians, bias > 1 prefers more detailed levels
+                // returns the number of patched instances, the TLAS needs an update if it's > 0
+                uint32_t update(top_level_acceleration_structure& tlas, const glm::vec3& camera, float fov_y, float bias = 1.0f);
+
+            private:
+                struct instance {
+                    index tlas_index;
+                    lod_set::ptr set;
+                    int32_t current = -1;
+                };
+
+                std::vector<instance> instances;
+                float hysteresis = 0.1f;
+            };
+
+            inline lod_selector::ptr make_lod_selector() {
+                return std::make_shared<lod_selector>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
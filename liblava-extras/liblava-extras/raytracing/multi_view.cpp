@@ -0,0 +1,97 @@
+#include "liblava-extras/raytracing/multi_view.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool multi_view::create(device_p dev, VkFormat format, glm::uvec2 size, uint32_t views, uint32_t frames, VkImageUsageFlags usage) {
+                if (views == 0 || frames == 0)
+                    return false;
+
+                device = dev;
+                max_views = views;
+                view_count = views;
+                frame_count = frames;
+                current_frame = 0;
+                initialized = false;
+
+                output_image = image::make(format);
+                output_image->set_usage(usage | VK_IMAGE_USAGE_STORAGE_BIT);
+                output_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+                output_image->set_aspect_mask(format_aspect_mask(format));
+                output_image->set_layer_count(max_views);
+                output_image->set_view_type(VK_IMAGE_VIEW_TYPE_2D_ARRAY);
+                if (!output_image->create(device, size))
+                    return false;
+
+                view_buffer = buffer::make();
+                if (!view_buffer->create_mapped(device, nullptr, sizeof(view) * max_views * frame_count,
+                                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT))
+                    return false;
+
+                return true;
+            }
+
+            void multi_view::destroy() {
+                if (output_image) {
+                    output_image->destroy();
+                    output_image = nullptr;
+                }
+
+                if (view_buffer) {
+                    view_buffer->destroy();
+                    view_buffer = nullptr;
+                }
+
+                max_views = 0;
+                view_count = 0;
+                frame_count = 0;
+                initialized = false;
+                device = nullptr;
+            }
+
+            bool multi_view::resize(glm::uvec2 size) {
+                if (!output_image)
+                    return false;
+
+                // a new image starts in VK_IMAGE_LAYOUT_UNDEFINED again
+                output_image->destroy();
+                initialized = false;
+                return output_image->create(device, size);
+            }
+
+            void multi_view::begin_frame(index frame) {
+                current_frame = frame_count > 0 ? frame % frame_count : 0;
+            }
+
+            void multi_view::set_view(index i, const view& v) {
+                if (!view_buffer || i >= max_views)
+                    return;
+                view* views = reinterpret_cast<view*>(static_cast<uint8_t*>(view_buffer->get_mapped_data()) + get_views_offset());
+                views[i] = v;
+            }
+
+            void multi_view::trace(VkCommandBuffer cmd_buf, const shader_binding_table& sbt, index raygen) {
+                if (!output_image || view_count == 0)
+                    return;
+
+                const glm::uvec2 size = output_image->get_size();
+
+                if (!initialized) {
+                    insert_image_memory_barrier(device, cmd_buf, output_image->get(), 0, VK_ACCESS_SHADER_WRITE_BIT,
+                                                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                                output_image->get_subresource_range());
+                    initialized = true;
+                }
+
+                const VkStridedDeviceAddressRegionKHR raygen_region = sbt.get_raygen_region(raygen);
+                device->call().vkCmdTraceRaysKHR(
+                    cmd_buf,
+                    &raygen_region, &sbt.get_miss_region(), &sbt.get_hit_region(), &sbt.get_callable_region(),
+                    size.x, size.y, view_count);
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "liblava-extras/raytracing/shader_binding_table.hpp"
+#include "liblava/resource/image.hpp"
+
+// traces many small views of the same size in a single vkCmdTraceRaysKHR call, e.g. shadow cubemap faces or light probes
+// the launch depth is the view count: raygen shaders read their camera from views[gl_LaunchIDEXT.z]
+// and write to layer gl_LaunchIDEXT.z of an image2DArray
+// the camera array lives in a host-visible buffer with one region per frame in flight,
+// pass get_views_address() to the shaders, see res/raytracing/multi_view.glsl
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct multi_view {
+                using ptr = std::shared_ptr<multi_view>;
+
+                // matches the std430 layout of the shader struct
+                struct view {
+                    glm::mat4 inv_view;
+                    glm::mat4 inv_proj;
+                };
+
+                ~multi_view() {
+                    destroy();
+                }
+
+                bool create(device_p device, VkFormat format, glm::uvec2 size, uint32_t max_views, uint32_t frame_count,
+                            VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+                void destroy();
+
+                // recreates the image with a new size, its contents are undefined until the next trace()
+                bool resize(glm::uvec2 size);
+
+                // selects the camera region of this frame, its previous contents were used by the GPU frame_count frames ago
+                void begin_frame(index frame);
+
+                // views are written to the region of the current frame
+                void set_view(index i, const view& view);
+                void set_view_count(uint32_t count) {
+                    view_count = std::min(count, max_views);
+                }
+
+                // traces all views with the given raygen shader, the image is in VK_IMAGE_LAYOUT_GENERAL afterwards
+                // insert a barrier before reading the image
+                void trace(VkCommandBuffer cmd_buf, const shader_binding_table& sbt, index raygen = 0);
+
+                VkDeviceAddress get_views_address() const {
+                    return view_buffer ? view_buffer->get_address() + get_views_offset() : 0;
+                }
+
+                VkDeviceSize get_views_offset() const {
+                    return VkDeviceSize(current_frame) * sizeof(view) * max_views;
+                }
+
+                buffer::ptr get_view_buffer() const {
+                    return view_buffer;
+                }
+
+                // layers of an image with VK_IMAGE_VIEW_TYPE_2D_ARRAY view
+                image::ptr get_image() const {
+                    return output_image;
+                }
+
+                uint32_t get_view_count() const {
+                    return view_count;
+                }
+
+            private:
+                device_p device = nullptr;
+
+                image::ptr output_image;
+                buffer::ptr view_buffer;
+
+                uint32_t max_views = 0;
+                uint32_t view_count = 0;
+                uint32_t frame_count = 0;
+                index current_frame = 0;
+
+                // the image was transitioned to VK_IMAGE_LAYOUT_GENERAL, reset whenever it's (re)created
+                bool initialized = false;
+            };
+
+            inline multi_view::ptr make_multi_view() {
+                return std::make_shared<multi_view>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -34,6 +34,31 @@ namespace lava {
                 return true;
             }
 
+            bool raytracing_pipeline::add_shader_stage(cdata const& data, VkShaderStageFlagBits stage, const specialization& constants) {
+                if (constants.empty())
+                    return add_shader_stage(data, stage);
+
+                if (!data.ptr) {
+                    log()->error("raytracing pipeline shader stage data");
+                    return false;
+                }
+
+                specialization::ptr stage_constants = std::make_shared<specialization>(constants);
+
+                shader_stage::ptr shader_stage = shader_stage::make(stage);
+                for (const VkSpecializationMapEntry& entry : stage_constants->entries)
+                    shader_stage->add_specialization_entry(entry);
+
+                if (!shader_stage->create(device, data, cdata(stage_constants->data.data(), stage_constants->data.size()))) {
+                    log()->error("create raytracing pipeline shader stage");
+                    return false;
+                }
+
+                specializations.push_back(stage_constants);
+                add(shader_stage);
+                return true;
+            }
+
             void raytracing_pipeline::add_shader_general_group(uint32_t index) {
                 add_shader_group({ .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
                                    .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
@@ -57,7 +82,9 @@ namespace lava {
             void raytracing_pipeline::copy_to(raytracing_pipeline* target) const {
                 target->shader_groups = shader_groups;
                 target->shader_stages = shader_stages;
+                target->specializations = specializations;
                 target->max_recursion_depth = max_recursion_depth;
+                target->vk_layout = vk_layout;
             }
 
             bool raytracing_pipeline::setup() {
@@ -73,7 +100,7 @@ namespace lava {
                     .groupCount = to_ui32(shader_groups.size()),
                     .pGroups = shader_groups.data(),
                     .maxPipelineRayRecursionDepth = max_recursion_depth,
-                    .layout = layout->get()
+                    .layout = vk_layout != VK_NULL_HANDLE ? vk_layout : layout->get()
                 };
 
                 return check(
@@ -84,6 +111,7 @@ namespace lava {
             void raytracing_pipeline::teardown() {
                 shader_groups.clear();
                 shader_stages.clear();
+                specializations.clear();
             }
 
         } // namespace raytracing
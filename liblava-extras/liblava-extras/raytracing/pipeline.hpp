@@ -8,6 +8,27 @@ namespace lava {
 
             using VkRayTracingShaderGroupCreateInfosKHR = std::vector<VkRayTracingShaderGroupCreateInfoKHR>;
 
+            // specialization constant values of one shader stage
+            struct specialization {
+                using ptr = std::shared_ptr<specialization>;
+
+                // value for layout(constant_id = constant_id), T must match the size of the shader type (bool is 4 bytes)
+                template<typename T>
+                void set(uint32_t constant_id, const T& value) {
+                    static_assert(std::is_trivially_copyable_v<T>);
+                    entries.push_back({ .constantID = constant_id, .offset = uint32_t(data.size()), .size = sizeof(T) });
+                    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+                    data.insert(data.end(), bytes, bytes + sizeof(T));
+                }
+
+                bool empty() const {
+                    return entries.empty();
+                }
+
+                VkSpecializationMapEntries entries;
+                std::vector<uint8_t> data;
+            };
+
             struct raytracing_pipeline : pipeline {
                 using ptr = std::shared_ptr<raytracing_pipeline>;
                 using map = std::map<id, ptr>;
@@ -28,6 +49,12 @@ namespace lava {
                     return add_shader_stage(data, stage);
                 }
 
+                // stage with specialization constants, the values are kept alive with the stage
+                bool add_shader_stage(cdata const& data, VkShaderStageFlagBits stage, const specialization& constants);
+                bool add_shader(cdata const& data, VkShaderStageFlagBits stage, const specialization& constants) {
+                    return add_shader_stage(data, stage, constants);
+                }
+
                 void add(shader_stage::ptr const& shader_stage) {
                     shader_stages.push_back(shader_stage);
                 }
@@ -37,6 +64,7 @@ namespace lava {
                 }
                 void clear_shader_stages() {
                     shader_stages.clear();
+                    specializations.clear();
                 }
 
                 // raygen or miss or callable
@@ -61,6 +89,13 @@ namespace lava {
                     max_recursion_depth = std::min(properties.maxRayRecursionDepth, depth);
                 }
 
+                using pipeline::set_layout;
+                // layout not created through lava's pipeline_layout, e.g. with a push descriptor set
+                // takes precedence over the pipeline_layout, the caller keeps ownership
+                void set_layout(VkPipelineLayout pipeline_layout) {
+                    vk_layout = pipeline_layout;
+                }
+
                 void copy_to(raytracing_pipeline* target) const;
                 void copy_from(ptr const& source) {
                     source->copy_to(this);
@@ -74,7 +109,10 @@ namespace lava {
 
                 VkRayTracingShaderGroupCreateInfosKHR shader_groups;
                 shader_stage::list shader_stages;
+                // stages only point to their specialization data
+                std::vector<specialization::ptr> specializations;
                 uint32_t max_recursion_depth;
+                VkPipelineLayout vk_layout = VK_NULL_HANDLE;
             };
 
             inline raytracing_pipeline::ptr make_raytracing_pipeline(device_p device,
@@ -0,0 +1,52 @@
+#include "liblava-extras/raytracing/pipeline_variants.hpp"
+#include "liblava/util/log.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            std::string pipeline_variants::make_key(const specialization& constants) {
+                // map entries and values, the same values at different ids are different variants
+                std::string key;
+                key.append(reinterpret_cast<const char*>(constants.entries.data()), sizeof(VkSpecializationMapEntry) * constants.entries.size());
+                key.append(reinterpret_cast<const char*>(constants.data.data()), constants.data.size());
+                return key;
+            }
+
+            pipeline_variants::variant pipeline_variants::get(const specialization& constants) {
+                const std::string key = make_key(constants);
+
+                auto it = variants.find(key);
+                if (it != variants.end())
+                    return it->second;
+
+                if (!on_create) {
+                    log()->error("raytracing pipeline variants without create function");
+                    return {};
+                }
+
+                variant created = on_create(constants);
+                if (!created.pipeline) {
+                    log()->error("create raytracing pipeline variant");
+                    return {};
+                }
+
+                variants[key] = created;
+                return created;
+            }
+
+            bool pipeline_variants::contains(const specialization& constants) const {
+                return variants.count(make_key(constants)) > 0;
+            }
+
+            void pipeline_variants::clear() {
+                for (auto& entry : variants) {
+                    entry.second.pipeline->destroy();
+                    entry.second.sbt = nullptr;
+                }
+                variants.clear();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
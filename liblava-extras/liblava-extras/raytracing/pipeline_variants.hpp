@@ -0,0 +1,59 @@
+#pragma once
+
+#include "liblava-extras/raytracing/shader_binding_table.hpp"
+#include <unordered_map>
+
+// creates and memoizes raytracing pipelines (and their SBT) for sets of specialization constants
+// values like the ray depth or ray flags become compile-time constants the driver can fold and unroll,
+// each distinct set of values gets its own pipeline the first time it's requested
+// create pipelines for common configurations upfront, creation at draw time causes hitches
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct pipeline_variants {
+                using ptr = std::shared_ptr<pipeline_variants>;
+
+                struct variant {
+                    raytracing_pipeline::ptr pipeline;
+                    shader_binding_table::ptr sbt;
+                };
+
+                // creates the pipeline and SBT for a set of constants, return an empty pipeline on failure
+                using create_func = std::function<variant(const specialization& constants)>;
+
+                ~pipeline_variants() {
+                    clear();
+                }
+
+                void set_create_func(create_func func) {
+                    on_create = std::move(func);
+                }
+
+                // returns the cached variant or creates it, pipeline is nullptr if creation failed
+                variant get(const specialization& constants);
+                bool contains(const specialization& constants) const;
+
+                // destroys all pipelines, they must not be in use anymore
+                // SBTs with a deletion queue are freed through it
+                void clear();
+
+                size_t size() const {
+                    return variants.size();
+                }
+
+            private:
+                create_func on_create;
+                std::unordered_map<std::string, variant> variants;
+
+                static std::string make_key(const specialization& constants);
+            };
+
+            inline pipeline_variants::ptr make_pipeline_variants() {
+                return std::make_shared<pipeline_variants>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,116 @@
+#include "liblava-extras/raytracing/push_descriptor.hpp"
+#include "liblava/util/log.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            void push_descriptor::add_binding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags stages) {
+                bindings.push_back({ .binding = binding,
+                                     .descriptorType = type,
+                                     .descriptorCount = 1,
+                                     .stageFlags = stages });
+                slots.push_back({});
+            }
+
+            bool push_descriptor::create(device_p dev) {
+                device = dev;
+
+                const VkDescriptorSetLayoutCreateInfo create_info = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+                                                                      .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
+                                                                      .bindingCount = uint32_t(bindings.size()),
+                                                                      .pBindings = bindings.data() };
+                return check(device->call().vkCreateDescriptorSetLayout(device->get(), &create_info, memory::instance().alloc(), &set_layout));
+            }
+
+            bool push_descriptor::create_template(VkPipelineLayout layout, uint32_t set, VkPipelineBindPoint bind_point) {
+                if (set_layout == VK_NULL_HANDLE) {
+                    log()->error("push descriptor template without set layout");
+                    return false;
+                }
+
+                // one entry per binding, each reads its own slot
+                std::vector<VkDescriptorUpdateTemplateEntry> entries;
+                for (size_t i = 0; i < bindings.size(); i++) {
+                    entries.push_back({ .dstBinding = bindings[i].binding,
+                                        .dstArrayElement = 0,
+                                        .descriptorCount = 1,
+                                        .descriptorType = bindings[i].descriptorType,
+                                        .offset = i * sizeof(slot),
+                                        .stride = sizeof(slot) });
+                }
+
+                const VkDescriptorUpdateTemplateCreateInfo create_info = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+                                                                           .descriptorUpdateEntryCount = uint32_t(entries.size()),
+                                                                           .pDescriptorUpdateEntries = entries.data(),
+                                                                           .templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR,
+                                                                           .descriptorSetLayout = set_layout,
+                                                                           .pipelineBindPoint = bind_point,
+                                                                           .pipelineLayout = layout,
+                                                                           .set = set };
+                if (!check(device->call().vkCreateDescriptorUpdateTemplate(device->get(), &create_info, memory::instance().alloc(), &update_template)))
+                    return false;
+
+                pipeline_layout = layout;
+                set_index = set;
+                return true;
+            }
+
+            void push_descriptor::destroy() {
+                if (update_template != VK_NULL_HANDLE) {
+                    device->call().vkDestroyDescriptorUpdateTemplate(device->get(), update_template, memory::instance().alloc());
+                    update_template = VK_NULL_HANDLE;
+                }
+
+                if (set_layout != VK_NULL_HANDLE) {
+                    device->call().vkDestroyDescriptorSetLayout(device->get(), set_layout, memory::instance().alloc());
+                    set_layout = VK_NULL_HANDLE;
+                }
+
+                pipeline_layout = VK_NULL_HANDLE;
+                device = nullptr;
+            }
+
+            push_descriptor::slot* push_descriptor::find_slot(uint32_t binding) {
+                for (size_t i = 0; i < bindings.size(); i++) {
+                    if (bindings[i].binding == binding)
+                        return &slots[i];
+                }
+                return nullptr;
+            }
+
+            void push_descriptor::set_acceleration_structure(uint32_t binding, const acceleration_structure& structure) {
+                // templates take the handle directly instead of a VkWriteDescriptorSetAccelerationStructureKHR
+                if (slot* s = find_slot(binding))
+                    s->acceleration_structure = structure.get();
+            }
+
+            void push_descriptor::set_image(uint32_t binding, VkImageView view, VkImageLayout layout) {
+                if (slot* s = find_slot(binding))
+                    s->image = { .sampler = VK_NULL_HANDLE, .imageView = view, .imageLayout = layout };
+            }
+
+            void push_descriptor::set_buffer(uint32_t binding, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+                if (slot* s = find_slot(binding))
+                    s->buffer = { .buffer = buffer, .offset = offset, .range = range };
+            }
+
+            void push_descriptor::push(VkCommandBuffer cmd_buf) const {
+                if (update_template == VK_NULL_HANDLE)
+                    return;
+                device->call().vkCmdPushDescriptorSetWithTemplateKHR(cmd_buf, update_template, pipeline_layout, set_index, slots.data());
+            }
+
+            bool push_descriptor::create_pipeline_layout(device_p device, const std::vector<VkDescriptorSetLayout>& set_layouts,
+                                                         const std::vector<VkPushConstantRange>& push_constant_ranges, VkPipelineLayout& layout) {
+                const VkPipelineLayoutCreateInfo create_info = { .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                                                                 .setLayoutCount = uint32_t(set_layouts.size()),
+                                                                 .pSetLayouts = set_layouts.data(),
+                                                                 .pushConstantRangeCount = uint32_t(push_constant_ranges.size()),
+                                                                 .pPushConstantRanges = push_constant_ranges.data() };
+                return check(device->call().vkCreatePipelineLayout(device->get(), &create_info, memory::instance().alloc(), &layout));
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+
+// binds the TLAS, output images and buffers of a dispatch with VK_KHR_push_descriptor
+// the bindings live in the command buffer, so there are no descriptor sets to allocate or rewrite when they change
+// all bindings are pushed with one vkCmdPushDescriptorSetWithTemplateKHR call through a descriptor update template
+// lava's pipeline_layout can't hold this set layout, create the pipeline layout with create_pipeline_layout()
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct push_descriptor {
+                using ptr = std::shared_ptr<push_descriptor>;
+
+                ~push_descriptor() {
+                    destroy();
+                }
+
+                // acceleration structures, storage images, storage and uniform buffers, one descriptor per binding
+                void add_binding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags stages);
+
+                // creates the set layout, use get() at index set in the pipeline layout
+                bool create(device_p device);
+                // creates the update template, needs the pipeline layout using this set
+                bool create_template(VkPipelineLayout layout, uint32_t set, VkPipelineBindPoint bind_point = VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR);
+                void destroy();
+
+                // the values are copied, they're pushed with the next push()
+                void set_acceleration_structure(uint32_t binding, const acceleration_structure& structure);
+                void set_image(uint32_t binding, VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL);
+                void set_buffer(uint32_t binding, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+                void push(VkCommandBuffer cmd_buf) const;
+
+                VkDescriptorSetLayout get() const {
+                    return set_layout;
+                }
+
+                // pipeline layout from raw set layouts, lava's pipeline_layout only takes descriptor objects
+                static bool create_pipeline_layout(device_p device, const std::vector<VkDescriptorSetLayout>& set_layouts,
+                                                   const std::vector<VkPushConstantRange>& push_constant_ranges, VkPipelineLayout& layout);
+
+            private:
+                device_p device = nullptr;
+
+                // template data of one binding, large enough for any of the descriptor infos
+                union slot {
+                    VkAccelerationStructureKHR acceleration_structure;
+                    VkDescriptorImageInfo image;
+                    VkDescriptorBufferInfo buffer;
+                };
+
+                std::vector<VkDescriptorSetLayoutBinding> bindings;
+                std::vector<slot> slots;
+
+                VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+                VkDescriptorUpdateTemplate update_template = VK_NULL_HANDLE;
+                VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+                uint32_t set_index = 0;
+
+                slot* find_slot(uint32_t binding);
+            };
+
+            inline push_descriptor::ptr make_push_descriptor() {
+                return std::make_shared<push_descriptor>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,348 @@
+#include "liblava-extras/raytracing/residency_manager.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+#include <algorithm>
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            namespace {
+
+                // serialized data has to be 256 byte aligned
+                constexpr VkDeviceSize serialize_alignment = 256;
+
+                VkDeviceAddress serialized_address(const buffer::ptr& buf) {
+                    return (buf->get_address() + serialize_alignment - 1) & ~(serialize_alignment - 1);
+                }
+
+            } // namespace
+
+            bool residency_manager::create(device_p dev, uint32_t max_entries, eviction_mode eviction, bool budget) {
+                device = dev;
+                mode = eviction;
+                memory_budget = budget;
+                max_entry_count = max_entries;
+                entries.reserve(max_entries);
+
+                if (mode == serialize) {
+                    const VkQueryPoolCreateInfo pool_info = {
+                        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                        .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+                        .queryCount = max_entries
+                    };
+                    if (!check(device->call().vkCreateQueryPool(device->get(), &pool_info, memory::instance().alloc(), &query_pool)))
+                        return false;
+                }
+
+                frame = 1;
+                return true;
+            }
+
+            void residency_manager::destroy() {
+                for (entry_data& data : entries) {
+                    if (data.serialized)
+                        retire(data.serialized);
+                }
+                entries.clear();
+
+                if (query_pool != VK_NULL_HANDLE) {
+                    device->call().vkDestroyQueryPool(device->get(), query_pool, memory::instance().alloc());
+                    query_pool = VK_NULL_HANDLE;
+                }
+
+                tracked = {};
+                max_entry_count = 0;
+                device = nullptr;
+            }
+
+            residency_manager::entry residency_manager::add(bottom_level_acceleration_structure::ptr blas, bottom_level_acceleration_structure::ptr proxy) {
+                if (!blas || !blas->is_built() || entries.size() >= max_entry_count)
+                    return no_entry;
+
+                entries.push_back({ .blas = blas, .proxy = proxy, .last_used = frame });
+                return entry(entries.size() - 1);
+            }
+
+            void residency_manager::add_instance(entry e, index instance) {
+                if (e < entries.size())
+                    entries[e].instances.push_back(instance);
+            }
+
+            void residency_manager::touch(entry e) {
+                if (e >= entries.size())
+                    return;
+                entry_data& data = entries[e];
+                data.last_used = frame;
+                if (!data.blas->is_resident())
+                    data.requested = true;
+            }
+
+            bool residency_manager::is_resident(entry e) const {
+                return e < entries.size() && entries[e].blas->is_resident();
+            }
+
+            uint32_t residency_manager::update(VkCommandBuffer cmd_buf, top_level_acceleration_structure& tlas, VkDeviceAddress scratch_buffer, VkDeviceSize scratch_size) {
+                if (!device)
+                    return 0;
+
+                read_queries();
+
+                if (fixed_limit > 0)
+                    limit = fixed_limit;
+                else
+                    limit = memory_budget ? query_limit() : heap_limit();
+
+                tracked.acceleration_structures = tlas.get_size();
+                for (const entry_data& data : entries) {
+                    if (data.blas->is_resident())
+                        tracked.acceleration_structures += data.blas->get_size();
+                }
+
+                // queries and serialization read the structures built before
+                bool synchronized = false;
+                const auto synchronize_builds = [&]() {
+                    if (!synchronized) {
+                        insert_build_barrier(device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+                        synchronized = true;
+                    }
+                };
+
+                // serialization sizes of new entries, they can be evicted once the result is available
+                if (mode == serialize) {
+                    for (entry e = 0; e < entries.size(); e++) {
+                        entry_data& data = entries[e];
+                        if (data.serialized_size > 0 || data.query_pending || !data.blas->is_built())
+                            continue;
+
+                        synchronize_builds();
+                        const VkAccelerationStructureKHR handle = data.blas->get();
+                        device->call().vkCmdResetQueryPool(cmd_buf, query_pool, e, 1);
+                        device->call().vkCmdWriteAccelerationStructuresPropertiesKHR(
+                            cmd_buf, 1, &handle, VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, query_pool, e);
+                        data.query_pending = true;
+                    }
+                }
+
+                uint32_t patched = 0;
+
+                // least recently used first, entries used this frame stay
+                if (tracked.total() > limit) {
+                    std::vector<entry_data*> candidates;
+                    for (entry_data& data : entries) {
+                        if (data.blas->is_resident() && data.last_used < frame && (mode == rebuild || data.serialized_size > 0))
+                            candidates.push_back(&data);
+                    }
+                    std::sort(candidates.begin(), candidates.end(), [](const entry_data* a, const entry_data* b) {
+                        return a->last_used < b->last_used;
+                    });
+
+                    for (entry_data* data : candidates) {
+                        if (tracked.total() <= limit)
+                            break;
+
+                        if (mode == serialize)
+                            synchronize_builds();
+
+                        const VkDeviceSize size = data->blas->get_size();
+                        if (!evict(cmd_buf, *data))
+                            break;
+                        tracked.acceleration_structures -= size;
+                        patched += patch_instances(tlas, *data);
+                    }
+                }
+
+                // most recently used first, stops at the first one that doesn't fit
+                std::vector<entry_data*> requests;
+                for (entry_data& data : entries) {
+                    if (data.requested)
+                        requests.push_back(&data);
+                }
+                std::sort(requests.begin(), requests.end(), [](const entry_data* a, const entry_data* b) {
+                    return a->last_used > b->last_used;
+                });
+
+                uint32_t restreamed = 0;
+                for (entry_data* data : requests) {
+                    if (restreamed >= max_restreams)
+                        break;
+
+                    // rebuilds get the full size, deserialized copies keep the size they were evicted with
+                    const VkDeviceSize size = mode == rebuild ? data->blas->get_build_sizes().accelerationStructureSize : data->blas->get_size();
+                    if (tracked.total() + size > limit)
+                        break;
+
+                    // rebuilds share the scratch buffer
+                    if (restreamed > 0 && mode == rebuild)
+                        insert_build_barrier(device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                             VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR);
+
+                    if (!restream(cmd_buf, *data, scratch_buffer, scratch_size))
+                        continue;
+
+                    tracked.acceleration_structures += data->blas->get_size();
+                    patched += patch_instances(tlas, *data);
+                    restreamed++;
+                }
+
+                // the TLAS build reads the restreamed structures
+                if (restreamed > 0)
+                    insert_build_barrier(device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                         VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR);
+
+                frame++;
+                return patched;
+            }
+
+            uint32_t residency_manager::get_resident_count() const {
+                return uint32_t(std::count_if(entries.begin(), entries.end(), [](const entry_data& data) {
+                    return data.blas->is_resident();
+                }));
+            }
+
+            uint32_t residency_manager::get_evicted_count() const {
+                return uint32_t(entries.size()) - get_resident_count();
+            }
+
+            bool residency_manager::evict(VkCommandBuffer cmd_buf, entry_data& data) {
+                if (mode == serialize) {
+                    data.serialized = buffer::make();
+                    if (!data.serialized->create(device, nullptr, data.serialized_size + serialize_alignment,
+                                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                                 false, VMA_MEMORY_USAGE_GPU_TO_CPU)) {
+                        log()->error("residency_manager failed to allocate {} bytes for a serialized BLAS", data.serialized_size);
+                        data.serialized = nullptr;
+                        return false;
+                    }
+
+                    if (!data.blas->serialize(cmd_buf, serialized_address(data.serialized))) {
+                        retire(data.serialized);
+                        data.serialized = nullptr;
+                        return false;
+                    }
+                }
+
+                // the deletion queue keeps the memory alive for the copy and frames in flight
+                data.blas->evict();
+                data.requested = false;
+                return true;
+            }
+
+            bool residency_manager::restream(VkCommandBuffer cmd_buf, entry_data& data, VkDeviceAddress scratch_buffer, VkDeviceSize scratch_size) {
+                if (mode == rebuild) {
+                    const VkDeviceSize needed = data.blas->get_build_sizes().buildScratchSize;
+                    if (!scratch_buffer || needed > scratch_size) {
+                        // logged once per entry, the request stays and is retried every update()
+                        if (!data.scratch_logged) {
+                            log()->error("residency_manager can't rebuild an evicted BLAS, it needs {} bytes of scratch memory and update() got {}",
+                                         needed, scratch_buffer ? scratch_size : 0);
+                            data.scratch_logged = true;
+                        }
+                        return false;
+                    }
+                    if (!data.blas->restore())
+                        return false;
+                    data.blas->build(cmd_buf, scratch_buffer);
+                } else {
+                    if (!data.serialized || !data.blas->restore(true))
+                        return false;
+                    data.blas->deserialize(cmd_buf, serialized_address(data.serialized));
+
+                    // read by the copy in flight
+                    retire(data.serialized);
+                    data.serialized = nullptr;
+                }
+
+                data.requested = false;
+                data.scratch_logged = false;
+                return true;
+            }
+
+            uint32_t residency_manager::patch_instances(top_level_acceleration_structure& tlas, entry_data& data) {
+                const std::vector<VkAccelerationStructureInstanceKHR>& instances = tlas.get_instances();
+                const bool resident = data.blas->is_resident();
+
+                if (!resident)
+                    data.masks.resize(data.instances.size());
+
+                uint32_t patched = 0;
+                for (size_t i = 0; i < data.instances.size(); i++) {
+                    if (data.instances[i] >= instances.size())
+                        continue;
+
+                    VkAccelerationStructureInstanceKHR instance = instances[data.instances[i]];
+                    if (resident) {
+                        instance.accelerationStructureReference = data.blas->get_address();
+                        if (!data.proxy && i < data.masks.size())
+                            instance.mask = data.masks[i];
+                    } else if (data.proxy) {
+                        instance.accelerationStructureReference = data.proxy->get_address();
+                    } else {
+                        // the evicted address can't stay in the TLAS, a null reference makes the instance inactive
+                        data.masks[i] = instance.mask;
+                        instance.mask = 0;
+                        instance.accelerationStructureReference = 0;
+                    }
+
+                    tlas.update_instance(data.instances[i], instance);
+                    patched++;
+                }
+                return patched;
+            }
+
+            void residency_manager::read_queries() {
+                for (entry e = 0; e < entries.size(); e++) {
+                    entry_data& data = entries[e];
+                    if (!data.query_pending)
+                        continue;
+
+                    // no wait, the size is available a frame or two later
+                    VkDeviceSize size = 0;
+                    if (device->call().vkGetQueryPoolResults(device->get(), query_pool, e, 1, sizeof(VkDeviceSize), &size, sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+                        data.serialized_size = size;
+                        data.query_pending = false;
+                    }
+                }
+            }
+
+            VkDeviceSize residency_manager::query_limit() const {
+                VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+                VkPhysicalDeviceMemoryProperties2 properties = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+                                                                 .pNext = &budget };
+                vkGetPhysicalDeviceMemoryProperties2(device->get_vk_physical_device(), &properties);
+
+                VkDeviceSize heap_budget = 0;
+                VkDeviceSize heap_usage = 0;
+                for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount; i++) {
+                    if (properties.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+                        heap_budget += budget.heapBudget[i];
+                        heap_usage += budget.heapUsage[i];
+                    }
+                }
+
+                // the budget is shared with everything else the process and other applications allocated
+                const VkDeviceSize available = VkDeviceSize(double(heap_budget) * budget_fraction);
+                const VkDeviceSize other = heap_usage - std::min(heap_usage, tracked.total());
+                return available - std::min(available, other);
+            }
+
+            VkDeviceSize residency_manager::heap_limit() const {
+                // no usage of other allocations to subtract, the fraction has to leave room for them
+                const VkPhysicalDeviceMemoryProperties& properties = device->get_physical_device()->get_memory_properties();
+                VkDeviceSize heap_size = 0;
+                for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+                    if (properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+                        heap_size += properties.memoryHeaps[i].size;
+                }
+                return VkDeviceSize(double(heap_size) * budget_fraction);
+            }
+
+            void residency_manager::retire(buffer::ptr buf) {
+                if (deletion)
+                    deletion->retire([buf]() { buf->destroy(); });
+                else
+                    buf->destroy();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
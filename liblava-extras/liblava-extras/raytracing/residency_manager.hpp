@@ -0,0 +1,160 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+
+// keeps the acceleration structures within the device memory budget reported by VK_EXT_memory_budget
+// tracks the footprint of acceleration structures, scratch memory and shader binding tables,
+// evicts the least recently used BLAS when it's over the limit and restreams them once they're used again
+// TLAS instances of evicted BLAS point to a proxy (e.g. a coarse LOD) or get a mask of 0 until the BLAS is back
+// restreaming either rebuilds the BLAS from its geometry (needs scratch memory) or deserializes a copy kept in host memory
+// without VK_EXT_memory_budget the limit is derived from the device local heap sizes, or set a fixed limit with set_limit()
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct residency_manager {
+                using ptr = std::shared_ptr<residency_manager>;
+                using entry = uint32_t;
+
+                static constexpr entry no_entry = ~0u;
+
+                enum eviction_mode {
+                    // restreaming rebuilds from the geometry, which has to stay valid
+                    rebuild = 0,
+                    // evicted structures are serialized to host memory and deserialized when restreamed
+                    serialize
+                };
+
+                struct footprint {
+                    VkDeviceSize acceleration_structures = 0;
+                    VkDeviceSize scratch = 0;
+                    VkDeviceSize sbt = 0;
+
+                    VkDeviceSize total() const {
+                        return acceleration_structures + scratch + sbt;
+                    }
+                };
+
+                ~residency_manager() {
+                    destroy();
+                }
+
+                // max_entries is the number of BLAS that can be added
+                // memory_budget tells whether VK_EXT_memory_budget is enabled on the device
+                bool create(device_p device, uint32_t max_entries, eviction_mode mode = rebuild, bool memory_budget = false);
+                void destroy();
+
+                // blas must be built, proxy stays resident and is referenced by the instances while blas is evicted
+                // the BLAS need a deletion queue if frames in flight can still trace against them
+                entry add(bottom_level_acceleration_structure::ptr blas, bottom_level_acceleration_structure::ptr proxy = nullptr);
+                // instance index in the TLAS passed to update() that references the entry's BLAS
+                void add_instance(entry e, index instance);
+
+                // marks the entry as used this frame, e.g. when its instances are visible
+                // evicted entries are restreamed by the next update()
+                void touch(entry e);
+
+                bool is_resident(entry e) const;
+
+                // records evictions and restreams, call once per frame before the TLAS build or update
+                // scratch_buffer of scratch_size bytes is used for rebuilds and required in rebuild mode,
+                // structures needing more aren't restreamed and an error is logged
+                // returns the number of TLAS instances that changed, rebuild the TLAS if it's not 0
+                // instances without proxy turn inactive while evicted, which an update can't do
+                uint32_t update(VkCommandBuffer cmd_buf, top_level_acceleration_structure& tlas, VkDeviceAddress scratch_buffer = 0, VkDeviceSize scratch_size = 0);
+
+                // fraction of the device local heap budget (or heap size) available to the tracked footprint, default 0.8
+                void set_budget_fraction(float fraction) {
+                    budget_fraction = fraction;
+                }
+
+                // fixed limit for the tracked footprint instead of the budget, 0 uses the budget again
+                void set_limit(VkDeviceSize bytes) {
+                    fixed_limit = bytes;
+                }
+
+                // other memory counted against the limit, e.g. scratch_allocator::get_region_size() * frame_count
+                void set_scratch_size(VkDeviceSize bytes) {
+                    tracked.scratch = bytes;
+                }
+                void set_sbt_size(VkDeviceSize bytes) {
+                    tracked.sbt = bytes;
+                }
+
+                // serialized copies are handed to the queue, the copies recorded by update() read them
+                void set_deletion_queue(deletion_queue::ptr queue) {
+                    deletion = queue;
+                }
+
+                // restreams per update(), spreads the build cost when many structures come back at once
+                void set_max_restreams(uint32_t count) {
+                    max_restreams = count;
+                }
+
+                const footprint& get_footprint() const {
+                    return tracked;
+                }
+
+                // limit of the last update()
+                VkDeviceSize get_limit() const {
+                    return limit;
+                }
+
+                uint32_t get_resident_count() const;
+                uint32_t get_evicted_count() const;
+
+            private:
+                device_p device = nullptr;
+                eviction_mode mode = rebuild;
+
+                struct entry_data {
+                    bottom_level_acceleration_structure::ptr blas;
+                    bottom_level_acceleration_structure::ptr proxy;
+                    std::vector<index> instances;
+                    // instance masks before eviction
+                    std::vector<uint32_t> masks;
+                    uint64_t last_used = 0;
+                    bool requested = false;
+                    // serialization size query written, serialized_size is valid once it's read
+                    bool query_pending = false;
+                    VkDeviceSize serialized_size = 0;
+                    // host copy of an evicted structure in serialize mode
+                    buffer::ptr serialized;
+                    // rebuild mode got too little scratch memory to restream it
+                    bool scratch_logged = false;
+                };
+
+                std::vector<entry_data> entries;
+                uint32_t max_entry_count = 0;
+
+                // one serialization size query per entry
+                VkQueryPool query_pool = VK_NULL_HANDLE;
+
+                footprint tracked;
+                float budget_fraction = 0.8f;
+                VkDeviceSize fixed_limit = 0;
+                VkDeviceSize limit = 0;
+                bool memory_budget = false;
+                uint32_t max_restreams = 4;
+
+                uint64_t frame = 1;
+
+                deletion_queue::ptr deletion;
+
+                bool evict(VkCommandBuffer cmd_buf, entry_data& data);
+                bool restream(VkCommandBuffer cmd_buf, entry_data& data, VkDeviceAddress scratch_buffer, VkDeviceSize scratch_size);
+                uint32_t patch_instances(top_level_acceleration_structure& tlas, entry_data& data);
+                void read_queries();
+                VkDeviceSize query_limit() const;
+                VkDeviceSize heap_limit() const;
+                void retire(buffer::ptr buf);
+            };
+
+            inline residency_manager::ptr make_residency_manager() {
+                return std::make_shared<residency_manager>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,136 @@
+#include "liblava-extras/raytracing/scratch_allocator.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool scratch_allocator::create(device_p dev, VkDeviceSize size, uint32_t frames) {
+                if (size == 0 || frames == 0)
+                    return false;
+
+                device = dev;
+                frame_count = frames;
+
+                VkPhysicalDeviceAccelerationStructurePropertiesKHR properties = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR };
+                VkPhysicalDeviceProperties2 properties2 = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+                                                            .pNext = &properties };
+                vkGetPhysicalDeviceProperties2(device->get_vk_physical_device(), &properties2);
+                alignment = std::max<VkDeviceSize>(properties.minAccelerationStructureScratchOffsetAlignment, 1);
+
+                region_size = align_up(size, alignment);
+
+                // the allocation itself might not be aligned, reserve space to align the first region
+                scratch_buffer = buffer::make();
+                if (!scratch_buffer->create(device, nullptr, region_size * frame_count + alignment,
+                                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, false, VMA_MEMORY_USAGE_GPU_ONLY))
+                    return false;
+                base_address = align_up(scratch_buffer->get_address(), alignment);
+
+                current_frame = 0;
+                offset = 0;
+
+                return true;
+            }
+
+            void scratch_allocator::destroy() {
+                if (scratch_buffer) {
+                    scratch_buffer->destroy();
+                    scratch_buffer = nullptr;
+                }
+
+                base_address = 0;
+                region_size = 0;
+                frame_count = 0;
+                offset = 0;
+
+                batch.clear();
+                build_infos.clear();
+                build_ranges.clear();
+
+                device = nullptr;
+            }
+
+            void scratch_allocator::begin_frame(index frame) {
+                current_frame = frame_count > 0 ? frame % frame_count : 0;
+                offset = 0;
+            }
+
+            VkDeviceAddress scratch_allocator::allocate(VkDeviceSize size) {
+                if (!scratch_buffer || size == 0)
+                    return 0;
+
+                const VkDeviceSize start = align_up(offset, alignment);
+                if (start + size > region_size)
+                    return 0;
+
+                offset = start + size;
+                return base_address + current_frame * region_size + start;
+            }
+
+            bool scratch_allocator::build(VkCommandBuffer cmd_buf, const bottom_level_acceleration_structure::list& structures) {
+                bool result = true;
+
+                for (const bottom_level_acceleration_structure::ptr& structure : structures) {
+                    const VkDeviceSize size = structure->scratch_buffer_size();
+                    if (size > region_size) {
+                        log()->error("scratch size {} of acceleration structure exceeds the region size {}", size, region_size);
+                        result = false;
+                        continue;
+                    }
+
+                    VkDeviceAddress scratch = allocate(size);
+                    if (!scratch) {
+                        // region is full, record what we have and wait for it before reusing the memory
+                        flush(cmd_buf);
+
+                        insert_build_barrier(device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+                                             VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+
+                        reset();
+                        scratch = allocate(size);
+                    }
+
+                    if (!structure->prepare_build(scratch)) {
+                        result = false;
+                        continue;
+                    }
+
+                    batch.push_back(structure.get());
+                }
+
+                flush(cmd_buf);
+
+                return result;
+            }
+
+            void scratch_allocator::flush(VkCommandBuffer cmd_buf) {
+                if (batch.empty())
+                    return;
+
+                build_infos.clear();
+                build_ranges.clear();
+                for (acceleration_structure* structure : batch) {
+                    build_infos.push_back(structure->get_build_info());
+                    build_ranges.push_back(structure->get_ranges().data());
+                }
+
+                device->call().vkCmdBuildAccelerationStructuresKHR(cmd_buf, uint32_t(build_infos.size()), build_infos.data(), build_ranges.data());
+
+                // one barrier for all compacted size queries
+                bool compaction = false;
+                for (acceleration_structure* structure : batch)
+                    compaction = compaction || (structure->get_build_info().flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
+
+                if (compaction)
+                    insert_build_barrier(device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+
+                for (acceleration_structure* structure : batch)
+                    structure->finish_build(cmd_buf, false);
+
+                batch.clear();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
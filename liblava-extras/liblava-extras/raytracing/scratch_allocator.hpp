@@ -0,0 +1,80 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+
+// hands out scratch memory for acceleration structure builds from a per-frame ring
+// each frame in flight owns one region of the buffer, begin_frame() reclaims it once that frame's fence signaled
+// builds with disjoint scratch ranges don't need barriers between them, build() records them in batches
+// the region size caps the memory: a batch that doesn't fit is split, with a barrier before the region is reused
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct scratch_allocator {
+                using ptr = std::shared_ptr<scratch_allocator>;
+
+                ~scratch_allocator() {
+                    destroy();
+                }
+
+                // region_size is the scratch memory available per frame, frame_count the number of frames in flight
+                bool create(device_p device, VkDeviceSize region_size, uint32_t frame_count = 1);
+                void destroy();
+
+                // call once per frame before allocating, with the index of the frame that's being recorded
+                // lava waits for the frame's fence before on_process, so the region can be reused
+                void begin_frame(index frame);
+
+                // aligned sub-range of the current region, 0 if there's not enough space left
+                VkDeviceAddress allocate(VkDeviceSize size);
+
+                // start handing out the current region from the beginning again
+                // only call this after a barrier that waits for all builds using it
+                void reset() {
+                    offset = 0;
+                }
+
+                // builds structures that weren't built yet and updates the others
+                // structures are batched into one vkCmdBuildAccelerationStructuresKHR call as long as their scratch fits into the region
+                // returns false if a structure couldn't be built, e.g. because its scratch size exceeds the region size
+                // insert a barrier after this before using the structures
+                bool build(VkCommandBuffer cmd_buf, const bottom_level_acceleration_structure::list& structures);
+
+                VkDeviceSize get_region_size() const {
+                    return region_size;
+                }
+
+                VkDeviceSize available() const {
+                    return region_size - std::min(region_size, align_up(offset, alignment));
+                }
+
+            private:
+                device_p device = nullptr;
+
+                buffer::ptr scratch_buffer;
+                // first region, aligned
+                VkDeviceAddress base_address = 0;
+
+                VkDeviceSize region_size = 0;
+                uint32_t frame_count = 0;
+                VkDeviceSize alignment = 1;
+
+                index current_frame = 0;
+                VkDeviceSize offset = 0;
+
+                // preallocated batch arrays for vkCmdBuildAccelerationStructuresKHR
+                std::vector<acceleration_structure*> batch;
+                std::vector<VkAccelerationStructureBuildGeometryInfoKHR> build_infos;
+                std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> build_ranges;
+
+                void flush(VkCommandBuffer cmd_buf);
+            };
+
+            inline scratch_allocator::ptr make_scratch_allocator() {
+                return std::make_shared<scratch_allocator>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
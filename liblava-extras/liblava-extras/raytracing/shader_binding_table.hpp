@@ -1,5 +1,6 @@
 #pragma once
 
+#include "liblava-extras/raytracing/deletion_queue.hpp"
 #include "liblava-extras/raytracing/pipeline.hpp"
 #include "liblava/resource/buffer.hpp"
 
@@ -130,11 +131,22 @@ namespace lava {
                 }
 
                 void destroy() {
-                    if (sbt_buffer)
-                        sbt_buffer->destroy();
+                    if (sbt_buffer) {
+                        // frames in flight might still trace with this table
+                        if (deletion)
+                            deletion->retire([buf = sbt_buffer]() { buf->destroy(); });
+                        else
+                            sbt_buffer->destroy();
+                        sbt_buffer = nullptr;
+                    }
                     device = nullptr;
                 }
 
+                // destroy() hands the buffer to the queue instead of freeing it right away
+                void set_deletion_queue(deletion_queue::ptr queue) {
+                    deletion = queue;
+                }
+
                 device_p get_device() {
                     return device;
                 }
@@ -143,6 +155,11 @@ namespace lava {
                     return sbt_buffer && sbt_buffer->valid();
                 }
 
+                // device memory of the table including alignment padding
+                VkDeviceSize get_size() const {
+                    return sbt_buffer ? sbt_buffer->get_size() : 0;
+                }
+
                 // miss/hit/callable shader can be chosen in traceRayEXT calls inside shaders with a parameter
                 // vkCmdTraceRaysKHR has no parameter to choose a raygen shader other than the one
                 // at the address provided, so adjust that address
@@ -168,6 +185,7 @@ namespace lava {
             private:
                 device_p device = nullptr;
                 buffer::ptr sbt_buffer;
+                deletion_queue::ptr deletion;
 
                 enum group_type : size_t {
                     raygen = 0,
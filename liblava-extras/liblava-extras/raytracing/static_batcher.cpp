@@ -0,0 +1,99 @@
+#include "liblava-extras/raytracing/static_batcher.hpp"
+#include <tuple>
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            index static_batcher::add(const VkAccelerationStructureGeometryTrianglesDataKHR& triangles, const VkAccelerationStructureBuildRangeInfoKHR& range,
+                                      const glm::mat4x3& transform, const glm::vec3& bounds_min, const glm::vec3& bounds_max, VkGeometryFlagsKHR flags) {
+                const glm::vec3 center = transform * glm::vec4((bounds_min + bounds_max) * 0.5f, 1.0f);
+                meshes.push_back({ .triangles = triangles, .range = range, .flags = flags, .transform = transform, .center = center });
+                return index(meshes.size() - 1);
+            }
+
+            bool static_batcher::create(device_p device, float cell_size, size_t max_geometries, VkBuildAccelerationStructureFlagsKHR flags) {
+                if (meshes.empty() || cell_size <= 0.0f || max_geometries == 0)
+                    return false;
+
+                // the cluster lists and the transform buffer are rebuilt from scratch
+                destroy();
+
+                // VkTransformMatrixKHR is row-major, transformOffset needs 16 byte alignment which 48 bytes satisfy
+                std::vector<VkTransformMatrixKHR> transforms(meshes.size());
+                for (size_t i = 0; i < meshes.size(); i++) {
+                    const glm::mat3x4 transposed = glm::transpose(meshes[i].transform);
+                    transforms[i] = *reinterpret_cast<const VkTransformMatrixKHR*>(glm::value_ptr(transposed));
+                }
+
+                transform_buffer = buffer::make();
+                if (!transform_buffer->create_mapped(device, transforms.data(), sizeof(VkTransformMatrixKHR) * transforms.size(),
+                                                     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR))
+                    return false;
+
+                // std::map keeps the cluster order deterministic
+                std::map<std::tuple<int32_t, int32_t, int32_t>, std::vector<index>> cells;
+                for (size_t i = 0; i < meshes.size(); i++) {
+                    const glm::vec3 cell = glm::floor(meshes[i].center / cell_size);
+                    cells[{ int32_t(cell.x), int32_t(cell.y), int32_t(cell.z) }].push_back(index(i));
+                }
+
+                remap.resize(meshes.size());
+
+                for (const auto& cell : cells) {
+                    const std::vector<index>& cell_meshes = cell.second;
+                    for (size_t first = 0; first < cell_meshes.size(); first += max_geometries) {
+                        const size_t count = std::min(max_geometries, cell_meshes.size() - first);
+
+                        bottom_level_acceleration_structure::ptr blas = make_bottom_level_acceleration_structure();
+                        std::vector<index> geometry_meshes;
+
+                        for (size_t g = 0; g < count; g++) {
+                            const index mesh_id = cell_meshes[first + g];
+                            const mesh& m = meshes[mesh_id];
+
+                            VkAccelerationStructureGeometryTrianglesDataKHR triangles = m.triangles;
+                            triangles.transformData.deviceAddress = transform_buffer->get_address();
+                            VkAccelerationStructureBuildRangeInfoKHR range = m.range;
+                            range.transformOffset = uint32_t(sizeof(VkTransformMatrixKHR) * mesh_id);
+
+                            blas->add_geometry(triangles, range, m.flags);
+                            geometry_meshes.push_back(mesh_id);
+                            remap[mesh_id] = { .instance = index(clusters.size()), .geometry = index(g) };
+                        }
+
+                        if (!blas->create(device, flags)) {
+                            destroy();
+                            return false;
+                        }
+
+                        clusters.push_back(blas);
+                        cluster_meshes.push_back(std::move(geometry_meshes));
+                    }
+                }
+
+                return true;
+            }
+
+            void static_batcher::destroy() {
+                clusters.clear();
+                cluster_meshes.clear();
+                remap.clear();
+
+                if (transform_buffer) {
+                    transform_buffer->destroy();
+                    transform_buffer = nullptr;
+                }
+            }
+
+            index static_batcher::add_instances(top_level_acceleration_structure& tlas, const uint32_t* custom_indices) const {
+                const index first = index(tlas.get_instances().size());
+                // add_instance() uses the identity transform
+                for (size_t i = 0; i < clusters.size(); i++)
+                    tlas.add_instance(clusters[i], custom_indices ? custom_indices[i] : 0);
+                return first;
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
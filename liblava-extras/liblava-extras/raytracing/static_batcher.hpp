@@ -0,0 +1,93 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+
+// merges small static meshes into shared multi-geometry BLAS to keep the TLAS small
+// meshes are clustered on a grid by the center of their bounds, each cluster becomes one BLAS with one geometry per mesh
+// the mesh transforms are baked into the geometries through a transform buffer, so the vertex data stays untouched
+// and the cluster instances use the identity transform
+// because of that, object space in hit shaders is the space of the untransformed vertex data of each mesh,
+// so vertices read through a geometry_table are NOT in world space: transform them with get_transform() of the mesh,
+// gl_ObjectToWorldEXT is the identity
+// get_location() maps a mesh id to its instance and gl_GeometryIndexEXT in the merged structures
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct static_batcher {
+                using ptr = std::shared_ptr<static_batcher>;
+
+                struct location {
+                    index instance = 0; // cluster index, relative to the first instance returned by add_instances()
+                    index geometry = 0;
+                };
+
+                ~static_batcher() {
+                    destroy();
+                }
+
+                // bounds are in object space, returns the mesh id
+                // transformData of triangles is overwritten by create()
+                index add(const VkAccelerationStructureGeometryTrianglesDataKHR& triangles, const VkAccelerationStructureBuildRangeInfoKHR& range,
+                          const glm::mat4x3& transform, const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+                          VkGeometryFlagsKHR flags = VK_GEOMETRY_OPAQUE_BIT_KHR);
+
+                // clusters all added meshes and creates the merged structures, build them with get_blas() afterwards
+                // clusters with more than max_geometries meshes are split
+                // calling this again replaces the structures of the previous call
+                bool create(device_p device, float cell_size, size_t max_geometries = 64,
+                            VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+                void destroy();
+
+                // adds one instance per cluster, custom_indices is either nullptr or has one value per cluster
+                // returns the index of the first added instance
+                index add_instances(top_level_acceleration_structure& tlas, const uint32_t* custom_indices = nullptr) const;
+
+                bottom_level_acceleration_structure::list const& get_blas() const {
+                    return clusters;
+                }
+
+                location get_location(index mesh) const {
+                    return mesh < remap.size() ? remap[mesh] : location{};
+                }
+
+                // mesh ids of the cluster in geometry order
+                std::vector<index> const& get_meshes(index cluster) const {
+                    return cluster_meshes[cluster];
+                }
+
+                size_t get_mesh_count() const {
+                    return meshes.size();
+                }
+
+                // object to world transform baked into the mesh's geometry, e.g. to upload for hit shaders
+                glm::mat4x3 const& get_transform(index mesh) const {
+                    return meshes[mesh].transform;
+                }
+
+            private:
+                struct mesh {
+                    VkAccelerationStructureGeometryTrianglesDataKHR triangles;
+                    VkAccelerationStructureBuildRangeInfoKHR range;
+                    VkGeometryFlagsKHR flags = 0;
+                    glm::mat4x3 transform;
+                    glm::vec3 center;
+                };
+
+                std::vector<mesh> meshes;
+
+                buffer::ptr transform_buffer;
+
+                bottom_level_acceleration_structure::list clusters;
+                std::vector<std::vector<index>> cluster_meshes;
+                std::vector<location> remap;
+            };
+
+            inline static_batcher::ptr make_static_batcher() {
+                return std::make_shared<static_batcher>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,260 @@
+#include "liblava-extras/raytracing/structure_heap.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            namespace {
+
+                // required for VkAccelerationStructureCreateInfoKHR::offset
+                constexpr VkDeviceSize structure_alignment = 256;
+
+            } // namespace
+
+            bool structure_heap::create(device_p dev, VkDeviceSize size, VkDeviceSize budget) {
+                if (size == 0)
+                    return false;
+
+                device = dev;
+                block_size = align_up(size, structure_alignment);
+                frame_budget = budget;
+
+                return true;
+            }
+
+            void structure_heap::destroy() {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                for (const std::unique_ptr<block>& b : blocks)
+                    b->memory->destroy();
+                blocks.clear();
+
+                structures.clear();
+                device = nullptr;
+            }
+
+            void structure_heap::add(bottom_level_acceleration_structure::ptr blas) {
+                if (!blas)
+                    return;
+
+                blas->set_memory(shared_from_this());
+
+                std::lock_guard<std::mutex> lock(mutex);
+                structures.push_back(blas);
+            }
+
+            uint32_t structure_heap::defragment(VkCommandBuffer cmd_buf, top_level_acceleration_structure& tlas) {
+                if (!device)
+                    return 0;
+
+                std::vector<bottom_level_acceleration_structure::ptr> moves;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    select_evacuations();
+
+                    std::erase_if(structures, [](const std::weak_ptr<bottom_level_acceleration_structure>& s) {
+                        return s.expired();
+                    });
+
+                    // at least one structure per call, even if it's larger than the budget
+                    VkDeviceSize bytes = 0;
+                    for (const std::weak_ptr<bottom_level_acceleration_structure>& weak : structures) {
+                        bottom_level_acceleration_structure::ptr structure = weak.lock();
+                        if (!structure || !structure->is_built())
+                            continue;
+
+                        const block* b = find_block(structure->get_buffer());
+                        if (!b || !b->evacuating)
+                            continue;
+
+                        if (!moves.empty() && bytes + structure->get_size() > frame_budget)
+                            break;
+
+                        bytes += structure->get_size();
+                        moves.push_back(structure);
+                    }
+                }
+
+                if (moves.empty())
+                    return 0;
+
+                // the clone source has to be built, relocate() allocates and frees through this heap so the lock isn't held
+                insert_build_barrier(device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+
+                std::unordered_map<VkDeviceAddress, VkDeviceAddress> relocated;
+                for (const bottom_level_acceleration_structure::ptr& structure : moves) {
+                    const VkDeviceAddress old_address = structure->get_address();
+                    if (structure->relocate(cmd_buf))
+                        relocated[old_address] = structure->get_address();
+                }
+
+                if (relocated.empty())
+                    return 0;
+
+                // the TLAS build reads the copies
+                insert_build_barrier(device, cmd_buf, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                                     VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR);
+
+                uint32_t patched = 0;
+                const std::vector<VkAccelerationStructureInstanceKHR>& instances = tlas.get_instances();
+                for (size_t i = 0; i < instances.size(); i++) {
+                    const auto it = relocated.find(instances[i].accelerationStructureReference);
+                    if (it == relocated.end())
+                        continue;
+
+                    VkAccelerationStructureInstanceKHR instance = instances[i];
+                    instance.accelerationStructureReference = it->second;
+                    tlas.update_instance(i, instance);
+                    patched++;
+                }
+
+                return patched;
+            }
+
+            structure_heap::stats structure_heap::get_stats() const {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                stats result;
+                for (const std::unique_ptr<block>& b : blocks) {
+                    result.block_count++;
+                    result.allocated += b->size;
+                    result.used += b->used;
+                    if (b->evacuating)
+                        result.evacuating_count++;
+                }
+                return result;
+            }
+
+            bool structure_heap::allocate(VkDeviceSize size, buffer::ptr& buffer, VkDeviceSize& offset) {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (!device)
+                    return false;
+
+                size = align_up(size, structure_alignment);
+
+                // first fit in the fullest block, which keeps the others sparse enough to be evacuated
+                block* target = nullptr;
+                std::map<VkDeviceSize, VkDeviceSize>::iterator target_range;
+                for (const std::unique_ptr<block>& b : blocks) {
+                    if (b->evacuating || (target && b->used <= target->used))
+                        continue;
+
+                    const auto range = std::find_if(b->free_ranges.begin(), b->free_ranges.end(), [size](const auto& free_range) {
+                        return free_range.second >= size;
+                    });
+                    if (range != b->free_ranges.end()) {
+                        target = b.get();
+                        target_range = range;
+                    }
+                }
+
+                if (!target) {
+                    std::unique_ptr<block> new_block = std::make_unique<block>();
+                    new_block->size = std::max(block_size, size);
+                    new_block->memory = buffer::make();
+                    if (!new_block->memory->create(device, nullptr, new_block->size,
+                                                   VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                                   false, VMA_MEMORY_USAGE_GPU_ONLY)) {
+                        log()->error("structure_heap failed to allocate a block of {} bytes", new_block->size);
+                        return false;
+                    }
+                    new_block->free_ranges[0] = new_block->size;
+
+                    target = new_block.get();
+                    target_range = target->free_ranges.begin();
+                    blocks.push_back(std::move(new_block));
+                }
+
+                offset = target_range->first;
+                const VkDeviceSize remaining = target_range->second - size;
+                target->free_ranges.erase(target_range);
+                if (remaining > 0)
+                    target->free_ranges[offset + size] = remaining;
+
+                target->used += size;
+                buffer = target->memory;
+                return true;
+            }
+
+            void structure_heap::free(const buffer::ptr& buffer, VkDeviceSize offset, VkDeviceSize size) {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                // blocks are gone after destroy()
+                block* b = find_block(buffer);
+                if (!b)
+                    return;
+
+                size = align_up(size, structure_alignment);
+                b->used -= std::min(b->used, size);
+
+                auto range = b->free_ranges.emplace(offset, size).first;
+                const auto next = std::next(range);
+                if (next != b->free_ranges.end() && range->first + range->second == next->first) {
+                    range->second += next->second;
+                    b->free_ranges.erase(next);
+                }
+                if (range != b->free_ranges.begin()) {
+                    const auto previous = std::prev(range);
+                    if (previous->first + previous->second == range->first) {
+                        previous->second += range->second;
+                        b->free_ranges.erase(range);
+                    }
+                }
+
+                if (b->used > 0)
+                    return;
+
+                // one empty block stays around for the next allocations, evacuating blocks are never reused
+                const bool has_spare = std::any_of(blocks.begin(), blocks.end(), [b](const std::unique_ptr<block>& other) {
+                    return other.get() != b && !other->evacuating && other->used == 0;
+                });
+                if (b->evacuating || has_spare) {
+                    b->memory->destroy();
+                    std::erase_if(blocks, [b](const std::unique_ptr<block>& other) {
+                        return other.get() == b;
+                    });
+                }
+            }
+
+            structure_heap::block* structure_heap::find_block(const buffer::ptr& buffer) {
+                for (const std::unique_ptr<block>& b : blocks) {
+                    if (b->memory == buffer)
+                        return b.get();
+                }
+                return nullptr;
+            }
+
+            void structure_heap::select_evacuations() {
+                // free space the structures of evacuated blocks can move to
+                VkDeviceSize available = 0;
+                std::vector<block*> sparse;
+                for (const std::unique_ptr<block>& b : blocks) {
+                    if (b->evacuating)
+                        continue;
+                    available += b->size - b->used;
+                    if (b->used > 0 && float(b->used) < float(b->size) * sparse_threshold)
+                        sparse.push_back(b.get());
+                }
+
+                std::sort(sparse.begin(), sparse.end(), [](const block* a, const block* b) {
+                    return float(a->used) / float(a->size) < float(b->used) / float(b->size);
+                });
+
+                // only if the others have room, evacuating into a new block would just move the holes
+                for (block* b : sparse) {
+                    const VkDeviceSize elsewhere = available - (b->size - b->used);
+                    if (elsewhere < b->used)
+                        continue;
+                    b->evacuating = true;
+                    available = elsewhere - b->used;
+                }
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "liblava-extras/raytracing/acceleration_structure.hpp"
+#include <mutex>
+
+// suballocates acceleration structures from large device memory blocks and defragments them online
+// streaming, rebuilds and compaction leave holes in the blocks over time, defragment() picks the sparsest blocks,
+// clones their live BLAS into the fullest blocks a few per frame and patches the TLAS instances referencing them
+// evacuated blocks are freed once the deletion queue released their last structure, so memory stops growing in long sessions
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct structure_heap : structure_memory, std::enable_shared_from_this<structure_heap> {
+                using ptr = std::shared_ptr<structure_heap>;
+
+                struct stats {
+                    uint32_t block_count = 0;
+                    // device memory of all blocks
+                    VkDeviceSize allocated = 0;
+                    // bytes of live structures, including structures waiting in the deletion queue
+                    VkDeviceSize used = 0;
+                    // blocks that are being emptied
+                    uint32_t evacuating_count = 0;
+                };
+
+                ~structure_heap() {
+                    destroy();
+                }
+
+                // block_size is the size of new blocks, larger structures get a block of their own
+                // frame_budget is the number of bytes defragment() copies per call
+                bool create(device_p device, VkDeviceSize block_size = 64 * 1024 * 1024, VkDeviceSize frame_budget = 4 * 1024 * 1024);
+                // only call this when the device is idle and the deletion queue was flushed
+                void destroy();
+
+                // places the BLAS in the heap and lets defragment() move it, call before its create()
+                // compacted copies are placed in the heap as well, add them to have them defragmented
+                void add(bottom_level_acceleration_structure::ptr blas);
+
+                // records clone copies out of sparse blocks, call once per frame after the BLAS builds and before the TLAS build
+                // the TLAS instances are patched with the new addresses, returns their number so the TLAS can be updated
+                uint32_t defragment(VkCommandBuffer cmd_buf, top_level_acceleration_structure& tlas);
+
+                // blocks below this fraction of live bytes are evacuated, default 0.5
+                void set_sparse_threshold(float threshold) {
+                    sparse_threshold = threshold;
+                }
+
+                void set_frame_budget(VkDeviceSize bytes) {
+                    frame_budget = bytes;
+                }
+
+                stats get_stats() const;
+
+                bool allocate(VkDeviceSize size, buffer::ptr& buffer, VkDeviceSize& offset) override;
+                void free(const buffer::ptr& buffer, VkDeviceSize offset, VkDeviceSize size) override;
+
+            private:
+                struct block {
+                    buffer::ptr memory;
+                    VkDeviceSize size = 0;
+                    VkDeviceSize used = 0;
+                    // offset -> size, neighbors are merged
+                    std::map<VkDeviceSize, VkDeviceSize> free_ranges;
+                    // no new allocations, freed once empty
+                    bool evacuating = false;
+                };
+
+                device_p device = nullptr;
+                VkDeviceSize block_size = 0;
+                VkDeviceSize frame_budget = 0;
+                float sparse_threshold = 0.5f;
+
+                // allocate() and free() can be called from the deletion queue or while recording on other threads
+                mutable std::mutex mutex;
+                std::vector<std::unique_ptr<block>> blocks;
+
+                std::vector<std::weak_ptr<bottom_level_acceleration_structure>> structures;
+
+                block* find_block(const buffer::ptr& buffer);
+                // marks the sparsest blocks whose structures fit into the free space of the others
+                void select_evacuations();
+            };
+
+            inline structure_heap::ptr make_structure_heap() {
+                return std::make_shared<structure_heap>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,198 @@
+#include "liblava-extras/raytracing/tiled_tracer.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+#include <chrono>
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool tiled_tracer::create(device_p dev, queue::ref queue, VkFormat format, uint32_t texel_size, glm::uvec2 size, uint32_t batch_size) {
+                if (texel_size == 0 || size.x == 0 || size.y == 0 || batch_size == 0)
+                    return false;
+
+                device = dev;
+                vk_queue = queue.vk_queue;
+                pixel_size = texel_size;
+                tile_size = size;
+                max_batch_size = batch_size;
+
+                const VkCommandPoolCreateInfo pool_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                                                            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                                                            .queueFamilyIndex = queue.family };
+                if (!check(device->call().vkCreateCommandPool(device->get(), &pool_info, memory::instance().alloc(), &pool)))
+                    return false;
+
+                const VkCommandBufferAllocateInfo alloc_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                                                 .commandPool = pool,
+                                                                 .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                                                 .commandBufferCount = 1 };
+                if (!check(device->call().vkAllocateCommandBuffers(device->get(), &alloc_info, &cmd_buf)))
+                    return false;
+
+                const VkFenceCreateInfo fence_info = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+                if (!check(device->call().vkCreateFence(device->get(), &fence_info, memory::instance().alloc(), &fence)))
+                    return false;
+
+                tile_image = image::make(format);
+                tile_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+                tile_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+                tile_image->set_aspect_mask(format_aspect_mask(format));
+                tile_image->set_layer_count(max_batch_size);
+                tile_image->set_view_type(VK_IMAGE_VIEW_TYPE_2D_ARRAY);
+                if (!tile_image->create(device, tile_size))
+                    return false;
+
+                readback_buffer = buffer::make();
+                if (!readback_buffer->create_mapped(device, nullptr, size_t(tile_size.x) * tile_size.y * pixel_size * max_batch_size,
+                                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU))
+                    return false;
+
+                return true;
+            }
+
+            void tiled_tracer::destroy() {
+                if (tile_image) {
+                    tile_image->destroy();
+                    tile_image = nullptr;
+                }
+
+                if (readback_buffer) {
+                    readback_buffer->destroy();
+                    readback_buffer = nullptr;
+                }
+
+                if (fence != VK_NULL_HANDLE) {
+                    device->call().vkDestroyFence(device->get(), fence, memory::instance().alloc());
+                    fence = VK_NULL_HANDLE;
+                }
+
+                // destroying the pool frees its command buffer
+                if (pool != VK_NULL_HANDLE) {
+                    device->call().vkDestroyCommandPool(device->get(), pool, memory::instance().alloc());
+                    pool = VK_NULL_HANDLE;
+                    cmd_buf = VK_NULL_HANDLE;
+                }
+
+                vk_queue = VK_NULL_HANDLE;
+                device = nullptr;
+            }
+
+            bool tiled_tracer::render(glm::uvec2 image_size, const shader_binding_table& sbt, VkPipelineLayout layout, uint32_t push_constant_offset,
+                                      const bind_func& bind, const tile_func& on_tile) {
+                if (!tile_image || image_size.x == 0 || image_size.y == 0)
+                    return false;
+
+                std::vector<tile> tiles;
+                for (uint32_t y = 0; y < image_size.y; y += tile_size.y) {
+                    for (uint32_t x = 0; x < image_size.x; x += tile_size.x) {
+                        tiles.push_back({ .offset = { x, y },
+                                          .size = { std::min(tile_size.x, image_size.x - x), std::min(tile_size.y, image_size.y - y) } });
+                    }
+                }
+
+                // start with a single tile and size the following batches from its duration
+                uint32_t batch_size = 1;
+                bool first_use = true;
+
+                for (size_t first = 0; first < tiles.size();) {
+                    const size_t count = std::min<size_t>(batch_size, tiles.size() - first);
+                    const std::vector<tile> batch(tiles.begin() + first, tiles.begin() + first + count);
+
+                    if (!record_batch(batch, image_size, sbt, layout, push_constant_offset, bind, first_use))
+                        return false;
+                    first_use = false;
+
+                    const auto start = std::chrono::steady_clock::now();
+
+                    const VkSubmitInfo submit_info = { .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                                                       .commandBufferCount = 1,
+                                                       .pCommandBuffers = &cmd_buf };
+                    if (!check(device->call().vkQueueSubmit(vk_queue, 1, &submit_info, fence)))
+                        return false;
+                    if (!check(device->call().vkWaitForFences(device->get(), 1, &fence, VK_TRUE, UINT64_MAX)))
+                        return false;
+                    if (!check(device->call().vkResetFences(device->get(), 1, &fence)))
+                        return false;
+
+                    const float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+                    const float per_tile = std::max(milliseconds / float(count), 0.001f);
+                    batch_size = std::clamp(uint32_t(time_budget / per_tile), 1u, max_batch_size);
+
+                    // GPU_TO_CPU memory is usually host-cached and doesn't have to be coherent
+                    const size_t layer_size = size_t(tile_size.x) * tile_size.y * pixel_size;
+                    if (!check(vmaInvalidateAllocation(device->alloc(), readback_buffer->get_allocation(), 0, layer_size * count)))
+                        return false;
+
+                    const uint8_t* data = static_cast<const uint8_t*>(readback_buffer->get_mapped_data());
+                    for (size_t i = 0; i < count; i++)
+                        on_tile(batch[i], data + i * layer_size, size_t(batch[i].size.x) * pixel_size);
+
+                    first += count;
+                }
+
+                return true;
+            }
+
+            bool tiled_tracer::render(glm::uvec2 image_size, const shader_binding_table& sbt, VkPipelineLayout layout, uint32_t push_constant_offset,
+                                      const bind_func& bind, void* output, size_t row_pitch) {
+                uint8_t* output_data = static_cast<uint8_t*>(output);
+                return render(image_size, sbt, layout, push_constant_offset, bind, [&](const tile& t, const uint8_t* data, size_t tile_pitch) {
+                    for (uint32_t y = 0; y < t.size.y; y++)
+                        memcpy(output_data + (t.offset.y + y) * row_pitch + size_t(t.offset.x) * pixel_size, data + y * tile_pitch, tile_pitch);
+                });
+            }
+
+            bool tiled_tracer::record_batch(const std::vector<tile>& tiles, glm::uvec2 image_size, const shader_binding_table& sbt, VkPipelineLayout layout,
+                                            uint32_t push_constant_offset, const bind_func& bind, bool first_use) {
+                const VkCommandBufferBeginInfo begin_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                                                              .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT };
+                if (!check(device->call().vkBeginCommandBuffer(cmd_buf, &begin_info)))
+                    return false;
+
+                // the last batch's copies must finish before the layers are overwritten
+                insert_image_memory_barrier(device, cmd_buf, tile_image->get(), first_use ? 0 : VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                                            first_use ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                            first_use ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                            tile_image->get_subresource_range());
+
+                bind(cmd_buf);
+
+                const VkStridedDeviceAddressRegionKHR raygen = sbt.get_raygen_region();
+                for (size_t i = 0; i < tiles.size(); i++) {
+                    const push_constants constants = { .offset = tiles[i].offset, .image_size = image_size, .layer = uint32_t(i) };
+                    device->call().vkCmdPushConstants(cmd_buf, layout, push_constant_stages, push_constant_offset, sizeof(constants), &constants);
+                    device->call().vkCmdTraceRaysKHR(
+                        cmd_buf,
+                        &raygen, &sbt.get_miss_region(), &sbt.get_hit_region(), &sbt.get_callable_region(),
+                        tiles[i].size.x, tiles[i].size.y, 1);
+                }
+
+                insert_image_memory_barrier(device, cmd_buf, tile_image->get(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                                            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                            VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                            tile_image->get_subresource_range());
+
+                // tightly packed rows, only the traced part of each layer
+                const VkDeviceSize layer_size = VkDeviceSize(tile_size.x) * tile_size.y * pixel_size;
+                std::vector<VkBufferImageCopy> regions;
+                for (size_t i = 0; i < tiles.size(); i++) {
+                    regions.push_back({ .bufferOffset = i * layer_size,
+                                        .bufferRowLength = tiles[i].size.x,
+                                        .bufferImageHeight = tiles[i].size.y,
+                                        .imageSubresource = { .aspectMask = tile_image->get_subresource_range().aspectMask,
+                                                              .mipLevel = 0,
+                                                              .baseArrayLayer = uint32_t(i),
+                                                              .layerCount = 1 },
+                                        .imageOffset = { 0, 0, 0 },
+                                        .imageExtent = { tiles[i].size.x, tiles[i].size.y, 1 } });
+                }
+                device->call().vkCmdCopyImageToBuffer(cmd_buf, tile_image->get(), VK_IMAGE_LAYOUT_GENERAL, readback_buffer->get(), uint32_t(regions.size()), regions.data());
+
+                insert_memory_barrier(device, cmd_buf, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+
+                return check(device->call().vkEndCommandBuffer(cmd_buf));
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
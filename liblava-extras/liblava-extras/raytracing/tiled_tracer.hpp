@@ -0,0 +1,100 @@
+#pragma once
+
+#include "liblava-extras/raytracing/shader_binding_table.hpp"
+#include "liblava/resource/image.hpp"
+
+// traces images too large for one dispatch (driver timeouts, output memory) in tiles
+// each tile is traced into its own layer of a small array image and copied back to the host once its batch finished,
+// so device memory only depends on the tile size and batch size
+// batches grow or shrink to fit the time budget, measured from previous batches
+// raygen shaders get the tile position through push constants, see res/raytracing/tiled_trace.glsl
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct tiled_tracer {
+                using ptr = std::shared_ptr<tiled_tracer>;
+
+                // raygen push constants, add a range of this size to the pipeline layout
+                struct push_constants {
+                    glm::uvec2 offset; // of the tile in the full image
+                    glm::uvec2 image_size; // use instead of gl_LaunchSizeEXT
+                    uint32_t layer; // write to gl_LaunchIDEXT.xy of this layer
+                };
+
+                struct tile {
+                    glm::uvec2 offset;
+                    glm::uvec2 size; // smaller than the tile size at the right and bottom edge
+                };
+
+                // called once per tile with the host copy of its pixels
+                using tile_func = std::function<void(const tile& tile, const uint8_t* data, size_t row_pitch)>;
+                // binds the pipeline and descriptor sets, called at the start of each batch
+                using bind_func = std::function<void(VkCommandBuffer cmd_buf)>;
+
+                ~tiled_tracer() {
+                    destroy();
+                }
+
+                // pixel_size is the size of one texel of format in bytes
+                // up to max_batch_size tiles are traced per submission, each needs its own layer and readback memory
+                bool create(device_p device, queue::ref queue, VkFormat format, uint32_t pixel_size, glm::uvec2 tile_size, uint32_t max_batch_size = 4);
+                void destroy();
+
+                // batches are sized to take about this long on the GPU, keep it well below the driver timeout
+                void set_time_budget(float milliseconds) {
+                    time_budget = milliseconds;
+                }
+
+                // stages of the layout's push constant range containing the tile constants, vkCmdPushConstants has to name all of them
+                void set_push_constant_stages(VkShaderStageFlags stages) {
+                    push_constant_stages = stages;
+                }
+
+                // traces all tiles and blocks until they're read back
+                bool render(glm::uvec2 image_size, const shader_binding_table& sbt, VkPipelineLayout layout, uint32_t push_constant_offset,
+                            const bind_func& bind, const tile_func& on_tile);
+
+                // copies the tiles into a host image with the given row pitch, e.g. a memory-mapped output file
+                bool render(glm::uvec2 image_size, const shader_binding_table& sbt, VkPipelineLayout layout, uint32_t push_constant_offset,
+                            const bind_func& bind, void* output, size_t row_pitch);
+
+                // bind as storage image2DArray
+                image::ptr get_image() const {
+                    return tile_image;
+                }
+
+                glm::uvec2 get_tile_size() const {
+                    return tile_size;
+                }
+
+            private:
+                device_p device = nullptr;
+                VkQueue vk_queue = VK_NULL_HANDLE;
+
+                VkCommandPool pool = VK_NULL_HANDLE;
+                VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+                VkFence fence = VK_NULL_HANDLE;
+
+                image::ptr tile_image;
+                buffer::ptr readback_buffer;
+
+                glm::uvec2 tile_size = { 0, 0 };
+                uint32_t pixel_size = 0;
+                uint32_t max_batch_size = 0;
+
+                float time_budget = 100.0f;
+                VkShaderStageFlags push_constant_stages = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
+
+                bool record_batch(const std::vector<tile>& tiles, glm::uvec2 image_size, const shader_binding_table& sbt, VkPipelineLayout layout,
+                                  uint32_t push_constant_offset, const bind_func& bind, bool first_use);
+            };
+
+            inline tiled_tracer::ptr make_tiled_tracer() {
+                return std::make_shared<tiled_tracer>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
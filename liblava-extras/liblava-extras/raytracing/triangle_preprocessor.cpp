@@ -0,0 +1,169 @@
+#include "liblava-extras/raytracing/triangle_preprocessor.hpp"
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            namespace {
+
+                // spreads the lower 10 bits so there are two zero bits between each
+                uint32_t expand_bits(uint32_t v) {
+                    v = (v * 0x00010001u) & 0xFF0000FFu;
+                    v = (v * 0x00000101u) & 0x0F00F00Fu;
+                    v = (v * 0x00000011u) & 0xC30C30C3u;
+                    v = (v * 0x00000005u) & 0x49249249u;
+                    return v;
+                }
+
+                // 30-bit Morton code of a point in [0, 1]
+                uint32_t morton_code(const glm::vec3& p) {
+                    const glm::vec3 scaled = glm::clamp(p * 1024.0f, 0.0f, 1023.0f);
+                    return (expand_bits(uint32_t(scaled.x)) << 2) | (expand_bits(uint32_t(scaled.y)) << 1) | expand_bits(uint32_t(scaled.z));
+                }
+
+                float triangle_area(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+                    return 0.5f * glm::length(glm::cross(b - a, c - a));
+                }
+
+                float half_box_area(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+                    const glm::vec3 extent = glm::max(glm::max(a, b), c) - glm::min(glm::min(a, b), c);
+                    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+                }
+
+                vertex midpoint(const vertex& a, const vertex& b) {
+                    vertex v;
+                    v.position = (a.position + b.position) * 0.5f;
+                    v.color = (a.color + b.color) * 0.5f;
+                    v.uv = (a.uv + b.uv) * 0.5f;
+                    const glm::vec3 normal = a.normal + b.normal;
+                    v.normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : a.normal;
+                    return v;
+                }
+
+            } // namespace
+
+            void triangle_preprocessor::process(mesh_data& mesh) {
+                const size_t triangle_count = mesh.indices.size() / 3;
+                primitive_remap.resize(triangle_count);
+                std::iota(primitive_remap.begin(), primitive_remap.end(), 0);
+                split_count = 0;
+
+                if (triangle_count == 0)
+                    return;
+
+                if (split_max_growth > 0.0f)
+                    split(mesh);
+                if (reorder)
+                    sort(mesh);
+            }
+
+            void triangle_preprocessor::split(mesh_data& mesh) {
+                const size_t budget = size_t(float(mesh.indices.size() / 3) * split_max_growth);
+
+                // shared edges get the same midpoint vertex
+                std::unordered_map<uint64_t, index> midpoints;
+                auto get_midpoint = [&](index a, index b) {
+                    const uint64_t key = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+                    auto it = midpoints.find(key);
+                    if (it != midpoints.end())
+                        return it->second;
+                    mesh.vertices.push_back(midpoint(mesh.vertices[a], mesh.vertices[b]));
+                    const index m = index(mesh.vertices.size() - 1);
+                    midpoints[key] = m;
+                    return m;
+                };
+
+                // new triangles are appended and checked again, so thin triangles can be split several times
+                size_t t = 0;
+                while (t < mesh.indices.size() / 3 && split_count < budget) {
+                    index* tri = &mesh.indices[t * 3];
+                    const glm::vec3 p[3] = { mesh.vertices[tri[0]].position, mesh.vertices[tri[1]].position, mesh.vertices[tri[2]].position };
+
+                    const float area = triangle_area(p[0], p[1], p[2]);
+                    if (area <= 0.0f || half_box_area(p[0], p[1], p[2]) <= split_threshold * area) {
+                        t++;
+                        continue;
+                    }
+
+                    // longest edge from e to e + 1
+                    size_t e = 0;
+                    float longest = 0.0f;
+                    for (size_t i = 0; i < 3; i++) {
+                        const float length = glm::distance(p[i], p[(i + 1) % 3]);
+                        if (length > longest) {
+                            longest = length;
+                            e = i;
+                        }
+                    }
+
+                    const index a = tri[e];
+                    const index b = tri[(e + 1) % 3];
+                    const index c = tri[(e + 2) % 3];
+                    const index m = get_midpoint(a, b);
+
+                    // keeps the winding: (a, b, c) becomes (a, m, c) and (m, b, c)
+                    tri[0] = a;
+                    tri[1] = m;
+                    tri[2] = c;
+                    mesh.indices.insert(mesh.indices.end(), { m, b, c });
+                    primitive_remap.push_back(primitive_remap[t]);
+
+                    // t is checked again with its new shape
+                    split_count++;
+                }
+            }
+
+            void triangle_preprocessor::sort(mesh_data& mesh) {
+                const size_t triangle_count = mesh.indices.size() / 3;
+
+                glm::vec3 bounds_min = mesh.vertices[mesh.indices[0]].position;
+                glm::vec3 bounds_max = bounds_min;
+                for (index i : mesh.indices) {
+                    bounds_min = glm::min(bounds_min, mesh.vertices[i].position);
+                    bounds_max = glm::max(bounds_max, mesh.vertices[i].position);
+                }
+                const glm::vec3 extent = glm::max(bounds_max - bounds_min, glm::vec3(1e-6f));
+
+                std::vector<uint32_t> codes(triangle_count);
+                for (size_t t = 0; t < triangle_count; t++) {
+                    const glm::vec3 centroid = (mesh.vertices[mesh.indices[t * 3]].position + mesh.vertices[mesh.indices[t * 3 + 1]].position + mesh.vertices[mesh.indices[t * 3 + 2]].position) / 3.0f;
+                    codes[t] = morton_code((centroid - bounds_min) / extent);
+                }
+
+                std::vector<uint32_t> order(triangle_count);
+                std::iota(order.begin(), order.end(), 0);
+                std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+
+                // renumber vertices by first use in the new triangle order, unreferenced vertices are dropped
+                const index unused = ~index(0);
+                std::vector<index> vertex_remap(mesh.vertices.size(), unused);
+                vertex::list vertices;
+                vertices.reserve(mesh.vertices.size());
+
+                index_list indices(mesh.indices.size());
+                std::vector<uint32_t> remap(triangle_count);
+
+                for (size_t t = 0; t < triangle_count; t++) {
+                    const uint32_t source = order[t];
+                    for (size_t i = 0; i < 3; i++) {
+                        index& v = vertex_remap[mesh.indices[source * 3 + i]];
+                        if (v == unused) {
+                            v = index(vertices.size());
+                            vertices.push_back(mesh.vertices[mesh.indices[source * 3 + i]]);
+                        }
+                        indices[t * 3 + i] = v;
+                    }
+                    remap[t] = primitive_remap[source];
+                }
+
+                mesh.vertices = std::move(vertices);
+                mesh.indices = std::move(indices);
+                primitive_remap = std::move(remap);
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "liblava/resource/mesh.hpp"
+
+// optional host-side pass over mesh data before it's uploaded for a BLAS build
+// - reorders the triangles along a Morton curve through their centroids and the vertices by first use,
+//   so neighbouring primitives are close in memory for attribute fetches in hit shaders
+// - splits long thin triangles at the midpoint of their longest edge until their bounding box fits them better,
+//   new vertices interpolate all attributes of the edge
+// gl_PrimitiveID then refers to the processed triangles, get_primitive_remap() maps them back to the input
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct triangle_preprocessor {
+                using ptr = std::shared_ptr<triangle_preprocessor>;
+
+                void set_reorder(bool enabled) {
+                    reorder = enabled;
+                }
+
+                // triangles are split while the half surface area of their bounding box is more than threshold times their area
+                // max_growth limits the added triangles to this fraction of the input triangle count, 0 disables splitting
+                void set_split(float threshold, float max_growth = 0.5f) {
+                    split_threshold = threshold;
+                    split_max_growth = max_growth;
+                }
+
+                // processes the indexed triangle list in place
+                void process(mesh_data& mesh);
+
+                // input triangle of each output triangle
+                std::vector<uint32_t> const& get_primitive_remap() const {
+                    return primitive_remap;
+                }
+
+                size_t get_split_count() const {
+                    return split_count;
+                }
+
+            private:
+                bool reorder = true;
+                float split_threshold = 8.0f;
+                float split_max_growth = 0.5f;
+
+                std::vector<uint32_t> primitive_remap;
+                size_t split_count = 0;
+
+                void split(mesh_data& mesh);
+                void sort(mesh_data& mesh);
+            };
+
+            inline triangle_preprocessor::ptr make_triangle_preprocessor() {
+                return std::make_shared<triangle_preprocessor>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
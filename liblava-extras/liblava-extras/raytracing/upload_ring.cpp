@@ -0,0 +1,96 @@
+#include "liblava-extras/raytracing/upload_ring.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            bool upload_ring::create(device_p dev, VkDeviceSize size, uint32_t frames, VkBufferUsageFlags usage) {
+                if (size == 0 || frames == 0)
+                    return false;
+
+                device = dev;
+                frame_count = frames;
+
+                // TLAS instances need 16 bytes
+                const VkPhysicalDeviceLimits& limits = device->get_physical_device()->get_properties().limits;
+                default_alignment = std::max({ limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment, VkDeviceSize(16) });
+
+                // regions start aligned, offsets are relative to the buffer start
+                region_size = align_up(size, default_alignment);
+
+                ring_buffer = buffer::make();
+                if (!ring_buffer->create_mapped(device, nullptr, region_size * frame_count,
+                                                usage | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                                    | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                                                    | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                VMA_MEMORY_USAGE_CPU_TO_GPU))
+                    return false;
+                mapped = static_cast<char*>(ring_buffer->get_mapped_data());
+
+                current_frame = 0;
+                offset = 0;
+                flushed = 0;
+
+                return true;
+            }
+
+            void upload_ring::destroy() {
+                if (ring_buffer) {
+                    ring_buffer->destroy();
+                    ring_buffer = nullptr;
+                }
+
+                mapped = nullptr;
+                region_size = 0;
+                frame_count = 0;
+                offset = 0;
+                flushed = 0;
+
+                device = nullptr;
+            }
+
+            void upload_ring::begin_frame(index frame) {
+                current_frame = frame_count > 0 ? frame % frame_count : 0;
+                offset = 0;
+                flushed = 0;
+            }
+
+            upload_ring::allocation upload_ring::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+                if (!ring_buffer || size == 0)
+                    return {};
+
+                // regions are only aligned to the default alignment, larger ones have to be applied to the offset into the buffer
+                const VkDeviceSize region_start = current_frame * region_size;
+                const VkDeviceSize buffer_offset = align_up(region_start + offset, alignment > 0 ? alignment : default_alignment);
+                if (buffer_offset + size > region_start + region_size) {
+                    log()->error("upload ring region of {} bytes is full, can't allocate {} bytes", region_size, size);
+                    return {};
+                }
+
+                offset = buffer_offset + size - region_start;
+
+                return { .data = mapped + buffer_offset,
+                         .offset = buffer_offset,
+                         .address = ring_buffer->get_address() + buffer_offset,
+                         .size = size };
+            }
+
+            upload_ring::allocation upload_ring::upload(const void* data, VkDeviceSize size, VkDeviceSize alignment) {
+                allocation result = allocate(size, alignment);
+                if (result)
+                    memcpy(result.data, data, size);
+                return result;
+            }
+
+            void upload_ring::flush() {
+                if (!ring_buffer || offset <= flushed)
+                    return;
+
+                // VMA rounds the range to nonCoherentAtomSize and skips coherent memory
+                ring_buffer->flush(current_frame * region_size + flushed, offset - flushed);
+                flushed = offset;
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "liblava/resource/buffer.hpp"
+
+// linear allocator for transient per-frame uploads in one persistently mapped buffer
+// uniforms, TLAS instances, SBT records, indirect trace arguments, ... get aligned ranges instead of their own buffers
+// each frame in flight owns one region, begin_frame() reclaims it once that frame's fence signaled
+// write through the mapped pointer and call flush() once after the last allocation of the frame
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct upload_ring {
+                using ptr = std::shared_ptr<upload_ring>;
+
+                struct allocation {
+                    void* data = nullptr;
+                    // offset into get_buffer(), e.g. for dynamic uniform buffer offsets
+                    VkDeviceSize offset = 0;
+                    VkDeviceAddress address = 0;
+                    VkDeviceSize size = 0;
+
+                    explicit operator bool() const {
+                        return data != nullptr;
+                    }
+                };
+
+                ~upload_ring() {
+                    destroy();
+                }
+
+                // region_size is the memory available per frame, frame_count the number of frames in flight
+                // usage is added to the flags every ring buffer gets (uniform, storage, device address, AS build input, indirect, transfer source)
+                bool create(device_p device, VkDeviceSize region_size, uint32_t frame_count = 1, VkBufferUsageFlags usage = 0);
+                void destroy();
+
+                // call once per frame before allocating, with the index of the frame that's being recorded
+                // lava waits for the frame's fence before on_process, so the region can be reused
+                void begin_frame(index frame);
+
+                // alignment applies to the offset into get_buffer(), 0 uses the default alignment, which satisfies uniform and storage buffer offsets and TLAS instances
+                // returns an empty allocation if the region is full
+                allocation allocate(VkDeviceSize size, VkDeviceSize alignment = 0);
+
+                allocation upload(const void* data, VkDeviceSize size, VkDeviceSize alignment = 0);
+
+                template<typename T>
+                allocation upload(const T& value, VkDeviceSize alignment = 0) {
+                    return upload(&value, sizeof(T), alignment);
+                }
+                template<typename T>
+                allocation upload(const std::vector<T>& values, VkDeviceSize alignment = 0) {
+                    return upload(values.data(), sizeof(T) * values.size(), alignment);
+                }
+
+                // makes everything written to the current region visible to the device, a no-op on coherent memory
+                void flush();
+
+                buffer::ptr get_buffer() const {
+                    return ring_buffer;
+                }
+
+                VkDeviceSize get_region_size() const {
+                    return region_size;
+                }
+
+                VkDeviceSize get_alignment() const {
+                    return default_alignment;
+                }
+
+                VkDeviceSize available() const {
+                    return region_size - std::min(region_size, align_up(offset, default_alignment));
+                }
+
+            private:
+                device_p device = nullptr;
+
+                buffer::ptr ring_buffer;
+                char* mapped = nullptr;
+
+                VkDeviceSize region_size = 0;
+                uint32_t frame_count = 0;
+                VkDeviceSize default_alignment = 1;
+
+                index current_frame = 0;
+                VkDeviceSize offset = 0;
+                // part of the current region that was flushed already
+                VkDeviceSize flushed = 0;
+            };
+
+            inline upload_ring::ptr make_upload_ring() {
+                return std::make_shared<upload_ring>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
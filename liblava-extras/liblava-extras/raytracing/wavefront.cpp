@@ -0,0 +1,255 @@
+#include "liblava-extras/raytracing/wavefront.hpp"
+#include "liblava-extras/raytracing/barrier.hpp"
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            namespace {
+
+                // matches wavefront_counter_buffer in wavefront.glsl
+                struct counters {
+                    uint32_t ray_count;
+                    uint32_t next_ray_count;
+                    VkTraceRaysIndirectCommandKHR trace_args;
+                    VkDispatchIndirectCommand scatter_args;
+                    uint32_t traced_rays;
+                };
+
+                // matches wavefront_bin in wavefront.glsl
+                struct bin {
+                    uint32_t count;
+                    uint32_t offset;
+                    uint32_t cursor;
+                };
+
+            } // namespace
+
+            bool wavefront::create(device_p dev, cdata const& shader_data, uint32_t materials) {
+                // file_data() returns nothing for a missing file, e.g. if the shader wasn't compiled
+                if (!shader_data.ptr) {
+                    log()->error("wavefront sort shader data, wavefront_sort.comp has to be compiled to SPIR-V");
+                    return false;
+                }
+
+                if (materials > max_material_count) {
+                    log()->error("wavefront supports at most {} materials", max_material_count);
+                    return false;
+                }
+
+                device = dev;
+                material_count = materials;
+
+                const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+                // host-readable for get_traced_rays(), cleared with vkCmdFillBuffer every frame
+                counter_buffer = buffer::make();
+                if (!counter_buffer->create_mapped(device, nullptr, sizeof(counters),
+                                                   usage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU))
+                    return false;
+
+                bin_buffer = buffer::make();
+                if (!bin_buffer->create(device, nullptr, sizeof(bin) * (material_count + 1) * octant_count, usage, false, VMA_MEMORY_USAGE_GPU_ONLY))
+                    return false;
+
+                dispatch_buffer = buffer::make();
+                if (!dispatch_buffer->create(device, nullptr, sizeof(VkDispatchIndirectCommand) * (material_count + 1),
+                                             usage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, false, VMA_MEMORY_USAGE_GPU_ONLY))
+                    return false;
+
+                sort_layout = pipeline_layout::make();
+                sort_layout->add({ .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT, .offset = 0, .size = sizeof(sort_push_constants) });
+                if (!sort_layout->create(device))
+                    return false;
+
+                sort_pipeline = compute_pipeline::make(device);
+                if (!sort_pipeline->set_shader_stage(shader_data, VK_SHADER_STAGE_COMPUTE_BIT))
+                    return false;
+                sort_pipeline->set_layout(sort_layout);
+                if (!sort_pipeline->create())
+                    return false;
+
+                return true;
+            }
+
+            void wavefront::destroy() {
+                if (sort_pipeline) {
+                    sort_pipeline->destroy();
+                    sort_pipeline = nullptr;
+                }
+
+                if (sort_layout) {
+                    sort_layout->destroy();
+                    sort_layout = nullptr;
+                }
+
+                destroy_queues();
+
+                for (buffer::ptr* buf : { &counter_buffer, &bin_buffer, &dispatch_buffer }) {
+                    if (*buf) {
+                        (*buf)->destroy();
+                        *buf = nullptr;
+                    }
+                }
+
+                material_count = 0;
+                device = nullptr;
+            }
+
+            bool wavefront::resize(uint32_t ray_capacity) {
+                if (ray_capacity == 0 || !sort_pipeline) {
+                    log()->error("wavefront needs a ray capacity and create() before resize()");
+                    return false;
+                }
+
+                destroy_queues();
+
+                const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+                for (buffer::ptr& queue : ray_queues) {
+                    queue = buffer::make();
+                    if (!queue->create(device, nullptr, sizeof(ray) * ray_capacity, usage, false, VMA_MEMORY_USAGE_GPU_ONLY))
+                        return false;
+                }
+
+                hit_buffer = buffer::make();
+                if (!hit_buffer->create(device, nullptr, sizeof(hit) * ray_capacity, usage, false, VMA_MEMORY_USAGE_GPU_ONLY))
+                    return false;
+
+                sorted_buffer = buffer::make();
+                if (!sorted_buffer->create(device, nullptr, sizeof(uint32_t) * ray_capacity, usage, false, VMA_MEMORY_USAGE_GPU_ONLY))
+                    return false;
+
+                capacity = ray_capacity;
+                return true;
+            }
+
+            void wavefront::destroy_queues() {
+                for (buffer::ptr* buf : { &ray_queues[0], &ray_queues[1], &hit_buffer, &sorted_buffer }) {
+                    if (*buf) {
+                        (*buf)->destroy();
+                        *buf = nullptr;
+                    }
+                }
+
+                capacity = 0;
+            }
+
+            void wavefront::record(VkCommandBuffer cmd_buf, const passes& passes, uint32_t bounce_count) {
+                if (!sort_pipeline || capacity == 0 || !passes.trace || !passes.sbt)
+                    return;
+
+                const VkPipelineStageFlags compute = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                const VkPipelineStageFlags trace = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+                const VkPipelineStageFlags indirect = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+                const VkAccessFlags shader_access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+                const auto push = [&](const push_constants& constants) {
+                    device->call().vkCmdPushConstants(cmd_buf, passes.layout, passes.push_constant_stages, passes.push_constant_offset, sizeof(constants), &constants);
+                };
+
+                // the previous frame might still use the queues and counters
+                insert_memory_barrier(device, cmd_buf, shader_access | VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                      compute | trace | indirect, VK_PIPELINE_STAGE_TRANSFER_BIT);
+                device->call().vkCmdFillBuffer(cmd_buf, counter_buffer->get(), 0, VK_WHOLE_SIZE, 0);
+                insert_memory_barrier(device, cmd_buf, VK_ACCESS_TRANSFER_WRITE_BIT, shader_access, VK_PIPELINE_STAGE_TRANSFER_BIT, compute);
+
+                if (passes.generate) {
+                    // emits into the queue traced by the first bounce
+                    push_constants constants = get_push_constants(0, 0);
+                    std::swap(constants.rays, constants.next_rays);
+
+                    passes.generate->bind(cmd_buf);
+                    if (passes.bind)
+                        passes.bind(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE);
+                    push(constants);
+                    device->call().vkCmdDispatch(cmd_buf, passes.generate_groups.x, passes.generate_groups.y, passes.generate_groups.z);
+
+                    insert_memory_barrier(device, cmd_buf, shader_access, shader_access, compute, compute);
+                }
+
+                const VkStridedDeviceAddressRegionKHR raygen_region = passes.sbt->get_raygen_region();
+                const VkStridedDeviceAddressRegionKHR miss_region = passes.sbt->get_miss_region();
+                const VkStridedDeviceAddressRegionKHR hit_region = passes.sbt->get_hit_region();
+                const VkStridedDeviceAddressRegionKHR callable_region = passes.sbt->get_callable_region();
+
+                for (uint32_t bounce = 0; bounce < bounce_count; bounce++) {
+                    const push_constants constants = get_push_constants(bounce, 0);
+
+                    sort(cmd_buf, constants, begin);
+                    insert_memory_barrier(device, cmd_buf, shader_access, shader_access | VK_ACCESS_INDIRECT_COMMAND_READ_BIT, compute, trace | indirect);
+
+                    // one launch index per live ray
+                    passes.trace->bind(cmd_buf);
+                    if (passes.bind)
+                        passes.bind(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR);
+                    push(constants);
+                    device->call().vkCmdTraceRaysIndirectKHR(cmd_buf, &raygen_region, &miss_region, &hit_region, &callable_region,
+                                                             counter_buffer->get_address() + offsetof(counters, trace_args));
+                    insert_memory_barrier(device, cmd_buf, shader_access, shader_access, trace, compute);
+
+                    sort(cmd_buf, constants, prefix);
+                    insert_memory_barrier(device, cmd_buf, shader_access, shader_access | VK_ACCESS_INDIRECT_COMMAND_READ_BIT, compute, compute | indirect);
+
+                    sort(cmd_buf, constants, scatter);
+                    insert_memory_barrier(device, cmd_buf, shader_access, shader_access, compute, compute);
+
+                    // misses are the last bin
+                    for (uint32_t material = 0; material <= material_count && material < passes.shade.size(); material++) {
+                        if (!passes.shade[material])
+                            continue;
+
+                        passes.shade[material]->bind(cmd_buf);
+                        if (passes.bind)
+                            passes.bind(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE);
+                        push(get_push_constants(bounce, material));
+                        device->call().vkCmdDispatchIndirect(cmd_buf, dispatch_buffer->get(), sizeof(VkDispatchIndirectCommand) * material);
+                    }
+
+                    // the next bounce reads the emitted rays and reuses the bins
+                    insert_memory_barrier(device, cmd_buf, shader_access, shader_access, compute, compute);
+                }
+
+                // get_traced_rays() reads the counters once the frame finished
+                insert_memory_barrier(device, cmd_buf, shader_access, VK_ACCESS_HOST_READ_BIT, compute, VK_PIPELINE_STAGE_HOST_BIT);
+            }
+
+            uint32_t wavefront::get_traced_rays() const {
+                if (!counter_buffer)
+                    return 0;
+
+                // GPU_TO_CPU memory is usually cached and might not be coherent
+                vmaInvalidateAllocation(device->alloc(), counter_buffer->get_allocation(), offsetof(counters, traced_rays), sizeof(uint32_t));
+                return static_cast<const counters*>(counter_buffer->get_mapped_data())->traced_rays;
+            }
+
+            wavefront::push_constants wavefront::get_push_constants(uint32_t bounce, uint32_t material) const {
+                return { .rays = ray_queues[bounce % 2]->get_address(),
+                         .next_rays = ray_queues[(bounce + 1) % 2]->get_address(),
+                         .hits = hit_buffer->get_address(),
+                         .sorted = sorted_buffer->get_address(),
+                         .counters = counter_buffer->get_address(),
+                         .bins = bin_buffer->get_address(),
+                         .dispatch = dispatch_buffer->get_address(),
+                         .capacity = capacity,
+                         .material_count = material_count,
+                         .material = material,
+                         .bounce = bounce };
+            }
+
+            void wavefront::sort(VkCommandBuffer cmd_buf, const push_constants& constants, sort_stage stage) {
+                const sort_push_constants sort_constants = { .constants = constants, .stage = stage };
+
+                sort_pipeline->bind(cmd_buf);
+                device->call().vkCmdPushConstants(cmd_buf, sort_layout->get(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sort_constants), &sort_constants);
+
+                // begin and prefix run in one workgroup with an invocation per bin
+                if (stage == scatter)
+                    device->call().vkCmdDispatchIndirect(cmd_buf, counter_buffer->get(), offsetof(counters, scatter_args));
+                else
+                    device->call().vkCmdDispatch(cmd_buf, 1, 1, 1);
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
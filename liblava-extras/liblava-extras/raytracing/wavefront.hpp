@@ -0,0 +1,168 @@
+#pragma once
+
+#include "liblava-extras/raytracing/shader_binding_table.hpp"
+
+// wavefront path tracing: rays live in queues in device memory instead of a per-pixel bounce loop in one raygen shader
+// each bounce traces the whole queue with a minimal raygen shader (indirect launch with the live ray count),
+// bins the hits by material and ray direction octant with a counting sort in compute,
+// then runs one compute shading pass per material over its contiguous range of hits, which writes the rays of the next bounce
+// shading passes see coherent materials and the rays they emit come out grouped by material and direction,
+// so diverging materials and bounce directions no longer serialize each other like in a megakernel
+// shaders include res/raytracing/wavefront.glsl, the sort shader is res/raytracing/wavefront_sort.comp
+
+namespace lava {
+    namespace extras {
+        namespace raytracing {
+
+            struct wavefront {
+                using ptr = std::shared_ptr<wavefront>;
+
+                // material bins are split by the 8 direction octants, the sort shader handles 256 bins
+                static constexpr uint32_t octant_count = 8;
+                static constexpr uint32_t max_material_count = 256 / octant_count - 1;
+
+                // matches wavefront_ray in wavefront.glsl (scalar layout)
+                struct ray {
+                    glm::vec3 origin;
+                    float t_min;
+                    glm::vec3 direction;
+                    float t_max;
+                    glm::vec3 throughput;
+                    uint32_t pixel;
+                };
+
+                // matches wavefront_hit in wavefront.glsl, written by the raygen shader
+                struct hit {
+                    glm::vec3 normal; // world space
+                    float t; // negative for misses
+                    glm::vec2 barycentrics;
+                    uint32_t instance; // gl_InstanceID
+                    uint32_t custom_index; // gl_InstanceCustomIndexEXT + gl_GeometryIndexEXT
+                    uint32_t primitive;
+                    uint32_t material; // material_count for misses
+                    uint32_t ray; // index in the ray queue
+                    uint32_t key; // sort bin
+                };
+
+                static_assert(sizeof(ray) == 48);
+                static_assert(sizeof(hit) == 48);
+
+                // matches wavefront_constants in wavefront.glsl
+                // pushed to every pass at the offset passed to record(), add a range of this size to the pipeline layout
+                struct push_constants {
+                    VkDeviceAddress rays;
+                    VkDeviceAddress next_rays;
+                    VkDeviceAddress hits;
+                    VkDeviceAddress sorted;
+                    VkDeviceAddress counters;
+                    VkDeviceAddress bins;
+                    VkDeviceAddress dispatch;
+                    uint32_t capacity;
+                    uint32_t material_count;
+                    uint32_t material; // of the shading pass
+                    uint32_t bounce;
+                };
+
+                // binds descriptor sets or pushes other constants, called after each pipeline bind
+                using bind_func = std::function<void(VkCommandBuffer cmd_buf, VkPipelineBindPoint bind_point)>;
+
+                struct passes {
+                    // writes the primary rays with wavefront_emit_ray()
+                    compute_pipeline::ptr generate;
+                    glm::uvec3 generate_groups = { 1, 1, 1 };
+
+                    // raygen traces the ray at gl_LaunchIDEXT.x and stores the hit with wavefront_store_hit()
+                    raytracing_pipeline::ptr trace;
+                    shader_binding_table::ptr sbt;
+
+                    // one pipeline per material, index material_count shades misses
+                    // nullptr skips the bin, e.g. when misses don't contribute
+                    std::vector<compute_pipeline::ptr> shade;
+
+                    // shared by all passes, with a push constant range for all used stages
+                    VkPipelineLayout layout = VK_NULL_HANDLE;
+                    uint32_t push_constant_offset = 0;
+                    VkShaderStageFlags push_constant_stages = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+
+                    bind_func bind;
+                };
+
+                ~wavefront() {
+                    destroy();
+                }
+
+                // shader_data is the SPIR-V of wavefront_sort.comp
+                // creates the sort pipeline and the per-material buffers, call resize() before record()
+                bool create(device_p device, cdata const& shader_data, uint32_t material_count);
+                bool create(device_p device, cdata const& shader_data, uint32_t capacity, uint32_t material_count) {
+                    return create(device, shader_data, material_count) && resize(capacity);
+                }
+                void destroy();
+
+                // capacity is the maximum number of rays per bounce, e.g. the pixel count
+                // recreates the ray queues, the previous ones must no longer be in use, e.g. after vkDeviceWaitIdle
+                bool resize(uint32_t capacity);
+
+                // records the primary ray generation and bounce_count bounces of trace, sort and shade
+                // rays emitted by the shading passes of the last bounce are dropped
+                // waits for the previous record() in the same queue, the queues aren't duplicated per frame in flight
+                void record(VkCommandBuffer cmd_buf, const passes& passes, uint32_t bounce_count);
+
+                // rays traced by the last recorded frame, only exact if no later frame is in flight
+                uint32_t get_traced_rays() const;
+
+                uint32_t get_capacity() const {
+                    return capacity;
+                }
+
+                uint32_t get_material_count() const {
+                    return material_count;
+                }
+
+            private:
+                device_p device = nullptr;
+
+                uint32_t capacity = 0;
+                uint32_t material_count = 0;
+
+                // rays of the current and the next bounce swap every bounce
+                std::array<buffer::ptr, 2> ray_queues;
+                buffer::ptr hit_buffer;
+                // hit indices ordered by bin
+                buffer::ptr sorted_buffer;
+                // counts, VkTraceRaysIndirectCommandKHR and VkDispatchIndirectCommand for the scatter pass
+                buffer::ptr counter_buffer;
+                // count, offset and cursor of each bin
+                buffer::ptr bin_buffer;
+                // VkDispatchIndirectCommand of each shading pass
+                buffer::ptr dispatch_buffer;
+
+                pipeline_layout::ptr sort_layout;
+                compute_pipeline::ptr sort_pipeline;
+
+                enum sort_stage : uint32_t {
+                    // takes over the emitted rays and clears the bins
+                    begin = 0,
+                    // prefix sum over the bin counts and shading dispatch sizes
+                    prefix,
+                    // writes the hit indices into their bin's range
+                    scatter
+                };
+
+                struct sort_push_constants {
+                    push_constants constants;
+                    uint32_t stage;
+                };
+
+                void destroy_queues();
+                push_constants get_push_constants(uint32_t bounce, uint32_t material) const;
+                void sort(VkCommandBuffer cmd_buf, const push_constants& constants, sort_stage stage);
+            };
+
+            inline wavefront::ptr make_wavefront() {
+                return std::make_shared<wavefront>();
+            }
+
+        } // namespace raytracing
+    } // namespace extras
+} // namespace lava
@@ -0,0 +1,5 @@
+@ECHO on
+
+glslangValidator -V -o denoise.spv denoise.comp
+glslangValidator -V -o instance_generator.spv instance_generator.comp
+glslangValidator -V -o wavefront_sort.spv wavefront_sort.comp
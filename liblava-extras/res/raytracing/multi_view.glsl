@@ -0,0 +1,20 @@
+// include in raygen shaders traced with multi_view, needs GL_EXT_buffer_reference
+// views[gl_LaunchIDEXT.z] is the camera of the current view, write to layer gl_LaunchIDEXT.z of an image2DArray
+
+struct view {
+    mat4 inv_view;
+    mat4 inv_proj;
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer view_buffer {
+    view views[];
+};
+
+// world space ray through the pixel center of the current launch
+void multi_view_ray(view_buffer buf, out vec3 origin, out vec3 direction) {
+    const view v = buf.views[gl_LaunchIDEXT.z];
+    const vec2 uv = (vec2(gl_LaunchIDEXT.xy) + 0.5) / vec2(gl_LaunchSizeEXT.xy);
+    const vec4 target = v.inv_proj * vec4(uv * 2.0 - 1.0, 1.0, 1.0);
+    origin = (v.inv_view * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+    direction = normalize((v.inv_view * vec4(normalize(target.xyz), 0.0)).xyz);
+}
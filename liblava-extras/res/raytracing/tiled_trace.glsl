@@ -0,0 +1,19 @@
+// include in raygen shaders traced with tiled_tracer
+// gl_LaunchIDEXT.xy is the pixel inside the tile, write it to layer tile.layer of an image2DArray
+
+// matches tiled_tracer::push_constants, declare it at the offset passed to render()
+struct tile_constants {
+    uvec2 offset;
+    uvec2 image_size;
+    uint layer;
+};
+
+// pixel coordinates in the full image
+uvec2 tile_pixel(tile_constants tile) {
+    return tile.offset + gl_LaunchIDEXT.xy;
+}
+
+// normalized coordinates of the pixel center in the full image, replaces gl_LaunchIDEXT / gl_LaunchSizeEXT
+vec2 tile_uv(tile_constants tile) {
+    return (vec2(tile_pixel(tile)) + 0.5) / vec2(tile.image_size);
+}
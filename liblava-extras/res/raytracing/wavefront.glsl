@@ -0,0 +1,131 @@
+// include in all passes of a wavefront path tracer, see wavefront.hpp
+// needs GL_EXT_scalar_block_layout and GL_EXT_buffer_reference
+// declare wavefront_constants in the push constant block at the offset passed to wavefront::record()
+
+#ifndef WAVEFRONT_GLSL_HEADER_GUARD
+#define WAVEFRONT_GLSL_HEADER_GUARD
+
+#define WAVEFRONT_OCTANTS 8
+// local size of the shading passes, the dispatch sizes are calculated for it
+#define WAVEFRONT_GROUP_SIZE 64
+
+// matches wavefront::ray
+struct wavefront_ray {
+    vec3 origin;
+    float t_min;
+    vec3 direction;
+    float t_max;
+    vec3 throughput;
+    uint pixel;
+};
+
+// matches wavefront::hit
+struct wavefront_hit {
+    vec3 normal; // world space
+    float t; // negative for misses
+    vec2 barycentrics;
+    uint instance; // gl_InstanceID
+    uint custom_index; // gl_InstanceCustomIndexEXT + gl_GeometryIndexEXT
+    uint primitive;
+    uint material; // material_count for misses
+    uint ray; // index in the ray queue
+    uint key; // sort bin
+};
+
+struct wavefront_bin {
+    uint count;
+    uint offset; // first slot in the sorted indices
+    uint cursor; // next free slot while scattering
+};
+
+layout (buffer_reference, scalar) buffer wavefront_ray_buffer {
+    wavefront_ray rays[];
+};
+
+layout (buffer_reference, scalar) buffer wavefront_hit_buffer {
+    wavefront_hit hits[];
+};
+
+layout (buffer_reference, scalar) buffer wavefront_index_buffer {
+    uint indices[];
+};
+
+layout (buffer_reference, scalar) buffer wavefront_counter_buffer {
+    uint ray_count; // rays traced in this bounce
+    uint next_ray_count; // rays emitted for the next bounce, can exceed the capacity
+    uvec3 trace_args; // VkTraceRaysIndirectCommandKHR
+    uvec3 scatter_args; // VkDispatchIndirectCommand
+    uint traced_rays;
+};
+
+layout (buffer_reference, scalar) buffer wavefront_bin_buffer {
+    wavefront_bin bins[];
+};
+
+// VkDispatchIndirectCommand per material
+layout (buffer_reference, scalar) buffer wavefront_dispatch_buffer {
+    uvec3 dispatch[];
+};
+
+// matches wavefront::push_constants
+struct wavefront_constants {
+    wavefront_ray_buffer rays;
+    wavefront_ray_buffer next_rays;
+    wavefront_hit_buffer hits;
+    wavefront_index_buffer sorted;
+    wavefront_counter_buffer counters;
+    wavefront_bin_buffer bins;
+    wavefront_dispatch_buffer dispatch;
+    uint capacity;
+    uint material_count;
+    uint material; // of the shading pass
+    uint bounce;
+};
+
+uint wavefront_octant(vec3 direction) {
+    return (direction.x < 0.0 ? 1u : 0u) | (direction.y < 0.0 ? 2u : 0u) | (direction.z < 0.0 ? 4u : 0u);
+}
+
+// raygen: trace the ray at gl_LaunchIDEXT.x, the launch size is the live ray count
+wavefront_ray wavefront_load_ray(wavefront_constants wf, uint index) {
+    return wf.rays.rays[index];
+}
+
+// raygen: store the hit of ray index and count it in its bin
+// set hit.t < 0 and hit.material = wf.material_count for misses
+void wavefront_store_hit(wavefront_constants wf, uint index, wavefront_hit hit) {
+    hit.material = min(hit.material, wf.material_count);
+    hit.ray = index;
+    hit.key = hit.material * WAVEFRONT_OCTANTS + wavefront_octant(wf.rays.rays[index].direction);
+    wf.hits.hits[index] = hit;
+    atomicAdd(wf.bins.bins[hit.key].count, 1);
+}
+
+// shading: number of hits with the material of this pass
+uint wavefront_hit_count(wavefront_constants wf) {
+    uint first = wf.material * WAVEFRONT_OCTANTS;
+    uint last = first + WAVEFRONT_OCTANTS - 1;
+    return wf.bins.bins[last].offset + wf.bins.bins[last].count - wf.bins.bins[first].offset;
+}
+
+// shading: i-th hit of this pass in sorted order, i < wavefront_hit_count()
+wavefront_hit wavefront_load_hit(wavefront_constants wf, uint i) {
+    uint slot = wf.bins.bins[wf.material * WAVEFRONT_OCTANTS].offset + i;
+    return wf.hits.hits[wf.sorted.indices[slot]];
+}
+
+// shading: ray that produced the hit
+wavefront_ray wavefront_hit_ray(wavefront_constants wf, wavefront_hit hit) {
+    return wf.rays.rays[hit.ray];
+}
+
+// generate and shading: add a ray to the next bounce, false if the queue is full
+bool wavefront_emit_ray(wavefront_constants wf, wavefront_ray ray) {
+    uint slot = atomicAdd(wf.counters.next_ray_count, 1);
+    if (slot >= wf.capacity)
+        return false;
+    wf.next_rays.rays[slot] = ray;
+    return true;
+}
+
+#endif // WAVEFRONT_GLSL_HEADER_GUARD